@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include "menon.h"
+#include "../pipeline/wavefront.hpp"
+#include "../refining/adaptive.hpp"
+#include "../refining/lowpass.hpp"
+#include "../refining/refine.hpp"
+#include "../service/pattern.hpp"
+#include "../support/rgb.hpp"
+#include "../support/scheduler.hpp"
+
+struct menon_context {
+    menon_options options;
+};
+
+namespace {
+
+    // Non-owning bitmap of row x
+    Bitmap RowView(const Bitmap& b, size_t x) {
+        size_t row_bytes = b.Width() * b.BytesPerPixel();
+        return Bitmap(1, b.Width(), b.BytesPerPixel(),
+                      const_cast<uint8_t*>(b.Data()) + x * row_bytes, [](uint8_t*) {});
+    }
+
+    uint16_t* Row(uint16_t* data, size_t stride, size_t x) {
+        return reinterpret_cast<uint16_t*>(reinterpret_cast<uint8_t*>(data) + x * stride);
+    }
+
+    const uint16_t* Row(const uint16_t* data, size_t stride, size_t x) {
+        return reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(data) + x * stride);
+    }
+
+    bool ValidMosaic(const uint16_t* mosaic, size_t height, size_t width, size_t stride) {
+        return mosaic != nullptr && height > 0 && width > 0
+               && width <= std::numeric_limits<size_t>::max() / 6 / height
+               && stride >= width * sizeof(uint16_t);
+    }
+
+#if defined(REFINE)
+    // Rows of a task of the refining
+    constexpr size_t kRefineBandRows = 64;
+
+    // Calls body(region) for the bands of rows of an h x w frame in 'threads' threads
+    template <typename Body>
+    void ForEachBand(size_t h, size_t w, size_t threads, const Body& body) {
+        size_t bands = (h + kRefineBandRows - 1) / kRefineBandRows;
+        sched::ParallelFor(bands, threads, [&](size_t i) {
+            body(Region::Rows(i * kRefineBandRows, std::min((i + 1) * kRefineBandRows, h), w));
+        });
+    }
+
+    // The refining of menon::Demosaicing (menon.hpp) with the same defines.
+    // Every stage runs by bands in the threads of the context: the stages of
+    // lowpass.cpp and refine.cpp for the whole frame start threads of their own.
+    // The low-pass is not computed concurrently with the wavefront here:
+    // a detached thread reading the mosaic must not outlive a failed call
+    void Refine(const Bitmap& cfa, menon::Layers& layers, size_t threads) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+        auto& green = layers.green;
+        auto& rb = layers.rb;
+        const auto& diff = layers.diff;
+#if defined(REFINE16)
+        auto lpVH = BitmapVH::Create(h, w, sizeof(uint16_t));
+        ForEachBand(h, w, threads, [&](const Region& band) { lp::FilterVH16Region(cfa, lpVH, band); });
+#else
+        auto lpVH = BitmapVH::Create(h, w, sizeof(int));
+        ForEachBand(h, w, threads, [&](const Region& band) { lp::FilterVHRegion(cfa, lpVH, band); });
+#endif
+#if defined(ADAPTIVE_REFINE)
+        refine::AdaptiveRefine(green, rb, lpVH, diff, threads);
+#else
+        // High-pass of green reads green around the band: all of it is found
+        // before RefineGonRB changes green
+#if defined(REFINE16)
+        Bitmap hpG(h, w, sizeof(int16_t));
+        Bitmap hpRR(h, w, sizeof(int16_t));
+        ForEachBand(h, w, threads, [&](const Region& band) {
+            lp::HighpassG16Region(lpVH, green, diff, hpG, band);
+            lp::HighpassRonR16Region(rb, diff, hpRR, band);
+        });
+        ForEachBand(h, w, threads, [&](const Region& band) {
+            refine::RefineGonRB16Region(green, hpG, hpRR, band);
+            refine::RefineRBonRB16Region(rb, hpRR, diff, band);
+        });
+#else
+        Bitmap hpG(h, w, sizeof(int));
+        Bitmap hpRR(h, w, sizeof(int));
+        ForEachBand(h, w, threads, [&](const Region& band) {
+            lp::HighpassGRegion(lpVH, green, diff, hpG, band);
+            lp::HighpassRonRRegion(rb, diff, hpRR, band);
+        });
+        ForEachBand(h, w, threads, [&](const Region& band) {
+            refine::RefineGonRBRegion(green, hpG, hpRR, band);
+            refine::RefineRBonRBRegion(rb, hpRR, diff, band);
+        });
+#endif
+#endif
+    }
+#endif
+
+    // Runs the wavefront on the mosaic and calls write(layers, x, dest_x, reversed)
+    // for every final row x, where dest_x and reversed undo the mirroring to the native pattern.
+    // With REFINE rows are final when the whole frame is refined
+    template <typename Write>
+    int Run(const menon_context* context, const uint16_t* mosaic, size_t height, size_t width,
+            size_t stride, Write write) {
+        const menon_options& options = context->options;
+        auto mirrors = service::MirrorsToNative(static_cast<service::Pattern>(options.pattern));
+        if (!service::CanMirror(height, width, mirrors)) {
+            return MENON_ERROR_ARGUMENT;
+        }
+
+        try {
+            Bitmap cfa;
+            size_t row_bytes = width * sizeof(uint16_t);
+            bool in_place = (options.flags & MENON_INPUT_PADDED) != 0 && stride == row_bytes
+                            && !mirrors.rows && !mirrors.columns;
+            if (in_place) {
+                cfa = Bitmap(height, width, sizeof(uint16_t),
+                             reinterpret_cast<uint8_t*>(const_cast<uint16_t*>(mosaic)), [](uint8_t*) {});
+            }
+            else {
+                cfa = Bitmap(height, width, sizeof(uint16_t));
+                for (size_t x = 0; x < height; ++x) {
+                    std::memcpy(cfa.Data() + x * row_bytes, Row(mosaic, stride, x), row_bytes);
+                }
+                service::MirrorBitmap(cfa, mirrors);
+            }
+
+            menon::BandOutput output = [&](const menon::Layers& layers, size_t begin, size_t end) {
+                for (size_t x = begin; x < end; ++x) {
+                    write(layers, x, mirrors.rows ? height - 1 - x : x, mirrors.columns);
+                }
+            };
+            size_t threads = options.threads == 0 ? sched::DefaultThreads() : options.threads;
+            size_t band_rows = options.band_rows == 0 ? menon::kWavefrontBandRows : options.band_rows;
+#if defined(REFINE)
+            auto layers = menon::InterpolateWavefront(cfa, threads, band_rows, nullptr, menon::Keep::RESULT);
+            Refine(cfa, layers, threads);
+            output(layers, 0, height);
+#else
+            menon::InterpolateWavefront(cfa, threads, band_rows, output, menon::Keep::RESULT);
+#endif
+        }
+        catch (const std::bad_alloc&) {
+            return MENON_ERROR_MEMORY;
+        }
+        catch (const std::invalid_argument&) {
+            return MENON_ERROR_ARGUMENT;
+        }
+        catch (...) {
+            return MENON_ERROR_INTERNAL;
+        }
+        return MENON_OK;
+    }
+} // namespace
+
+extern "C" {
+
+int menon_api_version(void) {
+    return MENON_API_VERSION;
+}
+
+const char* menon_status_string(int status) {
+    switch (status) {
+        case MENON_OK:             return "ok";
+        case MENON_ERROR_ARGUMENT: return "invalid argument";
+        case MENON_ERROR_MEMORY:   return "out of memory";
+        case MENON_ERROR_INTERNAL: return "internal error";
+    }
+    return "unknown status";
+}
+
+menon_options menon_default_options(void) {
+    return menon_options{0, 0, static_cast<uint32_t>(service::NativePattern()), 0};
+}
+
+int menon_create(const menon_options* options, menon_context** context) {
+    if (context == nullptr) {
+        return MENON_ERROR_ARGUMENT;
+    }
+    *context = nullptr;
+    menon_options chosen = options != nullptr ? *options : menon_default_options();
+    if (chosen.pattern > MENON_PATTERN_BGGR || (chosen.flags & ~MENON_INPUT_PADDED) != 0
+        || chosen.threads > MENON_MAX_THREADS) {
+        return MENON_ERROR_ARGUMENT;
+    }
+    *context = new (std::nothrow) menon_context{chosen};
+    return *context != nullptr ? MENON_OK : MENON_ERROR_MEMORY;
+}
+
+void menon_destroy(menon_context* context) {
+    delete context;
+}
+
+int menon_demosaic(const menon_context* context,
+                   const uint16_t* mosaic, size_t height, size_t width, size_t mosaic_stride,
+                   uint16_t* rgb, size_t rgb_stride) {
+    if (context == nullptr || !ValidMosaic(mosaic, height, width, mosaic_stride)
+        || rgb == nullptr || rgb_stride < width * 3 * sizeof(uint16_t)) {
+        return MENON_ERROR_ARGUMENT;
+    }
+    return Run(context, mosaic, height, width, mosaic_stride,
+               [&](const menon::Layers& layers, size_t x, size_t dest_x, bool reversed) {
+        uint16_t* dest = Row(rgb, rgb_stride, dest_x);
+        if (!reversed) {
+            rgb::PackRGB(RowView(layers.rb.V, x), RowView(layers.green, x), RowView(layers.rb.H, x), dest);
+            return;
+        }
+        auto r = reinterpret_cast<const uint16_t*>(layers.rb.V.Data()) + x * width;
+        auto g = reinterpret_cast<const uint16_t*>(layers.green.Data()) + x * width;
+        auto b = reinterpret_cast<const uint16_t*>(layers.rb.H.Data()) + x * width;
+        for (size_t y = 0; y < width; ++y) {
+            size_t i = 3 * (width - 1 - y);
+            dest[i]     = r[y];
+            dest[i + 1] = g[y];
+            dest[i + 2] = b[y];
+        }
+    });
+}
+
+int menon_demosaic_planar(const menon_context* context,
+                          const uint16_t* mosaic, size_t height, size_t width, size_t mosaic_stride,
+                          uint16_t* red, uint16_t* green, uint16_t* blue, size_t plane_stride) {
+    if (context == nullptr || !ValidMosaic(mosaic, height, width, mosaic_stride)
+        || red == nullptr || green == nullptr || blue == nullptr || plane_stride < width * sizeof(uint16_t)) {
+        return MENON_ERROR_ARGUMENT;
+    }
+    return Run(context, mosaic, height, width, mosaic_stride,
+               [&](const menon::Layers& layers, size_t x, size_t dest_x, bool reversed) {
+        const Bitmap* layer[3] = {&layers.rb.V, &layers.green, &layers.rb.H};
+        uint16_t* planes[3] = {red, green, blue};
+        for (size_t c = 0; c < 3; ++c) {
+            auto src = reinterpret_cast<const uint16_t*>(layer[c]->Data()) + x * width;
+            uint16_t* dest = Row(planes[c], plane_stride, dest_x);
+            if (reversed) {
+                std::reverse_copy(src, src + width, dest);
+            }
+            else {
+                std::memcpy(dest, src, width * sizeof(uint16_t));
+            }
+        }
+    });
+}
+
+} // extern "C"
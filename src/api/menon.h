@@ -0,0 +1,108 @@
+/*
+ * C API of the Menon demosaicing (libmenon.so) for calls from other languages
+ * in the same process (Python ctypes/cffi, Go cgo, ...).
+ *
+ * The caller owns all memory: the mosaic is read from the given buffer and
+ * the result is written to the given buffers, rows as soon as they are final.
+ * The pixels are the ones of the menon executable built with the same defines:
+ * with REFINE the rows are written when the whole frame is refined.
+ * The library keeps no pointers after a call returns.
+ *
+ *      menon_options options = menon_default_options();
+ *      options.pattern = MENON_PATTERN_RGGB;
+ *      menon_context* context;
+ *      if (menon_create(&options, &context) != MENON_OK) { ... }
+ *      int status = menon_demosaic(context, mosaic, height, width, mosaic_stride,
+ *                                  rgb, rgb_stride);
+ *      menon_destroy(context);
+ *
+ * A context does not change after menon_create, so it may be used by any number
+ * of threads at once. Every call runs its own pipeline in 'threads' threads.
+ *
+ * Strides are in bytes. Samples are 16-bit in the native byte order.
+ */
+#ifndef MENON_H
+#define MENON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Changes only with incompatible changes of the API */
+#define MENON_API_VERSION 1
+
+#define MENON_EXPORT __attribute__((visibility("default")))
+
+typedef struct menon_context menon_context;
+
+typedef enum menon_status {
+    MENON_OK = 0,
+    MENON_ERROR_ARGUMENT = 1, /* null pointers, sizes or strides */
+    MENON_ERROR_MEMORY = 2,
+    MENON_ERROR_INTERNAL = 3,
+} menon_status;
+
+/* Colors of the top left 2x2 block */
+typedef enum menon_pattern {
+    MENON_PATTERN_RGGB = 0,
+    MENON_PATTERN_GRBG = 1,
+    MENON_PATTERN_GBRG = 2,
+    MENON_PATTERN_BGGR = 3,
+} menon_pattern;
+
+/*
+ * The mosaic buffer has 16 readable bytes after its last pixel, so it is read
+ * in place. Without the flag, or if the rows are not contiguous
+ * (mosaic_stride != width * 2), the mosaic is copied once.
+ */
+#define MENON_INPUT_PADDED 1u
+
+/* Largest number of threads of a call */
+#define MENON_MAX_THREADS 1024
+
+typedef struct menon_options {
+    uint32_t threads;   /* 0 - all hardware threads, at most MENON_MAX_THREADS */
+    uint32_t band_rows; /* rows of a task, 0 - the default */
+    uint32_t pattern;   /* menon_pattern of the mosaics */
+    uint32_t flags;     /* MENON_INPUT_PADDED */
+} menon_options;
+
+MENON_EXPORT int menon_api_version(void);
+
+/* Text of a menon_status */
+MENON_EXPORT const char* menon_status_string(int status);
+
+/* All threads, the default band and the pattern the library is built for */
+MENON_EXPORT menon_options menon_default_options(void);
+
+/*
+ * Creates a context. 'options' may be NULL for the defaults.
+ * Other patterns than the native one (see menon_default_options) are mirrored
+ * to it: the mosaic is copied, and its height (upside down patterns) or width
+ * (patterns mirrored left to right) must be even
+ */
+MENON_EXPORT int menon_create(const menon_options* options, menon_context** context);
+
+MENON_EXPORT void menon_destroy(menon_context* context);
+
+/*
+ * Demosaics height x width 'mosaic' to interleaved 'rgb' (R, G, B of a pixel
+ * one after another), rgb_stride >= width * 6
+ */
+MENON_EXPORT int menon_demosaic(const menon_context* context,
+                                const uint16_t* mosaic, size_t height, size_t width, size_t mosaic_stride,
+                                uint16_t* rgb, size_t rgb_stride);
+
+/* The same writing three planes with one stride, plane_stride >= width * 2 */
+MENON_EXPORT int menon_demosaic_planar(const menon_context* context,
+                                       const uint16_t* mosaic, size_t height, size_t width, size_t mosaic_stride,
+                                       uint16_t* red, uint16_t* green, uint16_t* blue, size_t plane_stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MENON_H */
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../menon.hpp"
+#include "../support/perf.hpp"
+
+// Throughput and thread scaling of menon::Demosaicing on synthetic mosaics
+// Prints a JSON report to track it release to release:
+//      menon_bench [--max-mp <megapixels>] [--repeats <n>] [--output <file.json>]
+// menon_bench_refine is the same with define REFINE
+
+void PrintHelpUsage() {
+    std::cout << "Usage: menon_bench [options]\n"
+                 "Options:\n"
+                 "  --max-mp <megapixels>     largest resolution of the sweep (default 200)\n"
+                 "  --repeats <n>             runs of every point, the fastest one counts (default 3)\n"
+                 "  --output <file>           write the JSON report to the file (default stdout)\n";
+}
+
+struct Options {
+    size_t max_megapixels{200};
+    size_t repeats{3};
+    const char* output{nullptr};
+};
+
+// Returns false if arguments are wrong
+bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--max-mp" && i + 1 < argc) {
+            options.max_megapixels = std::stoul(argv[++i]);
+        }
+        else if (arg == "--repeats" && i + 1 < argc) {
+            options.repeats = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            options.output = argv[++i];
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Resolutions of the sweep in megapixels
+constexpr size_t kMegapixels[] = {1, 4, 16, 64, 200};
+
+// Rough peak memory of Demosaicing per pixel: the mosaic, the layers,
+// temporaries and the result (with refining also 32-bit filters, 16-bit with REFINE16)
+#if defined(REFINE) && defined(REFINE16)
+constexpr size_t kBytesPerPixelEstimate = 48;
+#elif defined(REFINE)
+constexpr size_t kBytesPerPixelEstimate = 64;
+#else
+constexpr size_t kBytesPerPixelEstimate = 32;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////
+// Bandwidth:
+
+// Items of a STREAM array: up to 256 MB per array, all three within a quarter
+// of the available memory, and at least 16 MB per array to exceed the caches
+constexpr size_t kStreamMaxItems = size_t{1} << 25;
+constexpr size_t kStreamMinItems = size_t{1} << 21;
+
+// STREAM triad a = b + s * c over arrays much larger than caches
+// Returns the best bandwidth of several runs in GB/s (3 arrays are moved),
+// 0 if there is not enough memory for the arrays
+double MeasureStreamBandwidth(size_t threads) {
+    constexpr size_t kRuns = 5;
+    size_t available = mem::AvailableMemory();
+    size_t items = kStreamMaxItems;
+    if (available != 0) {
+        items = std::min(items, available / 4 / (3 * sizeof(double)));
+    }
+    if (items < kStreamMinItems) {
+        return 0;
+    }
+    std::vector<double> a, b, c;
+    try {
+        a.resize(items);
+        b.resize(items, 1.0);
+        c.resize(items, 2.0);
+    }
+    catch (const std::bad_alloc&) {
+        return 0;
+    }
+
+    auto triad = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+    };
+    double best = 0;
+    for (size_t run = 0; run < kRuns; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        size_t part = (items + threads - 1) / threads;
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back(triad, std::min(i * part, items), std::min((i + 1) * part, items));
+        }
+        triad(0, std::min(part, items));
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        best = std::max(best, 3.0 * items * sizeof(double) / seconds.count() / 1e9);
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Sweep:
+
+struct Point {
+    size_t megapixels;
+    size_t height, width;
+    size_t threads;
+    double seconds;             // the fastest run
+    // LLC misses * line: demand misses only, without writebacks and prefetches,
+    // so a lower bound of the memory traffic. < 0 - unknown
+    double llc_miss_bytes_per_pixel;
+};
+
+// Demosaicing prints the stage times: keep the report clean
+class MuteOutput {
+public:
+    MuteOutput() : saved_{std::cout.rdbuf(&null_)} {}
+    ~MuteOutput() { std::cout.rdbuf(saved_); }
+
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+    NullBuffer null_;
+    std::streambuf* saved_;
+};
+
+constexpr double kCacheLine = 64;
+
+Point Measure(const Bitmap& mosaic, size_t megapixels, size_t threads, size_t repeats) {
+    auto tuning = menon::CurrentTuning();
+    tuning.threads = threads;
+    menon::SetTuning(tuning);
+
+    Point point{megapixels, mosaic.Height(), mosaic.Width(), threads, 0, -1};
+    perf::Values begin, end;
+    std::array<bool, perf::kCounters> valid_begin, valid_end;
+    perf::Read(begin, valid_begin);
+    for (size_t i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            MuteOutput mute;
+            auto image = menon::Demosaicing(mosaic);
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        if (i == 0 || seconds.count() < point.seconds) {
+            point.seconds = seconds.count();
+        }
+    }
+    perf::Read(end, valid_end);
+    if (valid_begin[perf::LLC_MISSES] && valid_end[perf::LLC_MISSES]) {
+        double misses = static_cast<double>(end[perf::LLC_MISSES] - begin[perf::LLC_MISSES]) / repeats;
+        point.llc_miss_bytes_per_pixel = misses * kCacheLine / (mosaic.Height() * mosaic.Width());
+    }
+    return point;
+}
+
+std::vector<size_t> ThreadCounts() {
+    std::vector<size_t> counts;
+    size_t hardware = sched::HardwareThreads();
+    for (size_t threads = 1; threads < hardware; threads <<= 1) {
+        counts.push_back(threads);
+    }
+    counts.push_back(hardware);
+    return counts;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Report:
+
+void WriteNumberOrNull(std::ostream& out, double value, bool known) {
+    if (known) {
+        out << value;
+    }
+    else {
+        out << "null";
+    }
+}
+
+void WriteReport(std::ostream& out, double stream_gbps, const std::vector<Point>& points,
+                 const std::vector<std::pair<size_t, std::string>>& skipped) {
+    out << "{\n";
+    out << "  \"benchmark\": \"menon_demosaicing\",\n";
+#if defined(REFINE)
+    out << "  \"refine\": true,\n";
+#else
+    out << "  \"refine\": false,\n";
+#endif
+#if defined(REFINE16)
+    out << "  \"refine16\": true,\n";
+#else
+    out << "  \"refine16\": false,\n";
+#endif
+#if defined(ADAPTIVE_REFINE)
+    out << "  \"adaptive_refine\": true,\n";
+#else
+    out << "  \"adaptive_refine\": false,\n";
+#endif
+#if defined(WAVEFRONT)
+    out << "  \"wavefront\": true,\n";
+#else
+    out << "  \"wavefront\": false,\n";
+#endif
+#if defined(SIMD)
+    out << "  \"simd\": true,\n";
+#else
+    out << "  \"simd\": false,\n";
+#endif
+    out << "  \"hardware_threads\": " << sched::HardwareThreads() << ",\n";
+    out << "  \"stream_triad_gbps\": ";
+    WriteNumberOrNull(out, stream_gbps, stream_gbps > 0);
+    out << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < points.size(); ++i) {
+        const auto& p = points[i];
+        // Speedup against one thread on the same resolution
+        double single = p.seconds;
+        for (const auto& q : points) {
+            if (q.megapixels == p.megapixels && q.threads == 1) {
+                single = q.seconds;
+            }
+        }
+        double pixels = static_cast<double>(p.height) * p.width;
+        double speedup = single / p.seconds;
+        bool traffic_known = p.llc_miss_bytes_per_pixel >= 0;
+        // Lower bounds, as the traffic they are computed of
+        double bandwidth = p.llc_miss_bytes_per_pixel * pixels / p.seconds / 1e9;
+
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"megapixels\": " << p.megapixels
+            << ", \"height\": " << p.height
+            << ", \"width\": " << p.width
+            << ", \"threads\": " << p.threads
+            << ", \"seconds\": " << p.seconds
+            << ", \"mpps\": " << pixels / 1e6 / p.seconds
+            << ", \"speedup\": " << speedup
+            << ", \"efficiency\": " << speedup / p.threads
+            << ", \"llc_miss_bytes_per_pixel\": ";
+        WriteNumberOrNull(out, p.llc_miss_bytes_per_pixel, traffic_known);
+        out << ", \"min_bandwidth_gbps\": ";
+        WriteNumberOrNull(out, bandwidth, traffic_known);
+        // Close to 1 - the run is bound by the memory bandwidth
+        out << ", \"min_bandwidth_fraction\": ";
+        WriteNumberOrNull(out, bandwidth / stream_gbps, traffic_known && stream_gbps > 0);
+        out << '}';
+    }
+    out << "\n  ],\n";
+    out << "  \"skipped\": [";
+    for (size_t i = 0; i < skipped.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"megapixels\": " << skipped[i].first << ", \"reason\": \"" << skipped[i].second << "\"}";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintHelpUsage();
+        return 1;
+    }
+
+    std::cerr << "Measuring memory bandwidth\n";
+    double stream_gbps = MeasureStreamBandwidth(sched::HardwareThreads());
+
+    std::vector<Point> points;
+    std::vector<std::pair<size_t, std::string>> skipped;
+    for (size_t megapixels : kMegapixels) {
+        if (megapixels > options.max_megapixels) {
+            continue;
+        }
+        // Square even-sized mosaic
+        size_t side = static_cast<size_t>(std::sqrt(megapixels * 1e6)) & ~size_t{1};
+        size_t available = mem::AvailableMemory();
+        if (available != 0 && side * side * kBytesPerPixelEstimate > available) {
+            skipped.emplace_back(megapixels, "not enough memory");
+            continue;
+        }
+
+        try {
+            Bitmap mosaic = menon::CreateSyntheticMosaic(side, side, 1);
+            for (size_t threads : ThreadCounts()) {
+                std::cerr << megapixels << " MP, " << threads << " threads\n";
+                points.push_back(Measure(mosaic, megapixels, threads, options.repeats));
+            }
+        }
+        catch (const std::bad_alloc&) {
+            skipped.emplace_back(megapixels, "allocation failed");
+        }
+    }
+
+    if (options.output != nullptr) {
+        std::ofstream file(options.output, std::ios::trunc);
+        WriteReport(file, stream_gbps, points, skipped);
+        if (!file) {
+            std::cerr << "Writing the report failed\n";
+            return 1;
+        }
+    }
+    else {
+        WriteReport(std::cout, stream_gbps, points, skipped);
+    }
+    return 0;
+}
@@ -0,0 +1,637 @@
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "differential.hpp"
+#include "../support/bitmap_arithmetics.hpp"
+#include "../interpolation/directional.hpp"
+#include "../interpolation/rb.hpp"
+#include "../refining/lowpass.hpp"
+#include "../refining/refine.hpp"
+#include "../refining/adaptive.hpp"
+#include "../refining/fixed16.hpp"
+#include "../decision/posteriori.hpp"
+#include "../pipeline/wavefront.hpp"
+#include "../pipeline/temporal.hpp"
+#include "../support/yuv.hpp"
+#include "../service/daemon.hpp"
+#include "../service/shard.hpp"
+#include "../menon.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace check {
+
+    namespace {
+        // Sizes with widths smaller than a vector, odd and not multiple of a vector
+        const std::vector<std::pair<size_t, size_t>> kSizes = {
+            {1, 1}, {1, 7}, {7, 1}, {2, 2}, {3, 5}, {5, 3}, {4, 9}, {8, 8},
+            {9, 15}, {16, 7}, {17, 33}, {31, 64}, {64, 61}, {70, 130},
+        };
+
+        // Kinds of pixel values
+        enum class Fill {
+            RANDOM,      // any 16-bit value
+            RANDOM_12,   // 12-bit sensor
+            ZEROS,
+            MAXIMUM,
+            EXTREMES,    // 0 and 65535 as a checkerboard
+            RANDOM_EXTREMES,
+            SMOOTH,      // flat colors with a slope and weak noise
+            GREY,        // one level of all colors with a slope and weak noise
+        };
+        const Fill kFills[] = {
+            Fill::RANDOM, Fill::RANDOM_12, Fill::ZEROS, Fill::MAXIMUM, Fill::EXTREMES, Fill::RANDOM_EXTREMES, Fill::SMOOTH,
+            Fill::GREY
+        };
+
+        const char* FillName(Fill fill) {
+            switch (fill) {
+                case Fill::RANDOM:          return "random";
+                case Fill::RANDOM_12:       return "random 12-bit";
+                case Fill::ZEROS:           return "zeros";
+                case Fill::MAXIMUM:         return "maximum";
+                case Fill::EXTREMES:        return "checkerboard of extremes";
+                case Fill::RANDOM_EXTREMES: return "random extremes";
+                case Fill::SMOOTH:          return "smooth";
+                case Fill::GREY:            return "grey";
+            }
+            return "";
+        }
+
+        // Equal levels of red, green and blue
+        bool Achromatic(Fill fill) {
+            return fill == Fill::ZEROS || fill == Fill::MAXIMUM || fill == Fill::GREY;
+        }
+
+        Bitmap MakeMosaic(size_t h, size_t w, Fill fill, std::mt19937& random) {
+            Bitmap b(h, w, sizeof(uint16_t));
+            for (size_t x = 0; x < h; ++x) {
+                for (size_t y = 0; y < w; ++y) {
+                    uint16_t v = 0;
+                    switch (fill) {
+                        case Fill::RANDOM:          v = static_cast<uint16_t>(random()); break;
+                        case Fill::RANDOM_12:       v = static_cast<uint16_t>(random() & 0xFFF); break;
+                        case Fill::ZEROS:           v = 0; break;
+                        case Fill::MAXIMUM:         v = UINT16_MAX; break;
+                        case Fill::EXTREMES:        v = ((x + y) & 1) ? UINT16_MAX : 0; break;
+                        case Fill::RANDOM_EXTREMES: v = (random() & 1) ? UINT16_MAX : 0; break;
+                        case Fill::SMOOTH:
+                            v = static_cast<uint16_t>((((x ^ y) & 1) ? 30000 : (x & 1) ? 9000 : 20000)
+                                                      + 40 * x + 25 * y + (random() & 63));
+                            break;
+                        case Fill::GREY:
+                            v = static_cast<uint16_t>(20000 + 40 * x + 25 * y + (random() & 127));
+                            break;
+                    }
+                    b.Set(x, y, v);
+                }
+            }
+            return b;
+        }
+
+        // Random 32-bit values small enough to never overflow in sums
+        Bitmap MakeInts(size_t h, size_t w, std::mt19937& random) {
+            Bitmap b(h, w, sizeof(int));
+            std::uniform_int_distribution<int> values(-(1 << 29), 1 << 29);
+            for (size_t x = 0; x < h; ++x) {
+                for (size_t y = 0; y < w; ++y) {
+                    b.Set(x, y, values(random));
+                }
+            }
+            return b;
+        }
+
+        // Compares bitmaps and reports the first different pixel
+        class Comparator {
+        public:
+            explicit Comparator(std::ostream& log) : log_{log} {
+            }
+
+            void Compare(const std::string& what, const Bitmap& expected, const Bitmap& actual) {
+                ++checks_;
+                if (expected.Height() != actual.Height() || expected.Width() != actual.Width()
+                    || expected.BytesPerPixel() != actual.BytesPerPixel()) {
+                    Fail(what + ": different sizes");
+                    return;
+                }
+                size_t p = expected.BytesPerPixel();
+                for (size_t x = 0; x < expected.Height(); ++x) {
+                    for (size_t y = 0; y < expected.Width(); ++y) {
+                        size_t offset = (x * expected.Width() + y) * p;
+                        if (std::memcmp(expected.Data() + offset, actual.Data() + offset, p) != 0) {
+                            Fail(what + ": pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") is "
+                                 + std::to_string(Value(actual, x, y)) + " instead of "
+                                 + std::to_string(Value(expected, x, y)));
+                            return;
+                        }
+                    }
+                }
+            }
+
+            // 16-bit layers may differ by at most 'tolerance'
+            void CompareWithin(const std::string& what, const Bitmap& expected, const Bitmap& actual, int tolerance) {
+                ++checks_;
+                if (expected.Height() != actual.Height() || expected.Width() != actual.Width()) {
+                    Fail(what + ": different sizes");
+                    return;
+                }
+                for (size_t x = 0; x < expected.Height(); ++x) {
+                    for (size_t y = 0; y < expected.Width(); ++y) {
+                        if (std::abs(expected.Get<uint16_t>(x, y) - actual.Get<uint16_t>(x, y)) > tolerance) {
+                            Fail(what + ": pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") is "
+                                 + std::to_string(actual.Get<uint16_t>(x, y)) + " instead of "
+                                 + std::to_string(expected.Get<uint16_t>(x, y)) + " +- " + std::to_string(tolerance));
+                            return;
+                        }
+                    }
+                }
+            }
+
+            size_t Mismatches() const {
+                return mismatches_;
+            }
+            size_t Checks() const {
+                return checks_;
+            }
+
+        private:
+            static long long Value(const Bitmap& b, size_t x, size_t y) {
+                return b.BytesPerPixel() == sizeof(int) ? b.Get<int>(x, y) : b.Get<uint16_t>(x, y);
+            }
+
+            void Fail(const std::string& message) {
+                ++mismatches_;
+                log_ << "MISMATCH " << message << '\n';
+            }
+
+            std::ostream& log_;
+            size_t mismatches_{0};
+            size_t checks_{0};
+        };
+
+        std::string Describe(const char* name, const Bitmap& b, const char* fill = nullptr) {
+            std::string result = std::string(name) + " " + std::to_string(b.Height()) + "x"
+                               + std::to_string(b.Width()) + " " + std::to_string(b.BytesPerPixel() * 8) + "-bit";
+            if (fill != nullptr) {
+                result += std::string(" ") + fill;
+            }
+            return result;
+        }
+
+#if defined(SIMD)
+        // Runs 'simple' and 'vector' variants of an in-place operation on copies of b1
+        void CompareInPlace(Comparator& cmp, const std::string& what, const Bitmap& b1,
+                            const std::function<void(Bitmap&)>& simple,
+                            const std::function<void(Bitmap&)>& vector) {
+            Bitmap expected = b1.Copy();
+            Bitmap actual = b1.Copy();
+            simple(expected);
+            vector(actual);
+            cmp.Compare(what, expected, actual);
+        }
+#endif
+
+        void CheckOperations(Comparator& cmp, const Bitmap& b1, const Bitmap& b2, const char* fill) {
+#if defined(SIMD)
+            const int shifts[][2] = {{0, 0}, {0, 1}, {1, 0}, {0, 2}, {2, 0}, {-1, 0}, {0, -1}, {-2, 1}, {1, -2}};
+            for (const auto& shift : shifts) {
+                int dx = shift[0], dy = shift[1];
+                std::string d = " dx=" + std::to_string(dx) + " dy=" + std::to_string(dy);
+                CompareInPlace(cmp, Describe("AddShifted", b1, fill) + d, b1,
+                               [&](Bitmap& b) { AddShiftedSimple(b, b2, dx, dy); },
+                               [&](Bitmap& b) { AddShiftedWithSIMD(b, b2, dx, dy); });
+                CompareInPlace(cmp, Describe("SubShifted", b1, fill) + d, b1,
+                               [&](Bitmap& b) { SubShiftedSimple(b, b2, dx, dy); },
+                               [&](Bitmap& b) { SubShiftedWithSIMD(b, b2, dx, dy); });
+                // In place with itself as GetGradient does. Backward shifts read
+                // values the scalar loop has already overwritten, so skip them
+                if (dx < 0 || dy < 0)
+                    continue;
+                CompareInPlace(cmp, Describe("SubShifted self", b1, fill) + d, b1,
+                               [&](Bitmap& b) { SubShiftedSimple(b, b, dx, dy); },
+                               [&](Bitmap& b) { SubShiftedWithSIMD(b, b, dx, dy); });
+            }
+            CompareInPlace(cmp, Describe("Sub", b1, fill), b1,
+                           [&](Bitmap& b) { SubShiftedSimple(b, b2, 0, 0); },
+                           [&](Bitmap& b) { SubWithSIMD(b, b2, b); });
+            CompareInPlace(cmp, Describe("Sub to dest", b1, fill), b1,
+                           [&](Bitmap& b) { SubSimple(b2, b1, b); },
+                           [&](Bitmap& b) { SubWithSIMD(b2, b1, b); });
+
+            CompareInPlace(cmp, Describe("Abs", b1, fill), b1, AbsSimple, AbsWithSIMD);
+            if (b1.BytesPerPixel() == sizeof(int)) {
+                // Mostly out of the 16-bit range: the clamp
+                cmp.Compare(Describe("CopyCast16", b1, fill), CopyCast16Simple(b1), CopyCast16WithSIMD(b1));
+            }
+
+            if (b1.BytesPerPixel() == sizeof(uint16_t)) {
+                CompareInPlace(cmp, Describe("Div2", b1, fill), b1, Div2Simple, Div2WithSIMD);
+                for (int offset : {0, 1, 3, 15}) {
+                    CompareInPlace(cmp, Describe("Shift", b1, fill) + " by " + std::to_string(offset), b1,
+                                   [&](Bitmap& b) { ShiftSimple(b, offset); },
+                                   [&](Bitmap& b) { ShiftWithSIMD(b, offset); });
+                }
+                CompareInPlace(cmp, Describe("SubDiv2", b1, fill), b1,
+                               [&](Bitmap& b) { SubDiv2Simple(b, b2, b); },
+                               [&](Bitmap& b) { SubDiv2WithSIMD(b, b2, b); });
+                CompareInPlace(cmp, Describe("SubDiv2 to dest", b1, fill), b1,
+                               [&](Bitmap& b) { SubDiv2Simple(b2, b1, b); },
+                               [&](Bitmap& b) { SubDiv2WithSIMD(b2, b1, b); });
+                cmp.Compare(Describe("CopyCast32", b1, fill), CopyCast32Simple(b1), CopyCast32WithSIMD(b1));
+                // Differences of 16-bit values: in the range and below zero
+                Bitmap ints = CopyCast32Simple(b1);
+                SubSimple(ints, CopyCast32Simple(b2), ints);
+                cmp.Compare(Describe("CopyCast16 of differences", b1, fill),
+                            CopyCast16Simple(ints), CopyCast16WithSIMD(ints));
+            }
+#else
+            (void)cmp;
+            (void)b1;
+            (void)b2;
+            (void)fill;
+#endif
+        }
+
+        void CheckDirectional(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+#if defined(SIMD)
+            for (menon::Direction d : {menon::HORIZONTAL, menon::VERTICAL}) {
+                // Destinations are filled with garbage: every pixel must be written
+                Bitmap expected = cfa.Copy();
+                Bitmap actual(cfa.Height(), cfa.Width(), sizeof(uint16_t));
+                std::memset(actual.Data(), 0x5A, cfa.Height() * cfa.Width() * sizeof(uint16_t));
+                menon::InterpolateDirectionalSimple(cfa, d, expected);
+                menon::InterpolateDirectionalWithSIMD(cfa, d, actual);
+                cmp.Compare(Describe(d == menon::HORIZONTAL ? "Directional H" : "Directional V", cfa, fill),
+                            expected, actual);
+            }
+#else
+            (void)cmp;
+            (void)cfa;
+            (void)fill;
+#endif
+        }
+
+        // Stage by stage pipeline as Demosaicing runs it without WAVEFRONT
+        menon::Layers RunStages(const Bitmap& cfa) {
+            // Stages print their timings
+            std::streambuf* out = std::cout.rdbuf(nullptr);
+            auto layers = menon::Layers::Create(cfa.Height(), cfa.Width());
+            auto temporary = BitmapVH::Create(cfa.Height(), cfa.Width(), sizeof(int16_t));
+            menon::InterpolateGreenVH(cfa, layers.green_vh);
+            menon::GetClassifierDifference(cfa, layers.green_vh, temporary, layers.diff);
+            menon::Posteriori(layers.green_vh, layers.diff, layers.green);
+            menon::InterpolateRBonGreen(cfa, layers.green, temporary.V, layers.rb);
+            menon::FillRBonRB(layers.rb, layers.diff);
+            std::cout.rdbuf(out);
+            return layers;
+        }
+
+        void CompareLayers(Comparator& cmp, const std::string& what,
+                           const menon::Layers& expected, const menon::Layers& actual) {
+            cmp.Compare(what + " green V", expected.green_vh.V, actual.green_vh.V);
+            cmp.Compare(what + " green H", expected.green_vh.H, actual.green_vh.H);
+            cmp.Compare(what + " classifier difference", expected.diff, actual.diff);
+            cmp.Compare(what + " green", expected.green, actual.green);
+            cmp.Compare(what + " red", expected.rb.V, actual.rb.V);
+            cmp.Compare(what + " blue", expected.rb.H, actual.rb.H);
+        }
+
+        // Layers kept by Keep::RESULT
+        void CompareResult(Comparator& cmp, const std::string& what,
+                           const menon::Layers& expected, const menon::Layers& actual) {
+            cmp.Compare(what + " classifier difference", expected.diff, actual.diff);
+            cmp.Compare(what + " green", expected.green, actual.green);
+            cmp.Compare(what + " red", expected.rb.V, actual.rb.V);
+            cmp.Compare(what + " blue", expected.rb.H, actual.rb.H);
+        }
+
+        // Simple and SIMD variants of the red and blue steps and of the refining,
+        // taking the layers of the pipeline as their input
+        void CheckColors(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+#if defined(SIMD)
+            auto layers = RunStages(cfa);
+            size_t h = cfa.Height();
+            size_t w = cfa.Width();
+
+            Bitmap chrom(h, w, sizeof(int16_t));
+            SubDiv2Simple(cfa, layers.green, chrom);
+            auto expected = BitmapVH::Create(h, w, sizeof(uint16_t));
+            auto actual = BitmapVH::Create(h, w, sizeof(uint16_t));
+            menon::FillGreenRBSimple(cfa, chrom, expected.V, expected.H);
+            menon::FillGreenRBWithSIMD(cfa, chrom, actual.V, actual.H);
+            cmp.Compare(Describe("FillGreenRB red", cfa, fill), expected.V, actual.V);
+            cmp.Compare(Describe("FillGreenRB blue", cfa, fill), expected.H, actual.H);
+            menon::FillRBRBSimple(expected.V, expected.H, layers.diff);
+            menon::FillRBRBWithSIMD(actual.V, actual.H, layers.diff);
+            cmp.Compare(Describe("FillRBRB red", cfa, fill), expected.V, actual.V);
+            cmp.Compare(Describe("FillRBRB blue", cfa, fill), expected.H, actual.H);
+
+            auto lpVH = lp::FilterVH(CopyCast32Simple(cfa));
+            Bitmap hpG = lp::HighpassGSimple(lpVH, layers.green, layers.diff);
+            Bitmap hpRR = lp::HighpassRonRSimple(layers.rb, layers.diff);
+            cmp.Compare(Describe("HighpassG", cfa, fill), hpG, lp::HighpassGWithSIMD(lpVH, layers.green, layers.diff));
+            cmp.Compare(Describe("HighpassRonR", cfa, fill), hpRR, lp::HighpassRonRWithSIMD(layers.rb, layers.diff));
+
+            for (int odd : {0, 1}) {
+                CompareInPlace(cmp, Describe(odd == 0 ? "RefineConG red" : "RefineConG blue", cfa, fill),
+                               odd == 0 ? layers.rb.V : layers.rb.H,
+                               [&](Bitmap& b) { refine::RefineConGSimple(b, lpVH, hpG, odd); },
+                               [&](Bitmap& b) { refine::RefineConGWithSIMD(b, lpVH, hpG, odd); });
+            }
+            CompareInPlace(cmp, Describe("RefineGonRB", cfa, fill), layers.green,
+                           [&](Bitmap& b) { refine::RefineGonRBSimple(b, hpG, hpRR); },
+                           [&](Bitmap& b) { refine::RefineGonRBWithSIMD(b, hpG, hpRR); });
+            BitmapVH refined_expected{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            BitmapVH refined_actual{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            refine::RefineRBonRBSimple(refined_expected, hpRR, layers.diff);
+            refine::RefineRBonRBWithSIMD(refined_actual, hpRR, layers.diff);
+            cmp.Compare(Describe("RefineRBonRB red", cfa, fill), refined_expected.V, refined_actual.V);
+            cmp.Compare(Describe("RefineRBonRB blue", cfa, fill), refined_expected.H, refined_actual.H);
+
+            // Tiles of odd size with every tile active give the full-frame refining
+            Bitmap green_expected = layers.green.Copy();
+            refine::RefineGonRBSimple(green_expected, hpG, hpRR);
+            for (size_t tile_size : {size_t{5}, size_t{32}}) {
+                Bitmap green_actual = layers.green.Copy();
+                BitmapVH rb_actual{layers.rb.V.Copy(), layers.rb.H.Copy()};
+                refine::AdaptiveRefine(green_actual, rb_actual, lpVH, layers.diff, 3,
+                                       refine::AdaptiveOptions{tile_size, 0});
+                cmp.Compare(Describe("AdaptiveRefine green", cfa, fill), green_expected, green_actual);
+                cmp.Compare(Describe("AdaptiveRefine red", cfa, fill), refined_expected.V, rb_actual.V);
+                cmp.Compare(Describe("AdaptiveRefine blue", cfa, fill), refined_expected.H, rb_actual.H);
+            }
+#else
+            (void)cmp;
+            (void)cfa;
+            (void)fill;
+#endif
+        }
+
+        // The 16-bit refining: variants bit by bit and the error bound
+        // of fixed16.hpp against the 32-bit refining
+        void CheckRefine16(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+            auto layers = RunStages(cfa);
+            auto lpVH = lp::FilterVH(CopyCast32Simple(cfa));
+            Bitmap hpG = lp::HighpassGSimple(lpVH, layers.green, layers.diff);
+            Bitmap hpRR = lp::HighpassRonRSimple(layers.rb, layers.diff);
+            Bitmap green32 = layers.green.Copy();
+            BitmapVH rb32{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            refine::RefineGonRBSimple(green32, hpG, hpRR);
+            refine::RefineRBonRBSimple(rb32, hpRR, layers.diff);
+
+            auto lpVH16 = lp::FilterVH16Simple(cfa);
+            Bitmap hpG16 = lp::HighpassG16Simple(lpVH16, layers.green, layers.diff);
+            Bitmap hpRR16 = lp::HighpassRonR16Simple(layers.rb, layers.diff);
+            Bitmap green16 = layers.green.Copy();
+            BitmapVH rb16{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            refine::RefineGonRB16Simple(green16, hpG16, hpRR16);
+            refine::RefineRBonRB16Simple(rb16, hpRR16, layers.diff);
+            cmp.CompareWithin(Describe("Refine16 green", cfa, fill), green32, green16, fixed16::kMaxError);
+            cmp.CompareWithin(Describe("Refine16 red", cfa, fill), rb32.V, rb16.V, fixed16::kMaxError);
+            cmp.CompareWithin(Describe("Refine16 blue", cfa, fill), rb32.H, rb16.H, fixed16::kMaxError);
+
+            // Low-pass by bands of rows (the refining of the C API)
+            size_t h = cfa.Height();
+            size_t w = cfa.Width();
+            auto lpVH_bands = BitmapVH::Create(h, w, sizeof(int));
+            auto lpVH16_bands = BitmapVH::Create(h, w, sizeof(uint16_t));
+            for (size_t x = 0; x < h; x += 3) {
+                lp::FilterVHRegion(cfa, lpVH_bands, Region::Rows(x, std::min(x + 3, h), w));
+                lp::FilterVH16Region(cfa, lpVH16_bands, Region::Rows(x, std::min(x + 3, h), w));
+            }
+            cmp.Compare(Describe("FilterVHRegion V", cfa, fill), lpVH.V, lpVH_bands.V);
+            cmp.Compare(Describe("FilterVHRegion H", cfa, fill), lpVH.H, lpVH_bands.H);
+            cmp.Compare(Describe("FilterVH16Region V", cfa, fill), lpVH16.V, lpVH16_bands.V);
+            cmp.Compare(Describe("FilterVH16Region H", cfa, fill), lpVH16.H, lpVH16_bands.H);
+
+#if defined(SIMD)
+            auto lpVH16_actual = lp::FilterVH16WithSIMD(cfa);
+            cmp.Compare(Describe("FilterVH16 V", cfa, fill), lpVH16.V, lpVH16_actual.V);
+            cmp.Compare(Describe("FilterVH16 H", cfa, fill), lpVH16.H, lpVH16_actual.H);
+            cmp.Compare(Describe("HighpassG16", cfa, fill), hpG16,
+                        lp::HighpassG16WithSIMD(lpVH16, layers.green, layers.diff));
+            cmp.Compare(Describe("HighpassRonR16", cfa, fill), hpRR16, lp::HighpassRonR16WithSIMD(layers.rb, layers.diff));
+            CompareInPlace(cmp, Describe("RefineGonRB16", cfa, fill), layers.green,
+                           [&](Bitmap& b) { refine::RefineGonRB16Simple(b, hpG16, hpRR16); },
+                           [&](Bitmap& b) { refine::RefineGonRB16WithSIMD(b, hpG16, hpRR16); });
+            BitmapVH rb16_actual{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            refine::RefineRBonRB16WithSIMD(rb16_actual, hpRR16, layers.diff);
+            cmp.Compare(Describe("RefineRBonRB16 red", cfa, fill), rb16.V, rb16_actual.V);
+            cmp.Compare(Describe("RefineRBonRB16 blue", cfa, fill), rb16.H, rb16_actual.H);
+#endif
+            // Every tile active gives the full-frame 16-bit refining
+            Bitmap green_actual = layers.green.Copy();
+            BitmapVH rb_actual{layers.rb.V.Copy(), layers.rb.H.Copy()};
+            refine::AdaptiveRefine(green_actual, rb_actual, lpVH16, layers.diff, 3, refine::AdaptiveOptions{5, 0});
+            cmp.Compare(Describe("AdaptiveRefine16 green", cfa, fill), green16, green_actual);
+            cmp.Compare(Describe("AdaptiveRefine16 red", cfa, fill), rb16.V, rb_actual.V);
+            cmp.Compare(Describe("AdaptiveRefine16 blue", cfa, fill), rb16.H, rb_actual.H);
+        }
+
+        // Tiles of the adaptive refining chosen by the threshold: on achromatic
+        // content pixels differ from the full-frame refining by less than twice it
+        void CheckAdaptiveThreshold(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+            auto layers = RunStages(cfa);
+            for (bool bits16 : {false, true}) {
+                auto lpVH = bits16 ? lp::FilterVH16(cfa) : lp::FilterVH(CopyCast32(cfa));
+                Bitmap green_expected = layers.green.Copy();
+                BitmapVH rb_expected{layers.rb.V.Copy(), layers.rb.H.Copy()};
+                refine::AdaptiveRefine(green_expected, rb_expected, lpVH, layers.diff, 3, refine::AdaptiveOptions{5, 0});
+                for (int threshold : {refine::AdaptiveOptions{}.threshold, 64, 1024}) {
+                    Bitmap green_actual = layers.green.Copy();
+                    BitmapVH rb_actual{layers.rb.V.Copy(), layers.rb.H.Copy()};
+                    refine::AdaptiveRefine(green_actual, rb_actual, lpVH, layers.diff, 3,
+                                           refine::AdaptiveOptions{5, threshold});
+                    std::string name = std::string(bits16 ? "AdaptiveRefine16" : "AdaptiveRefine")
+                                     + " threshold " + std::to_string(threshold);
+                    cmp.CompareWithin(Describe((name + " green").c_str(), cfa, fill),
+                                      green_expected, green_actual, 2 * threshold - 1);
+                    cmp.CompareWithin(Describe((name + " red").c_str(), cfa, fill),
+                                      rb_expected.V, rb_actual.V, 2 * threshold - 1);
+                    cmp.CompareWithin(Describe((name + " blue").c_str(), cfa, fill),
+                                      rb_expected.H, rb_actual.H, 2 * threshold - 1);
+                }
+            }
+        }
+
+        void CompareYUV(Comparator& cmp, const std::string& what, const yuv::Image& expected,
+                        const yuv::Image& actual) {
+            cmp.Compare(what + " Y", expected.Y, actual.Y);
+            cmp.Compare(what + " U", expected.U, actual.U);
+            cmp.Compare(what + " V", expected.V, actual.V);
+        }
+
+        // Scalar and SIMD conversion to YCbCr, the conversion of the final rows
+        // inside the wavefront and after it
+        void CheckYUV(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+            auto layers = RunStages(cfa);
+            size_t h = cfa.Height();
+            size_t w = cfa.Width();
+            const std::pair<yuv::Format, const char*> formats[] = {
+                {yuv::Format::NV12, "YUV NV12"}, {yuv::Format::I420, "YUV I420"},
+                {yuv::Format::I422, "YUV I422"}, {yuv::Format::P010, "YUV P010"},
+            };
+            for (const auto& [format, name] : formats) {
+                std::string what = Describe(name, cfa, fill);
+                auto expected = yuv::Create(format, h, w);
+                yuv::ConvertRowsSimple(layers.rb.V, layers.green, layers.rb.H, expected, yuv::Matrix::BT709, 0, h);
+#if defined(SIMD)
+                auto actual = yuv::Create(format, h, w);
+                yuv::ConvertRowsWithSIMD(layers.rb.V, layers.green, layers.rb.H, actual, yuv::Matrix::BT709, 0, h);
+                CompareYUV(cmp, what, expected, actual);
+#endif
+                for (size_t band : {size_t{2}, menon::kWavefrontBandRows}) {
+                    auto fused = yuv::Create(format, h, w);
+                    menon::InterpolateWavefront(cfa, 3, band, [&](const menon::Layers& l, size_t begin, size_t end) {
+                        yuv::ConvertRows(l.rb.V, l.green, l.rb.H, fused, yuv::Matrix::BT709, begin, end);
+                    }, menon::Keep::RESULT);
+                    CompareYUV(cmp, what + " in wavefront band=" + std::to_string(band), expected, fused);
+                }
+            }
+        }
+
+        void CheckPipelines(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+            auto stages = RunStages(cfa);
+            for (size_t threads : {size_t{1}, size_t{3}, size_t{8}}) {
+                for (size_t band : {size_t{1}, size_t{2}, size_t{5}, menon::kWavefrontBandRows}) {
+                    auto layers = menon::InterpolateWavefront(cfa, threads, band);
+                    CompareLayers(cmp, Describe("Wavefront", cfa, fill) + " threads=" + std::to_string(threads)
+                                       + " band=" + std::to_string(band), stages, layers);
+                    // Buffers reused by the later layers
+                    auto result = menon::InterpolateWavefront(cfa, threads, band, {}, menon::Keep::RESULT);
+                    CompareResult(cmp, Describe("Wavefront reusing buffers", cfa, fill) + " threads="
+                                       + std::to_string(threads) + " band=" + std::to_string(band), stages, result);
+                }
+            }
+
+            // Temporal: the first frame, then the same frame with a changed pixel
+            menon::TemporalDemosaicing video(menon::kPipelineHalo, 3);
+            CompareLayers(cmp, Describe("Temporal first frame", cfa, fill), stages, video.Process(cfa));
+            Bitmap next = cfa.Copy();
+            next.Set(next.Height() / 2, next.Width() / 2, static_cast<uint16_t>(12345));
+            CompareLayers(cmp, Describe("Temporal next frame", cfa, fill), RunStages(next), video.Process(next));
+        }
+
+        // Accepts and drops everything written to it, from any thread
+        class NullBuffer : public std::streambuf {
+        protected:
+            int overflow(int c) override {
+                return traits_type::not_eof(c);
+            }
+        };
+
+        // Demosaicing by stripes of service/shard.hpp against menon::Demosaicing byte for byte.
+        // The workers are ServeConnection threads of this process serving socketpairs.
+        // Stripe heights are odd (rounded up to even) and smaller than the halo
+        void CheckSharded(Comparator& cmp, const Bitmap& cfa, const char* fill) {
+            constexpr size_t kWorkers = 2;
+            size_t h = cfa.Height();
+            size_t w = cfa.Width();
+#if defined(ADAPTIVE_REFINE)
+            // Tiles chosen per stripe differ from the ones of the image (service/shard.hpp)
+            auto adaptive = refine::Adaptive();
+            refine::SetAdaptive(refine::AdaptiveOptions{adaptive.tile_size, 0});
+#endif
+            // menon::Demosaicing reports its stages to std::cout
+            NullBuffer null_buffer;
+            std::streambuf* cout_buffer = std::cout.rdbuf(&null_buffer);
+            std::ostream worker_log(&null_buffer);
+            service::Demosaic demosaic = [](const Bitmap& mosaic) { return menon::Demosaicing(mosaic); };
+
+            Bitmap expected(h, 3 * w, sizeof(uint16_t));
+            auto image = menon::Demosaicing(cfa);
+            rgb::PackRGB(image.R, image.G, image.B, reinterpret_cast<uint16_t*>(expected.Data()));
+
+            const size_t heights[] = {1, 3, 7, service::kStripeHalo - 1, service::kStripeHalo + 3, h};
+            std::vector<std::pair<std::string, Bitmap>> results;
+            for (size_t rows : heights) {
+                Bitmap actual(h, 3 * w, sizeof(uint16_t));
+                std::string name = Describe("DemosaicSharded", cfa, fill) + " stripe=" + std::to_string(rows);
+                int pairs[kWorkers][2];
+                std::vector<int> workers;
+                std::vector<std::thread> servers;
+                for (auto& pair : pairs) {
+                    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+                        pair[0] = pair[1] = -1;
+                        name += " (no socketpair)";
+                        continue;
+                    }
+                    workers.push_back(pair[0]);
+                    servers.emplace_back([&, fd = pair[1]]() { service::ServeConnection(fd, demosaic, worker_log); });
+                }
+                try {
+                    auto source = [&](size_t begin, size_t end) {
+                        Bitmap stripe(end - begin, w, sizeof(uint16_t));
+                        std::memcpy(stripe.Data(), cfa.Data() + begin * w * sizeof(uint16_t),
+                                    (end - begin) * w * sizeof(uint16_t));
+                        return stripe;
+                    };
+                    auto output = [&](size_t begin, size_t end, const uint16_t* rgb) {
+                        std::memcpy(actual.Data() + begin * w * 3 * sizeof(uint16_t), rgb,
+                                    (end - begin) * w * 3 * sizeof(uint16_t));
+                    };
+                    service::DemosaicSharded(h, w, source, workers, rows, output);
+                }
+                catch (const std::exception& e) {
+                    name += std::string(" (") + e.what() + ")";
+                }
+                // Workers return when the coordinator closes its ends
+                for (int fd : workers) {
+                    close(fd);
+                }
+                for (auto& server : servers) {
+                    server.join();
+                }
+                for (auto& pair : pairs) {
+                    if (pair[1] >= 0) {
+                        close(pair[1]);
+                    }
+                }
+                results.emplace_back(std::move(name), std::move(actual));
+            }
+
+            std::cout.rdbuf(cout_buffer);
+#if defined(ADAPTIVE_REFINE)
+            refine::SetAdaptive(adaptive);
+#endif
+            for (const auto& [name, actual] : results) {
+                cmp.Compare(name, expected, actual);
+            }
+        }
+    } // namespace
+
+    size_t RunDifferentialChecks(std::ostream& log, uint32_t seed) {
+        std::mt19937 random(seed);
+        Comparator cmp(log);
+
+        for (const auto& [h, w] : kSizes) {
+            for (Fill fill : kFills) {
+                Bitmap cfa = MakeMosaic(h, w, fill, random);
+                Bitmap other = MakeMosaic(h, w, Fill::RANDOM, random);
+                CheckOperations(cmp, cfa, other, FillName(fill));
+                CheckDirectional(cmp, cfa, FillName(fill));
+                CheckColors(cmp, cfa, FillName(fill));
+                CheckRefine16(cmp, cfa, FillName(fill));
+                if (Achromatic(fill)) {
+                    CheckAdaptiveThreshold(cmp, cfa, FillName(fill));
+                }
+                CheckPipelines(cmp, cfa, FillName(fill));
+                CheckYUV(cmp, cfa, FillName(fill));
+                CheckSharded(cmp, cfa, FillName(fill));
+            }
+            Bitmap ints = MakeInts(h, w, random);
+            Bitmap other_ints = MakeInts(h, w, random);
+            CheckOperations(cmp, ints, other_ints, "random");
+        }
+
+        log << cmp.Checks() << " checks, " << cmp.Mismatches() << " mismatches\n";
+        return cmp.Mismatches();
+    }
+} // namespace check
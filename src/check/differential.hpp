@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+namespace check {
+    // Runs every variant of the kernels on random and edge-case mosaics
+    // (odd sizes, widths smaller than a vector, extreme values) and compares
+    // their results bit by bit:
+    //  - Simple and SIMD bitmap operations (16 and 32 bit)
+    //  - Simple and SIMD directional interpolation
+    //  - Simple and SIMD red and blue interpolation, high-pass and refining
+    //  - the 16-bit refining (define REFINE16) within its error bound of the 32-bit one
+    //  - stage by stage pipeline, row wavefront (any threads and bands)
+    //    and temporal tile skipping
+    //  - demosaicing by stripes over worker sockets (service/shard.hpp)
+    //    against the single call, byte for byte
+    //
+    // Prints mismatches to 'log'. Returns the number of mismatches
+    size_t RunDifferentialChecks(std::ostream& log, uint32_t seed = 1);
+} // namespace check
@@ -0,0 +1,11 @@
+#include <iostream>
+#include <string>
+#include "differential.hpp"
+
+// Test of the build (ctest): compares SIMD and pipeline variants against scalar code
+// Usage: menon_check [seed]
+int main(int argc, char* argv[]) {
+    uint32_t seed = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1;
+    size_t mismatches = check::RunDifferentialChecks(std::cout, seed);
+    return mismatches == 0 ? 0 : 1;
+}
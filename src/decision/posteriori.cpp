@@ -1,6 +1,7 @@
 #include <thread>
 #include "posteriori.hpp"
 #include "../support/bitmap_arithmetics.hpp"
+#include "../support/simd_report.hpp"
 
 // for debug
 #include <iostream>
@@ -12,49 +13,52 @@ std::cout << duration.count() << " ms \n";       \
 }
 
 namespace menon {
-    // turns
-    Bitmap GetChrominance(const Bitmap& mosaic, const Bitmap& layer) {
-        Bitmap chrominance = mosaic;
-        Sub(chrominance, layer);
+    // |mosaic - layer|
+    void GetChrominance(const Bitmap& mosaic, const Bitmap& layer, Bitmap& chrominance) {
+        Sub(mosaic, layer, chrominance);
         Abs(chrominance);
-        return chrominance;
     }
 
-    Bitmap GetGradient(const Bitmap& mosaic, const Bitmap& layer, size_t dx, size_t dy) {
-        Bitmap chrominance = GetChrominance(mosaic, layer);
-        Shift(chrominance, 1);
-        SubShifted(chrominance, chrominance, dx, dy);
-        Abs(chrominance);
-        return chrominance;
+    void GetGradient(const Bitmap& mosaic, const Bitmap& layer, size_t dx, size_t dy, Bitmap& gradient) {
+        GetChrominance(mosaic, layer, gradient);
+        Shift(gradient, 1);
+        SubShifted(gradient, gradient, dx, dy);
+        Abs(gradient);
     }
 
-    BitmapVH GetGradients(const Bitmap& mosaic, const BitmapVH& layers) {
+    void GetGradients(const Bitmap& mosaic, const BitmapVH& layers, BitmapVH& grads) {
 #ifdef PARALLEL
-        BitmapVH grads;
         std::thread vertical([&]() {
-            grads.V = GetGradient(mosaic, layers.V, 2, 0);
+            GetGradient(mosaic, layers.V, 2, 0, grads.V);
         });
         std::thread horizontal([&]() {
-            grads.H = GetGradient(mosaic, layers.H, 0, 2);
+            GetGradient(mosaic, layers.H, 0, 2, grads.H);
         });
         vertical.join();
         horizontal.join();
-        return grads;
 #else
-        return BitmapVH{
-            GetGradient(mosaic, layers.V, 2, 0),
-            GetGradient(mosaic, layers.H, 0, 2)
-        };
+        GetGradient(mosaic, layers.V, 2, 0, grads.V);
+        GetGradient(mosaic, layers.H, 0, 2, grads.H);
 #endif
     }
 
     Bitmap GetClassifierDifference(const Bitmap& mosaic, const BitmapVH& interpolation) {
+        auto grads = BitmapVH::Create(mosaic.Height(), mosaic.Width(), sizeof(int16_t));
+        Bitmap diff(mosaic.Height(), mosaic.Width(), sizeof(int));
+        GetClassifierDifference(mosaic, interpolation, grads, diff);
+        return diff;
+    }
+
+    // The running window sum goes pixel by pixel
+    SCALAR_ONLY("GetClassifierDifference 5x5 sum")
+    void GetClassifierDifference(const Bitmap& mosaic, const BitmapVH& interpolation,
+                                 BitmapVH& grads, Bitmap& diff) {
         constexpr size_t AREA_SIZE = 5;
         constexpr size_t AREA_HALF = AREA_SIZE >> 1;
 
         auto start = std::chrono::system_clock::now();
 
-        auto grads = GetGradients(mosaic, interpolation);
+        GetGradients(mosaic, interpolation, grads);
         Sub(grads.H, grads.V);
         std::cout << "Gradients found ";
         TIMESTAMP
@@ -74,8 +78,6 @@ namespace menon {
             }
         }
 
-        Bitmap diff(h, w, sizeof(int));
-
         for (size_t x = 0; x < h; ++x) {
             int current_area_sum = 0;
             for (size_t y = 0; y <= AREA_HALF && y < w; ++y) {
@@ -112,14 +114,18 @@ namespace menon {
         }
         std::cout << "Classes found ";
         TIMESTAMP
-
-        return diff;
     }
 
     Bitmap Posteriori(const BitmapVH& interpolation, const Bitmap& diff) {
+        Bitmap merged(diff.Height(), diff.Width(), interpolation.V.BytesPerPixel());
+        Posteriori(interpolation, diff, merged);
+        return merged;
+    }
+
+    SCALAR_ONLY("Posteriori")
+    void Posteriori(const BitmapVH& interpolation, const Bitmap& diff, Bitmap& merged) {
         size_t w = diff.Width();
         size_t h = diff.Height();
-        Bitmap merged(h, w, interpolation.V.BytesPerPixel());
         for (size_t x = 0; x < h; ++x) {
             for (size_t y = 0; y < w; ++y) {
                 // check if classifier h < classifier v
@@ -131,6 +137,118 @@ namespace menon {
                 }
             }
         }
-        return merged;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Region variants:
+
+    // |mosaic - layer| >> 1 like GetChrominance + Shift(1) do it with int16 values
+    inline int16_t HalfChrominance(uint16_t mosaic, uint16_t layer) {
+        auto d = static_cast<int16_t>(mosaic - layer);
+        auto abs = static_cast<int16_t>(d < 0 ? -d : d);
+        return static_cast<int16_t>(static_cast<uint16_t>(abs) >> 1);
+    }
+
+    inline int16_t Abs16(int v) {
+        return static_cast<int16_t>(v < 0 ? -v : v);
+    }
+
+    SCALAR_ONLY("GetGradientDifferenceRegion")
+    void GetGradientDifferenceRegion(const Bitmap& mosaic, const BitmapVH& interpolation,
+                                     Bitmap& grad_diff, const Region& region) {
+        size_t h = mosaic.Height();
+        size_t w = mosaic.Width();
+        auto m  = reinterpret_cast<const uint16_t*>(mosaic.Data());
+        auto lv = reinterpret_cast<const uint16_t*>(interpolation.V.Data());
+        auto lh = reinterpret_cast<const uint16_t*>(interpolation.H.Data());
+        auto gd = reinterpret_cast<int16_t*>(grad_diff.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            size_t row_pos = x * w;
+            size_t next_pos = (x + 2) * w;
+            for (size_t y = region.y_begin; y < region.y_end; ++y) {
+                size_t i = row_pos + y;
+                int16_t grad_v = HalfChrominance(m[i], lv[i]);
+                if (x + 2 < h) {
+                    grad_v = Abs16(grad_v - HalfChrominance(m[next_pos + y], lv[next_pos + y]));
+                }
+                int16_t grad_h = HalfChrominance(m[i], lh[i]);
+                if (y + 2 < w) {
+                    grad_h = Abs16(grad_h - HalfChrominance(m[i + 2], lh[i + 2]));
+                }
+                gd[i] = static_cast<int16_t>(grad_h - grad_v);
+            }
+        }
+    }
+
+    SCALAR_ONLY("SumClassifierRegion")
+    void SumClassifierRegion(const Bitmap& grad_diff, Bitmap& diff, const Region& region) {
+        constexpr size_t AREA_SIZE = 5;
+        constexpr size_t AREA_HALF = AREA_SIZE >> 1;
+
+        size_t h = grad_diff.Height();
+        size_t w = grad_diff.Width();
+        auto gd = reinterpret_cast<const int16_t*>(grad_diff.Data());
+        auto d  = reinterpret_cast<int*>(diff.Data());
+
+        // Columns the square windows of the region touch
+        size_t y_low  = region.y_begin > AREA_HALF ? region.y_begin - AREA_HALF : 0;
+        size_t y_high = std::min(region.y_end + AREA_HALF, w);
+
+        // Sum of the column window [x - AREA_HALF, x + AREA_HALF] for each touched column
+        std::vector<int> column_sum(y_high - y_low, 0);
+        size_t x_low = region.x_begin > AREA_HALF ? region.x_begin - AREA_HALF : 0;
+        for (size_t x = x_low; x <= region.x_begin + AREA_HALF && x < h; ++x) {
+            for (size_t y = y_low; y < y_high; ++y) {
+                column_sum[y - y_low] += gd[x * w + y];
+            }
+        }
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            int current_area_sum = 0;
+            for (size_t y = (region.y_begin > AREA_HALF ? region.y_begin - AREA_HALF : 0);
+                 y <= region.y_begin + AREA_HALF && y < w; ++y) {
+                current_area_sum += column_sum[y - y_low];
+            }
+
+            // Move the square window
+            for (size_t y = region.y_begin; y < region.y_end; ++y) {
+                d[x * w + y] = current_area_sum;
+                if (y + AREA_HALF + 1 < y_high) {
+                    current_area_sum += column_sum[y + AREA_HALF + 1 - y_low];
+                }
+                if (y >= AREA_HALF) {
+                    current_area_sum -= column_sum[y - AREA_HALF - y_low];
+                }
+            }
+
+            // Move the column window
+            for (size_t y = y_low; y < y_high; ++y) {
+                if (x >= AREA_HALF) {
+                    column_sum[y - y_low] -= gd[(x - AREA_HALF) * w + y];
+                }
+                if (x + AREA_HALF + 1 < h) {
+                    column_sum[y - y_low] += gd[(x + AREA_HALF + 1) * w + y];
+                }
+            }
+        }
+    }
+
+    SCALAR_ONLY("PosterioriRegion")
+    void PosterioriRegion(const BitmapVH& interpolation, const Bitmap& diff,
+                          Bitmap& green, const Region& region) {
+        size_t w = diff.Width();
+        auto d  = reinterpret_cast<const int*>(diff.Data());
+        auto lv = reinterpret_cast<const uint16_t*>(interpolation.V.Data());
+        auto lh = reinterpret_cast<const uint16_t*>(interpolation.H.Data());
+        auto g  = reinterpret_cast<uint16_t*>(green.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            for (size_t y = region.y_begin; y < region.y_end; ++y) {
+                size_t i = x * w + y;
+                // check if classifier h < classifier v
+                g[i] = d[i] < 0 ? lh[i] : lv[i];
+            }
+        }
     }
 } // namespace menon
@@ -1,5 +1,6 @@
 #pragma once
 #include "../support/bitmap.hpp"
+#include "../support/region.hpp"
 namespace menon {
     // Merge two interpolations using a posteriori decision
     // Classifier difference is a difference between vertical and horizontal classifiers
@@ -10,4 +11,32 @@ namespace menon {
     // for each pixel
     Bitmap GetClassifierDifference(const Bitmap& cfa, const BitmapVH& interpolation);
 
+    // The same writing to preallocated buffers
+    // grads - pair of Bitmap<int16_t> for the gradients (contents are lost)
+    // diff - Bitmap<int>
+    void GetClassifierDifference(const Bitmap& cfa, const BitmapVH& interpolation,
+                                 BitmapVH& grads, Bitmap& diff);
+
+    // green - preallocated Bitmap<uint16_t>
+    void Posteriori(const BitmapVH& interpolation, const Bitmap& classifier_difference, Bitmap& green);
+
+    // Region variants. Write only pixels of the region,
+    // so they are safe to call concurrently for disjoint regions
+
+    // Computes (gradient H - gradient V) of the chrominance of interpolations
+    // grad_diff - preallocated Bitmap<int16_t>
+    // Reads interpolation rows and columns up to region end + 2
+    void GetGradientDifferenceRegion(const Bitmap& cfa, const BitmapVH& interpolation,
+                                     Bitmap& grad_diff, const Region& region);
+
+    // Sums grad_diff by the area of 5x5 to get the classifier difference
+    // diff - preallocated Bitmap<int>
+    // Reads grad_diff rows and columns in region +- 2
+    void SumClassifierRegion(const Bitmap& grad_diff, Bitmap& diff, const Region& region);
+
+    // Merges two interpolations into green using classifier difference
+    // green - preallocated Bitmap<uint16_t>
+    void PosterioriRegion(const BitmapVH& interpolation, const Bitmap& diff,
+                          Bitmap& green, const Region& region);
+
 } // namespace menon
@@ -1,6 +1,7 @@
 #pragma once
 #include "../support/bitmap.hpp"
 #include "../support/pf.hpp"
+#include "../support/region.hpp"
 #include "filter.hpp"
 
 namespace menon {
@@ -9,4 +10,20 @@ namespace menon {
     Bitmap InterpolateHorizontal(const Bitmap& cfa);
     Bitmap InterpolateDirectional(const Bitmap& cfa, Direction d);
     BitmapVH InterpolateGreenVH(const Bitmap& cfa);
+
+    // The same writing every pixel of preallocated Bitmap<uint16_t> of the cfa size
+    void InterpolateDirectional(const Bitmap& cfa, Direction d, Bitmap& dest);
+    void InterpolateGreenVH(const Bitmap& cfa, BitmapVH& dest);
+
+    // Interpolation variants. InterpolateDirectional chooses one by define SIMD
+    // Both must give the same result (see check/differential.hpp)
+    void InterpolateDirectionalSimple(const Bitmap& cfa, Direction d, Bitmap& dest);
+#if defined(SIMD)
+    void InterpolateDirectionalWithSIMD(const Bitmap& cfa, Direction d, Bitmap& dest);
+#endif
+
+    // Interpolates green in both directions only for pixels of the region
+    // green_vh - preallocated pair of Bitmap<uint16_t> of the cfa size
+    // Safe to call concurrently for disjoint regions
+    void InterpolateGreenVHRegion(const Bitmap& cfa, BitmapVH& green_vh, const Region& region);
 } // namespace menon
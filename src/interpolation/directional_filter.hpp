@@ -0,0 +1,362 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "../support/bitmap.hpp"
+#include "../support/border.hpp"
+#include "../support/pf.hpp"
+#include "../support/region.hpp"
+#include "filter.hpp"
+
+#if defined(SIMD)
+#include <immintrin.h>
+#endif
+
+// Directional green interpolation for any FIRFilter
+// Taps, shifts and border tables are known at compile time,
+// so the loops are unrolled and multiplications are shifts and adds.
+// directional.cpp instantiates it with MenonFilter. To try another filter:
+//
+//      using Filter7 = menon::FIRFilter<-1, 0, 5, 8, 5, 0, -1>;
+//      menon::fir::InterpolateDirectional<Filter7>(cfa, menon::VERTICAL, dest);
+//
+// BE CAREFUL: the halo of the pipeline (kPipelineHalo in pipeline/temporal.hpp)
+// is computed for MenonFilter
+namespace menon::fir {
+
+    // Filter sum of the taps first[0], first[step], ...
+    template <typename Filter, typename T>
+    inline int FilterSum(const T* first, size_t step) {
+        int sum = 0;
+        for (size_t i = 0; i < Filter::kSize; ++i) {
+            sum += static_cast<int>(first[i * step]) * Filter::kTaps[i];
+        }
+        return sum;
+    }
+
+    // Filter sum of the pixel 'pos' of a line of 'len' pixels whose filter is
+    // partially out of the line. 'sum' is computed over the extended line
+    template <typename Filter>
+    inline int BorderSum(int sum, size_t pos, size_t len) {
+#if defined(EXACT_BORDERS)
+        // The line is extended by zeros: compensate the weight of the taps out of it
+        constexpr size_t kOff = Filter::kOffset;
+        sum *= Filter::kSubSums[0][Filter::kSize - 1];
+        sum /= Filter::kSubSums
+        [pos < kOff ? kOff - pos : 0] /*first in filter*/
+        [pos + kOff >= len ? Filter::kSize - 2 - pos - kOff + len : Filter::kSize - 1]; /*last*/
+#else
+        // The line is mirrored: nothing to compensate
+        (void)pos;
+        (void)len;
+#endif
+        return sum;
+    }
+
+    // Result of the filter sum
+    template <typename Filter>
+    inline uint16_t NormalizeSum(int sum) {
+        // divide by the sum of taps
+        sum >>= Filter::kShift;
+        // avoid overflow
+        return static_cast<uint16_t>(std::min(std::max(sum, 0), UINT16_MAX));
+    }
+
+    // Applies the filter at item 'pos' of a line of 'len' items placed 'step' apart
+    // The same border handling as in InterpolateDirectionalSimple
+    template <typename Filter>
+    inline uint16_t ApplyFilter(const uint16_t* line, size_t step, size_t pos, size_t len) {
+        constexpr size_t kOff = Filter::kOffset;
+        if (pos >= kOff && pos + kOff < len) {
+            return NormalizeSum<Filter>(FilterSum<Filter>(line + (pos - kOff) * step, step));
+        }
+        int sum = 0;
+        for (size_t i = 0; i < Filter::kSize; ++i) {
+            auto at = static_cast<ptrdiff_t>(pos + i) - static_cast<ptrdiff_t>(kOff);
+#if defined(EXACT_BORDERS)
+            int value = at >= 0 && static_cast<size_t>(at) < len ? line[at * step] : 0;
+#else
+            int value = line[border::Mirror(at, len) * step];
+#endif
+            sum += value * Filter::kTaps[i];
+        }
+        return NormalizeSum<Filter>(BorderSum<Filter>(sum, pos, len));
+    }
+
+    // Copies the line x (row for HORIZONTAL, column for VERTICAL) of the mosaic
+    // to line[kOffset, kOffset + len) and extends it by kOffset items on both sides
+    template <typename Filter>
+    void LoadExtendedLine(const Bitmap& mosaic, Direction d, size_t x, size_t len, int* line) {
+        constexpr size_t kOff = Filter::kOffset;
+        int* center = line + kOff;
+        for (size_t y = 0; y < len; ++y) {
+            center[y] = d == HORIZONTAL ? mosaic.Get<uint16_t>(x, y) : mosaic.Get<uint16_t>(y, x);
+        }
+        for (size_t k = 1; k <= kOff; ++k) {
+#if defined(EXACT_BORDERS)
+            center[-static_cast<ptrdiff_t>(k)] = 0;
+            center[len - 1 + k] = 0;
+#else
+            center[-static_cast<ptrdiff_t>(k)] = center[border::Mirror(-static_cast<ptrdiff_t>(k), len)];
+            center[len - 1 + k] = center[border::Mirror(static_cast<ptrdiff_t>(len - 1 + k), len)];
+#endif
+        }
+    }
+
+    // Sets the pixel y of the line x in the direction d
+    inline void SetDirectional(Bitmap& dest, size_t x, size_t y, Direction d, uint16_t value) {
+        if (d == HORIZONTAL) {
+            dest.Set(x, y, value);
+        }
+        else {
+            dest.Set(y, x, value);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Implementations:
+
+    // The simplest implementation. Safe to use in several threads
+    template <typename Filter>
+    void InterpolateDirectionalSimple(const Bitmap& mosaic, Direction d, Bitmap& dest) {
+        constexpr size_t kOff = Filter::kOffset;
+        size_t w = mosaic.Width();
+        size_t h = mosaic.Height();
+        if (d == Direction::VERTICAL) {
+            std::swap(w, h);
+        }
+
+        // The line of the mosaic with the border, line[y] is the first tap of pixel y
+        std::vector<int> line(w + 2 * kOff);
+
+        for (size_t x = 0; x < h; ++x)
+        {
+            // position of the first R or B in a row
+            SIZE_T_PF(x);
+            LoadExtendedLine<Filter>(mosaic, d, x, w, line.data());
+
+            // Green pixels stay as they are in the mosaic
+            for (size_t y = 1 - pf; y < w; y += 2) {
+                SetDirectional(dest, x, y, d, static_cast<uint16_t>(line[y + kOff]));
+            }
+
+            // No bounds checks: the line is extended
+            border::Split(pf, w, w, kOff, [&](size_t begin, size_t end, bool inside) {
+                size_t y = begin + ((begin & 1) != pf);
+                if (inside) {
+                    for (; y < end; y += 2) {
+                        auto sum = FilterSum<Filter>(line.data() + y, 1);
+                        SetDirectional(dest, x, y, d, NormalizeSum<Filter>(sum));
+                    }
+                }
+                else {
+                    for (; y < end; y += 2) {
+                        auto sum = BorderSum<Filter>(FilterSum<Filter>(line.data() + y, 1), y, w);
+                        SetDirectional(dest, x, y, d, NormalizeSum<Filter>(sum));
+                    }
+                }
+            });
+        }
+    }
+
+#if defined(SIMD)
+
+    // v * kFactor (kFactor > 0) by shifts and adds
+    template <int kFactor>
+    inline __m128i Multiply(__m128i v) {
+        static_assert(kFactor > 0, "Factor must be positive");
+        if constexpr (kFactor == 1) {
+            return v;
+        }
+        else if constexpr ((kFactor & 1) == 0) {
+            return _mm_slli_epi32(Multiply<kFactor / 2>(v), 1);
+        }
+        else {
+            return _mm_add_epi32(Multiply<kFactor - 1>(v), v);
+        }
+    }
+
+    // sum + v * kTap
+    template <int kTap>
+    inline __m128i AccumulateTap(__m128i sum, __m128i v) {
+        if constexpr (kTap > 0) {
+            return _mm_add_epi32(sum, Multiply<kTap>(v));
+        }
+        else if constexpr (kTap < 0) {
+            return _mm_sub_epi32(sum, Multiply<-kTap>(v));
+        }
+        else {
+            return sum;
+        }
+    }
+
+    // 4 consecutive items as 32-bit lanes
+    inline __m128i Load4(const int* items) {
+        return _mm_loadu_si128((const __m128i*)items);
+    }
+    inline __m128i Load4(const uint16_t* items) {
+        return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)items));
+    }
+
+    // Filter sums of 4 consecutive pixels, line[0] is the first tap of the first one
+    // and taps of a pixel are 'step' items apart (the width for columns of a mosaic)
+    template <typename Filter, typename T, size_t... kI>
+    inline __m128i FilterSums4(const T* line, size_t step, std::index_sequence<kI...>) {
+        __m128i sum = _mm_setzero_si128();
+        ((sum = AccumulateTap<Filter::kTaps[kI]>(sum, Load4(line + kI * step))), ...);
+        return sum;
+    }
+
+    template <typename Filter, typename T>
+    inline __m128i FilterSums4(const T* line, size_t step = 1) {
+        return FilterSums4<Filter>(line, step, std::make_index_sequence<Filter::kSize>{});
+    }
+
+    // Filtered values of 8 consecutive pixels (NormalizeSum of their sums)
+    template <typename Filter>
+    inline __m128i Filter8(const uint16_t* line, size_t step) {
+        __m128i low  = _mm_srai_epi32(FilterSums4<Filter>(line, step), Filter::kShift);
+        __m128i high = _mm_srai_epi32(FilterSums4<Filter>(line + 4, step), Filter::kShift);
+        return _mm_packus_epi32(low, high);
+    }
+
+    // The implementation with SIMD. Safe to use in several threads
+    // Filters 8 pixels of the extended line at once (4 per register)
+    template <typename Filter>
+    void InterpolateDirectionalWithSIMD(const Bitmap& mosaic, Direction d, Bitmap& dest) {
+        constexpr size_t SIMD_ITEMS = 8;
+        constexpr size_t kOff = Filter::kOffset;
+
+        size_t w = mosaic.Width();
+        size_t h = mosaic.Height();
+        if (d == Direction::VERTICAL) {
+            std::swap(w, h);
+        }
+
+        // The line of the mosaic with the border, line[y] is the first tap of pixel y
+        // Also SIMD_ITEMS items to read the last vector safely
+        std::vector<int> line(w + 2 * kOff + SIMD_ITEMS);
+        // Lanes of 16-bit items with red or blue pixels for pf = 0 and 1
+        const __m128i rb_lanes[2] = {
+            _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1),
+            _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0)
+        };
+
+        for (size_t x = 0; x < h; ++x)
+        {
+            // position of the first R or B in a row
+            SIZE_T_PF(x)
+            LoadExtendedLine<Filter>(mosaic, d, x, w, line.data());
+
+            size_t y = 0;
+            for (; y + SIMD_ITEMS <= w; y += SIMD_ITEMS) {
+                // shift and clamp to [0, UINT16_MAX] like NormalizeSum
+                __m128i low  = _mm_srai_epi32(FilterSums4<Filter>(line.data() + y), Filter::kShift);
+                __m128i high = _mm_srai_epi32(FilterSums4<Filter>(line.data() + y + 4), Filter::kShift);
+                __m128i filtered = _mm_packus_epi32(low, high);
+
+                if (d == HORIZONTAL) {
+                    // Green pixels stay as they are in the mosaic
+                    auto row = reinterpret_cast<const uint16_t*>(mosaic.Data()) + x * w;
+                    __m128i green = _mm_loadu_si128((const __m128i*)(row + y));
+                    __m128i result = _mm_blendv_epi8(green, filtered, rb_lanes[pf]);
+                    _mm_storeu_si128((__m128i*)(reinterpret_cast<uint16_t*>(dest.Data()) + x * w + y), result);
+                }
+                else {
+                    uint16_t result[SIMD_ITEMS];
+                    _mm_storeu_si128((__m128i*)result, filtered);
+                    for (size_t i = 0; i < SIMD_ITEMS; ++i) {
+                        bool is_rb = ((y + i) & 1) == pf;
+                        auto value = is_rb ? result[i] : static_cast<uint16_t>(line[y + i + kOff]);
+                        dest.Set(y + i, x, value);
+                    }
+                }
+            }
+            // Deal with the rest
+            for (; y < w; ++y) {
+                bool is_rb = (y & 1) == pf;
+                auto value = is_rb ? NormalizeSum<Filter>(FilterSum<Filter>(line.data() + y, 1))
+                                   : static_cast<uint16_t>(line[y + kOff]);
+                SetDirectional(dest, x, y, d, value);
+            }
+#if defined(EXACT_BORDERS)
+            // Compensate the pixels near the border
+            border::Split(pf, w, w, kOff, [&](size_t begin, size_t end, bool inside) {
+                if (inside) {
+                    return;
+                }
+                for (size_t y = begin + ((begin & 1) != pf); y < end; y += 2) {
+                    auto sum = BorderSum<Filter>(FilterSum<Filter>(line.data() + y, 1), y, w);
+                    SetDirectional(dest, x, y, d, NormalizeSum<Filter>(sum));
+                }
+            });
+#endif
+        }
+    }
+#endif
+
+    // Chooses the implementation by define SIMD
+    template <typename Filter>
+    void InterpolateDirectional(const Bitmap& mosaic, Direction d, Bitmap& dest) {
+#if defined(SIMD)
+        InterpolateDirectionalWithSIMD<Filter>(mosaic, d, dest);
+#else
+        InterpolateDirectionalSimple<Filter>(mosaic, d, dest);
+#endif
+    }
+
+    // Interpolates green in both directions only for pixels of the region
+    template <typename Filter>
+    void InterpolateGreenVHRegion(const Bitmap& mosaic, BitmapVH& green_vh, const Region& region) {
+        constexpr size_t kOff = Filter::kOffset;
+        size_t h = mosaic.Height();
+        size_t w = mosaic.Width();
+        auto m  = reinterpret_cast<const uint16_t*>(mosaic.Data());
+        auto gv = reinterpret_cast<uint16_t*>(green_vh.V.Data());
+        auto gh = reinterpret_cast<uint16_t*>(green_vh.H.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            // position of the first R or B in a row
+            SIZE_T_PF(x)
+            size_t row_pos = x * w;
+
+            // Green pixels stay as they are in the mosaic
+            size_t count = (region.y_end - region.y_begin) * sizeof(uint16_t);
+            std::memcpy(gv + row_pos + region.y_begin, m + row_pos + region.y_begin, count);
+            std::memcpy(gh + row_pos + region.y_begin, m + row_pos + region.y_begin, count);
+
+            border::Split(region.y_begin, region.y_end, w, kOff, [&](size_t begin, size_t end, bool inside) {
+                size_t y = begin + ((begin & 1) != pf);
+#if defined(SIMD)
+                // 8 pixels a vector from a red or blue one: filtered values of the green
+                // ones (odd lanes) are replaced by the mosaic. The edge columns and
+                // rows are left to the scalar loops
+                if (inside && x >= kOff && x + kOff < h) {
+                    const __m128i rb_lanes = _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+                    for (; y + 8 <= end; y += 8) {
+                        size_t i = row_pos + y;
+                        __m128i green = _mm_loadu_si128((const __m128i*)(m + i));
+                        __m128i h_values = Filter8<Filter>(m + i - kOff, 1);
+                        __m128i v_values = Filter8<Filter>(m + i - kOff * w, w);
+                        _mm_storeu_si128((__m128i*)(gh + i), _mm_blendv_epi8(green, h_values, rb_lanes));
+                        _mm_storeu_si128((__m128i*)(gv + i), _mm_blendv_epi8(green, v_values, rb_lanes));
+                    }
+                }
+#endif
+                if (inside) {
+                    for (; y < end; y += 2) {
+                        gh[row_pos + y] = NormalizeSum<Filter>(FilterSum<Filter>(m + row_pos + y - kOff, 1));
+                        gv[row_pos + y] = ApplyFilter<Filter>(m + y, w, x, h);
+                    }
+                }
+                else {
+                    for (; y < end; y += 2) {
+                        gh[row_pos + y] = ApplyFilter<Filter>(m + row_pos, 1, y, w);
+                        gv[row_pos + y] = ApplyFilter<Filter>(m + y, w, x, h);
+                    }
+                }
+            });
+        }
+    }
+} // namespace menon::fir
@@ -1,11 +1,67 @@
 #pragma once
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
 
 namespace menon {
-    using FIRFilter = std::vector<int>;
     enum Direction {
         HORIZONTAL = 0,
         VERTICAL   = 1,
     };
+
+    // FIR filter of the directional green interpolation given by integer taps
+    // The filter is (taps / sum of taps). The sum must be a power of two,
+    // so the division is a shift. The number of taps must be odd
+    // Everything is computed at compile time (see directional_filter.hpp)
+    template <int... kCoefficients>
+    struct FIRFilter {
+        static constexpr size_t kSize = sizeof...(kCoefficients);
+        static constexpr std::array<int, kSize> kTaps{kCoefficients...};
+        // Offset from the first tap of the filter to the result pixel
+        static constexpr size_t kOffset = kSize >> 1;
+        static constexpr int kSum = (kCoefficients + ...);
+
+        static constexpr int Log2(int value) {
+            int shift = 0;
+            while ((1 << shift) < value) {
+                ++shift;
+            }
+            return shift;
+        }
+        static constexpr int kShift = Log2(kSum);
+
+        // Matrix of the sum of taps in the segment [i, j] of the filter
+        // Used to renormalise the filter partially out of the image (EXACT_BORDERS)
+        static constexpr auto CreateSubSums() {
+            std::array<std::array<int, kSize>, kSize> matrix{};
+            for (size_t i = 0; i < kSize; ++i) {
+                int segment_sum = 0;
+                for (size_t j = i; j < kSize; ++j) {
+                    segment_sum += kTaps[j];
+                    matrix[i][j] = segment_sum;
+                }
+            }
+            return matrix;
+        }
+        static constexpr auto kSubSums = CreateSubSums();
+
+        // Segments containing the result pixel are used for renormalisation
+        static constexpr bool HasNonZeroSubSums() {
+            for (size_t i = 0; i <= kOffset; ++i) {
+                for (size_t j = kOffset; j < kSize; ++j) {
+                    if (kSubSums[i][j] == 0) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        static_assert(kSize % 2 == 1, "The number of taps must be odd");
+        static_assert(kSum > 0 && (kSum & (kSum - 1)) == 0, "The sum of taps must be a power of two");
+        static_assert(HasNonZeroSubSums(), "Segments of taps around the center must have non-zero sums");
+    };
+
+    // 4 * (FIR filter proposed in the article)
+    using MenonFilter = FIRFilter<-1, 2, 2, 2, -1>;
 } // namespace menon
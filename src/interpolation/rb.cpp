@@ -1,80 +1,109 @@
 #include "rb.hpp"
 #include "../support/bitmap_arithmetics.hpp"
+#include "../support/border.hpp"
+#include "../support/strided.hpp"
+#include <algorithm>
+#include <cstring>
 #include <thread>
 
 namespace menon {
 
-    /////////////////////////////////////////////////////////////////////
-    // Variants:
-    void FillGreenRBSimple(Bitmap& red, Bitmap& blue, const Bitmap& chrom);
-    void FillRBRBSimple(Bitmap& red, Bitmap& blue, const Bitmap& chrom);
+    // Variants are declared in the header
+
+    // (c1 - c2) / 2 like SubDiv2 does it
+    inline int16_t HalfDifference(uint16_t c1, uint16_t c2) {
+        return static_cast<int16_t>(static_cast<uint16_t>(c1 >> 1) - static_cast<uint16_t>(c2 >> 1));
+    }
+
+    inline uint16_t Clamp16(int v) {
+        return static_cast<uint16_t>(std::min(std::max(v, 0), UINT16_MAX));
+    }
 
     ////////////////////////////////////////////////////////////////////////////////////
     // Implementations:
 
-    // Fills Red and Blue for ONLY green pixels of the mosaic
-    // red and blue must be copies of the mosaic
+    // Fills Red and Blue for all pixels of the mosaic:
+    // interpolated on green pixels and the mosaic values on the others
     // chrom is a chrominance 'R-G and B-G' matrix
-    void FillGreenRB(Bitmap& red, Bitmap& blue, const Bitmap& chrom) {
-        // use of SIMD is ineffective here
-        FillGreenRBSimple(red, blue, chrom);
+    void FillGreenRB(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& red, Bitmap& blue) {
+#if defined(SIMD)
+        FillGreenRBWithSIMD(mosaic, chrom, red, blue);
+#else
+        FillGreenRBSimple(mosaic, chrom, red, blue);
+#endif
     }
 
     // Fills Red and Blue for red and blue pixels of the mosaic
-    // red and blue must be copies of the mosaic except green pixels
+    // red and blue must be filled by FillGreenRB
     // diff is a difference between classifiers
     void FillRBRB(Bitmap& red, Bitmap& blue, const Bitmap& diff) {
-        // use of SIMD is ineffective here
+#if defined(SIMD)
+        FillRBRBWithSIMD(red, blue, diff);
+#else
         FillRBRBSimple(red, blue, diff);
+#endif
     }
 
-    // FIll C color on Green pixels
+    // FIll C color of every pixel: the mosaic value or interpolated on Green pixels
     // Implementation without SIMD
     // odd = 0 for red and 1 for blue
-    void FillGreenCSimple(Bitmap& color, const Bitmap& chrom, int odd) {
+    void FillGreenCSimple(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& color, int odd) {
         size_t h = chrom.Height();
         size_t w = chrom.Width();
         for (size_t x = 0; x < h; ++x) {
             SIZE_T_PF(x)
             bool is_c_row = (x & 1) == odd;
 
-            for (size_t y = 1-pf; y < w; y += 2) {
-                int c = color.Get<uint16_t>(x, y);
-                if (is_c_row) {
-                    c += chrom.GetSafe<int16_t>(x, y - 1);
-                    c += chrom.GetSafe<int16_t>(x, y + 1);
+            // Bounds are checked only near the border
+            border::ForEachRowPart(x, 0, w, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                for (size_t y = begin; y < end; ++y) {
+                    int c = mosaic.Get<uint16_t>(x, y);
+                    if ((y & 1) == pf) {
+                        // red or blue pixel
+                        color.Set(x, y, static_cast<uint16_t>(c));
+                        continue;
+                    }
+                    if (is_c_row) {
+                        c += border::Get<kInside, int16_t>(chrom, x, y - 1);
+                        c += border::Get<kInside, int16_t>(chrom, x, y + 1);
+                    }
+                    else {
+                        c += border::Get<kInside, int16_t>(chrom, x - 1, y);
+                        c += border::Get<kInside, int16_t>(chrom, x + 1, y);
+                    }
+                    color.Set(x, y, Clamp16(c));
                 }
-                else {
-                    c += chrom.GetSafe<int16_t>(x - 1, y);
-                    c += chrom.GetSafe<int16_t>(x + 1, y);
-                }
-                c = std::min(std::max(c, 0), UINT16_MAX);
-                color.Set(x, y, static_cast<uint16_t>(c));
-            }
+            });
         }
     }
 
-    void FillGreenRBSimple(Bitmap& red, Bitmap& blue, const Bitmap& chrom) {
-#if not defined (PARALLEL)
-        std::thread fill_red ([&](){ FillGreenCSimple(red, chrom, 0); });
-        std::thread fill_blue([&](){ FillGreenCSimple(blue, chrom, 1); });
+    void FillGreenRBSimple(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& red, Bitmap& blue) {
+#if defined(PARALLEL)
+        std::thread fill_red ([&](){ FillGreenCSimple(mosaic, chrom, red, 0); });
+        std::thread fill_blue([&](){ FillGreenCSimple(mosaic, chrom, blue, 1); });
         fill_red.join();
         fill_blue.join();
 #else
-        FillGreenCSimple(red, chrom, 0);
-        FillGreenCSimple(blue, chrom, 1);
+        FillGreenCSimple(mosaic, chrom, red, 0);
+        FillGreenCSimple(mosaic, chrom, blue, 1);
 #endif
     }
 
     // Implementation without SIMD
+    // In place: reads only green pixels of red and blue and writes only the others
     void FillRBRBSimple(Bitmap& red, Bitmap& blue, const Bitmap& diff) {
         size_t h = red.Height();
         size_t w = red.Width();
 
-        // (R - B) / 2;
+        // (R - B) / 2 of a green pixel or zero if it is out of bounds
         // we lose quality(last bit) but win speed
-        auto rb_chrom = red;
-        SubDiv2(rb_chrom, blue);
+        auto rb_chrom = [&](size_t x, size_t y) -> int {
+            if (x < h && y < w) {
+                return HalfDifference(red.Get<uint16_t>(x, y), blue.Get<uint16_t>(x, y));
+            }
+            return 0;
+        };
 
         for (size_t x = 0; x < h; ++x) {
             SIZE_T_PF(x)
@@ -84,12 +113,12 @@ namespace menon {
                 int c = (is_red_row ? red : blue).Get<uint16_t>(x, y);
                 int sum = 0;
                 if (diff.Get<int>(x, y) < 0) {
-                    sum += rb_chrom.GetSafe<int16_t>(x, y - 1);
-                    sum += rb_chrom.GetSafe<int16_t>(x, y + 1);
+                    sum += rb_chrom(x, y - 1);
+                    sum += rb_chrom(x, y + 1);
                 }
                 else {
-                    sum += rb_chrom.GetSafe<int16_t>(x - 1, y);
-                    sum += rb_chrom.GetSafe<int16_t>(x + 1, y);
+                    sum += rb_chrom(x - 1, y);
+                    sum += rb_chrom(x + 1, y);
                 }
                 c += (is_red_row ? -sum : sum );
                 c = std::min(std::max(c, 0), UINT16_MAX);
@@ -99,17 +128,153 @@ namespace menon {
         }
     }
 
+    // Sets C color of pixels [begin, end) of row x: the mosaic value
+    // or interpolated on green pixels. odd = 0 for red and 1 for blue
+    // Vector part on the interior, the rest as FillGreenCSimple does it
+    void FillGreenCRow(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& color, int odd,
+                       size_t x, size_t begin, size_t end) {
+        size_t h = chrom.Height();
+        size_t w = chrom.Width();
+        auto m  = reinterpret_cast<const uint16_t*>(mosaic.Data());
+        auto c  = reinterpret_cast<uint16_t*>(color.Data());
+
+        SIZE_T_PF(x)
+        size_t row_pos = x * w;
+        bool is_c_row = (x & 1) == odd;
+
+        std::memcpy(c + row_pos + begin, m + row_pos + begin, (end - begin) * sizeof(uint16_t));
+        border::ForEachRowPart(x, begin, end, h, w, [&](auto inside, size_t part_begin, size_t part_end) {
+            constexpr bool kInside = decltype(inside)::value;
+            size_t y = part_begin + ((part_begin & 1) == pf);
+#if defined(SIMD)
+            if constexpr (kInside) {
+                auto ch = reinterpret_cast<const int16_t*>(chrom.Data());
+                // Distance to the neighbours with the chrominance of C
+                size_t step = is_c_row ? 1 : w;
+                for (; y + strided::kLast < part_end; y += strided::kStep) {
+                    size_t i = row_pos + y;
+                    __m128i sum = _mm_add_epi32(strided::LoadI16(ch + i - step), strided::LoadI16(ch + i + step));
+                    strided::StoreU16(c + i, _mm_add_epi32(strided::LoadU16(m + i), sum));
+                }
+            }
+#endif
+            for (; y < part_end; y += 2) {
+                int v = m[row_pos + y];
+                if (is_c_row) {
+                    v += border::Get<kInside, int16_t>(chrom, x, y - 1);
+                    v += border::Get<kInside, int16_t>(chrom, x, y + 1);
+                }
+                else {
+                    v += border::Get<kInside, int16_t>(chrom, x - 1, y);
+                    v += border::Get<kInside, int16_t>(chrom, x + 1, y);
+                }
+                c[row_pos + y] = Clamp16(v);
+            }
+        });
+    }
+
+    // Sets the other color of red and blue pixels [begin, end) of row x
+    // Vector part on the interior, the rest as FillRBRBSimple does it
+    void FillRBRBRow(Bitmap& red, Bitmap& blue, const Bitmap& diff, size_t x, size_t begin, size_t end) {
+        size_t h = diff.Height();
+        size_t w = diff.Width();
+        auto r = reinterpret_cast<uint16_t*>(red.Data());
+        auto b = reinterpret_cast<uint16_t*>(blue.Data());
+        auto d = reinterpret_cast<const int*>(diff.Data());
+
+        // (R - B) / 2 of a green pixel, or zero if it is out of bounds
+        auto rb_chrom = [&](size_t cx, size_t cy) -> int {
+            if (cx < h && cy < w) {
+                return HalfDifference(r[cx * w + cy], b[cx * w + cy]);
+            }
+            return 0;
+        };
+
+        SIZE_T_PF(x)
+        bool is_red_row = (~x) & 1;
+        size_t row_pos = x * w;
+        // Known color of the row and the one to find
+        const uint16_t* known = is_red_row ? r : b;
+        uint16_t* found = is_red_row ? b : r;
+
+        // Only the vector path depends on the part: rb_chrom checks the bounds itself
+        border::ForEachRowPart(x, begin, end, h, w, [&]([[maybe_unused]] auto inside, size_t part_begin,
+                                                        size_t part_end) {
+            size_t y = part_begin + ((part_begin & 1) != pf);
+#if defined(SIMD)
+            constexpr bool kInside = decltype(inside)::value;
+            if constexpr (kInside) {
+                auto half_difference = [&](size_t i) {
+                    return _mm_sub_epi32(_mm_srli_epi32(strided::LoadU16(r + i), 1),
+                                         _mm_srli_epi32(strided::LoadU16(b + i), 1));
+                };
+                for (; y + strided::kLast < part_end; y += strided::kStep) {
+                    size_t i = row_pos + y;
+                    __m128i along  = _mm_add_epi32(half_difference(i - 1), half_difference(i + 1));
+                    __m128i across = _mm_add_epi32(half_difference(i - w), half_difference(i + w));
+                    __m128i sum = strided::SelectNegative(strided::LoadI32(d + i), along, across);
+                    __m128i v = strided::LoadU16(known + i);
+                    strided::StoreU16(found + i, is_red_row ? _mm_sub_epi32(v, sum) : _mm_add_epi32(v, sum));
+                }
+            }
+#endif
+            for (; y < part_end; y += 2) {
+                size_t i = row_pos + y;
+                int sum = 0;
+                if (d[i] < 0) {
+                    sum += rb_chrom(x, y - 1);
+                    sum += rb_chrom(x, y + 1);
+                }
+                else {
+                    sum += rb_chrom(x - 1, y);
+                    sum += rb_chrom(x + 1, y);
+                }
+                found[i] = Clamp16(is_red_row ? known[i] - sum : known[i] + sum);
+            }
+        });
+    }
+
+#if defined(SIMD)
+    void FillGreenRBWithSIMD(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& red, Bitmap& blue) {
+        size_t h = chrom.Height();
+        size_t w = chrom.Width();
+        auto fill = [&](Bitmap& color, int odd) {
+            for (size_t x = 0; x < h; ++x) {
+                FillGreenCRow(mosaic, chrom, color, odd, x, 0, w);
+            }
+        };
+#if defined(PARALLEL)
+        std::thread fill_red ([&](){ fill(red, 0); });
+        std::thread fill_blue([&](){ fill(blue, 1); });
+        fill_red.join();
+        fill_blue.join();
+#else
+        fill(red, 0);
+        fill(blue, 1);
+#endif
+    }
+
+    void FillRBRBWithSIMD(Bitmap& red, Bitmap& blue, const Bitmap& diff) {
+        for (size_t x = 0; x < diff.Height(); ++x) {
+            FillRBRBRow(red, blue, diff, x, 0, diff.Width());
+        }
+    }
+#endif
+
     BitmapVH InterpolateRBonGreen(const Bitmap& mosaic, const Bitmap& green) {
-        Bitmap red (mosaic);
-        Bitmap blue(mosaic);
+        size_t h = mosaic.Height();
+        size_t w = mosaic.Width();
+        Bitmap chrom(h, w, sizeof(int16_t));
+        auto rb = BitmapVH::Create(h, w, sizeof(uint16_t));
+        InterpolateRBonGreen(mosaic, green, chrom, rb);
+        return rb;
+    }
 
+    void InterpolateRBonGreen(const Bitmap& mosaic, const Bitmap& green, Bitmap& chrom, BitmapVH& rb) {
         // Chrominance (R - G) / 2 or (B - G) / 2.
-        auto chrom = mosaic;
-        SubDiv2(chrom, green);
-
-        FillGreenRB(red, blue, chrom);
+        SubDiv2(mosaic, green, chrom);
 
-        return BitmapVH{std::move(red), std::move(blue)};
+        FillGreenRB(mosaic, chrom, rb.V, rb.H);
     }
 
     void FillRBonRB(BitmapVH& rb, const Bitmap& diff) {
@@ -117,6 +282,44 @@ namespace menon {
     }
 
 
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Region variants:
 
+    void GetColorDifferenceRegion(const Bitmap& mosaic, const Bitmap& green,
+                                  Bitmap& chrom, const Region& region) {
+        size_t w = mosaic.Width();
+        auto m = reinterpret_cast<const uint16_t*>(mosaic.Data());
+        auto g = reinterpret_cast<const uint16_t*>(green.Data());
+        auto c = reinterpret_cast<int16_t*>(chrom.Data());
 
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            size_t y = region.y_begin;
+#if defined(SIMD)
+            // The same as SubDiv2WithSIMD
+            for (; y + 8 <= region.y_end; y += 8) {
+                size_t i = x * w + y;
+                __m128i half_m = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m + i)), 1);
+                __m128i half_g = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i)), 1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c + i), _mm_sub_epi16(half_m, half_g));
+            }
+#endif
+            for (; y < region.y_end; ++y) {
+                c[x * w + y] = HalfDifference(m[x * w + y], g[x * w + y]);
+            }
+        }
+    }
+
+    void InterpolateRBonGreenRegion(const Bitmap& mosaic, const Bitmap& chrom,
+                                    BitmapVH& rb, const Region& region) {
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            FillGreenCRow(mosaic, chrom, rb.V, 0, x, region.y_begin, region.y_end);
+            FillGreenCRow(mosaic, chrom, rb.H, 1, x, region.y_begin, region.y_end);
+        }
+    }
+
+    void FillRBonRBRegion(BitmapVH& rb, const Bitmap& diff, const Region& region) {
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            FillRBRBRow(rb.V, rb.H, diff, x, region.y_begin, region.y_end);
+        }
+    }
 } // namespace menon
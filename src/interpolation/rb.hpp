@@ -8,7 +8,12 @@ namespace menon {
     // In other words returns BitmapVH{ red, blue };
     BitmapVH InterpolateRBonGreen(const Bitmap& mosaic, const Bitmap& green);
 
-    // Changes red and blue colors FOR RED AND BLUE PIXELS
+    // The same writing every pixel of preallocated buffers
+    // chrom - Bitmap<int16_t> for the chrominance (contents are lost)
+    // rb - pair of Bitmap<uint16_t>
+    void InterpolateRBonGreen(const Bitmap& mosaic, const Bitmap& green, Bitmap& chrom, BitmapVH& rb);
+
+    // Changes red and blue colors FOR RED AND BLUE PIXELS in place
     //
     // rb - pair of red and blue color as rb.V and rb.H respectively
     // diff - the difference of classifiers of each pixel
@@ -16,4 +21,33 @@ namespace menon {
             BitmapVH& rb,
             const Bitmap& diff
             );
-}
\ No newline at end of file
+
+    // Region variants. Write only pixels of the region,
+    // so they are safe to call concurrently for disjoint regions
+
+    // Computes chrominance (mosaic - green) / 2
+    // chrom - preallocated Bitmap<int16_t>
+    void GetColorDifferenceRegion(const Bitmap& mosaic, const Bitmap& green,
+                                  Bitmap& chrom, const Region& region);
+
+    // Sets red and blue colors for every pixel of the region:
+    // values of the mosaic on red and blue pixels, interpolated on green ones
+    // rb - preallocated pair of Bitmap<uint16_t>
+    // Reads chrom rows and columns in region +- 1
+    void InterpolateRBonGreenRegion(const Bitmap& mosaic, const Bitmap& chrom,
+                                    BitmapVH& rb, const Region& region);
+
+    // The same as FillRBonRB for pixels of the region
+    // Reads green pixels of rb in region +- 1
+    void FillRBonRBRegion(BitmapVH& rb, const Bitmap& diff, const Region& region);
+
+    // Variants of the steps of InterpolateRBonGreen (after the chrominance) and FillRBonRB.
+    // All variants must give the same result (see check/differential.hpp)
+    // red, blue - Bitmap<uint16_t>; chrom - Bitmap<int16_t>; diff - Bitmap<int>
+    void FillGreenRBSimple(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& red, Bitmap& blue);
+    void FillRBRBSimple(Bitmap& red, Bitmap& blue, const Bitmap& diff);
+#if defined(SIMD)
+    void FillGreenRBWithSIMD(const Bitmap& mosaic, const Bitmap& chrom, Bitmap& red, Bitmap& blue);
+    void FillRBRBWithSIMD(Bitmap& red, Bitmap& blue, const Bitmap& diff);
+#endif
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <stdexcept>
+#include "compression.hpp"
+
+#if defined(USE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace io {
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // PackBits:
+
+    void EncodePackBitsRow(const uint8_t* row, size_t size, std::vector<uint8_t>& out) {
+        constexpr size_t kMaxRun = 128;
+        size_t i = 0;
+        while (i < size) {
+            // Length of the run of equal bytes from i
+            size_t run = 1;
+            while (i + run < size && run < kMaxRun && row[i + run] == row[i]) {
+                ++run;
+            }
+            if (run >= 2) {
+                out.push_back(static_cast<uint8_t>(1 - static_cast<int>(run)));
+                out.push_back(row[i]);
+                i += run;
+                continue;
+            }
+            // Literal bytes until the next run of at least two equal bytes
+            size_t literal = 1;
+            while (i + literal < size && literal < kMaxRun
+                   && !(i + literal + 1 < size && row[i + literal] == row[i + literal + 1])) {
+                ++literal;
+            }
+            out.push_back(static_cast<uint8_t>(literal - 1));
+            out.insert(out.end(), row + i, row + i + literal);
+            i += literal;
+        }
+    }
+
+    void EncodePackBits(const uint8_t* data, size_t size, size_t row_bytes, std::vector<uint8_t>& out) {
+        for (size_t pos = 0; pos < size; pos += row_bytes) {
+            EncodePackBitsRow(data + pos, std::min(row_bytes, size - pos), out);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // LZW:
+
+    // Writer of MSB-first codes of variable length
+    class CodeWriter {
+    public:
+        explicit CodeWriter(std::vector<uint8_t>& out) : out_{out} {
+        }
+
+        void Put(uint32_t code, int bits) {
+            buffer_ = (buffer_ << bits) | code;
+            buffered_ += bits;
+            while (buffered_ >= 8) {
+                buffered_ -= 8;
+                out_.push_back(static_cast<uint8_t>(buffer_ >> buffered_));
+            }
+        }
+
+        void Flush() {
+            if (buffered_ > 0) {
+                out_.push_back(static_cast<uint8_t>(buffer_ << (8 - buffered_)));
+                buffered_ = 0;
+            }
+        }
+
+    private:
+        std::vector<uint8_t>& out_;
+        uint64_t buffer_{0};
+        int buffered_{0};
+    };
+
+    void EncodeLZW(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+        constexpr uint32_t kClear = 256;
+        constexpr uint32_t kEndOfInformation = 257;
+        constexpr uint32_t kFirstCode = 258;
+        constexpr int kMinBits = 9;
+        constexpr int kMaxBits = 12;
+        constexpr uint32_t kMaxCode = (1u << kMaxBits) - 1;
+        // Open addressing table of strings: key is (prefix code << 8 | byte)
+        constexpr size_t kTableSize = 9001; // prime, like in libtiff
+        std::vector<int32_t> keys(kTableSize, -1);
+        std::vector<uint16_t> codes(kTableSize);
+
+        CodeWriter writer(out);
+        int bits = kMinBits;
+        uint32_t next_code = kFirstCode;
+
+        // Adds a string to the table after a code is emitted.
+        // Returns false if the table is full and was cleared
+        auto grow = [&]() {
+            ++next_code;
+            if (next_code == kMaxCode - 1) {
+                writer.Put(kClear, bits);
+                std::fill(keys.begin(), keys.end(), -1);
+                next_code = kFirstCode;
+                bits = kMinBits;
+                return false;
+            }
+            if (next_code > (1u << bits) - 1) {
+                ++bits;
+            }
+            return true;
+        };
+
+        writer.Put(kClear, bits);
+        if (size > 0) {
+            uint32_t prefix = data[0];
+            for (size_t i = 1; i < size; ++i) {
+                uint8_t byte = data[i];
+                auto key = static_cast<int32_t>((prefix << 8) | byte);
+                size_t slot = static_cast<size_t>(key) % kTableSize;
+                while (keys[slot] != -1 && keys[slot] != key) {
+                    slot = slot + 1 < kTableSize ? slot + 1 : 0;
+                }
+                if (keys[slot] == key) {
+                    prefix = codes[slot];
+                    continue;
+                }
+                writer.Put(prefix, bits);
+                // The new string gets next_code before the table grows
+                keys[slot] = key;
+                codes[slot] = static_cast<uint16_t>(next_code);
+                grow();
+                prefix = byte;
+            }
+            writer.Put(prefix, bits);
+            // The decoder adds a string after the last code too
+            grow();
+        }
+        writer.Put(kEndOfInformation, bits);
+        writer.Flush();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Deflate:
+
+    void EncodeDeflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+#if defined(USE_ZLIB)
+        size_t begin = out.size();
+        uLongf bound = compressBound(static_cast<uLong>(size));
+        out.resize(begin + bound);
+        if (compress2(out.data() + begin, &bound, data, static_cast<uLong>(size), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            throw std::runtime_error("Deflate compression failed");
+        }
+        out.resize(begin + bound);
+#else
+        (void)data;
+        (void)size;
+        (void)out;
+        throw std::runtime_error("Built without zlib: Deflate compression is not available");
+#endif
+    }
+} // namespace io
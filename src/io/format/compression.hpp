@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace io {
+    // Lossless encoders of TIFF strips
+    // Every encoder appends the encoded data to 'out'
+
+    // PackBits run-length encoding (TIFF Compression = 32773)
+    // Rows of 'row_bytes' bytes are packed separately as TIFF requires
+    void EncodePackBits(const uint8_t* data, size_t size, size_t row_bytes, std::vector<uint8_t>& out);
+
+    // TIFF LZW encoding: MSB-first codes of 9 to 12 bits with "early change"
+    // (TIFF Compression = 5)
+    void EncodeLZW(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    // zlib stream (TIFF Compression = 8, Adobe Deflate)
+    // Exception if built without zlib (define USE_ZLIB)
+    void EncodeDeflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    // Horizontal differencing (TIFF Predictor = 2) of rows of 'row_items' pixels
+    // with 'samples' samples of type T each. In place
+    template <typename T>
+    void ApplyHorizontalPredictor(T* data, size_t rows, size_t row_items, size_t samples) {
+        size_t row_size = row_items * samples;
+        for (size_t x = 0; x < rows; ++x) {
+            T* row = data + x * row_size;
+            for (size_t i = row_size; i-- > samples;) {
+                row[i] = static_cast<T>(row[i] - row[i - samples]);
+            }
+        }
+    }
+} // namespace io
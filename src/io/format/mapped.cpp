@@ -0,0 +1,251 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include "mapped.hpp"
+#include "tiff.hpp"
+
+namespace io {
+
+    namespace {
+        // Closes file descriptor on scope exit
+        struct FileGuard {
+            int fd;
+            ~FileGuard() {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        };
+
+        // TIFF tags and types used to find pixel data
+        constexpr uint16_t kTagWidth           = 256;
+        constexpr uint16_t kTagHeight          = 257;
+        constexpr uint16_t kTagBitsPerSample   = 258;
+        constexpr uint16_t kTagCompression     = 259;
+        constexpr uint16_t kTagStripOffsets    = 273;
+        constexpr uint16_t kTagSamplesPerPixel = 277;
+        constexpr uint16_t kTagStripByteCounts = 279;
+        constexpr uint16_t kTagTileWidth       = 322;
+        constexpr uint16_t kTagSampleFormat    = 339;
+
+        constexpr uint16_t kTypeShort = 3;
+        constexpr uint16_t kTypeLong  = 4;
+
+        bool IsHostLittleEndian() {
+            const uint16_t one = 1;
+            return *reinterpret_cast<const uint8_t*>(&one) == 1;
+        }
+
+        // Reader of the TIFF header of the file mapped to memory
+        // Only the byte order of the host is supported
+        class Header {
+        public:
+            Header(const uint8_t* file, size_t size)
+                : file_{file}, size_{size} {
+            }
+
+            template <typename T>
+            bool Read(size_t offset, T& value) const {
+                if (offset + sizeof(T) > size_) {
+                    return false;
+                }
+                std::memcpy(&value, file_ + offset, sizeof(T));
+                return true;
+            }
+
+            // Reads i-th value of the entry of SHORT or LONG type
+            bool ReadValue(size_t entry, size_t i, uint32_t& value) const {
+                uint16_t type;
+                uint32_t count;
+                if (!Read(entry + 2, type) || !Read(entry + 4, count) || i >= count
+                    || (type != kTypeShort && type != kTypeLong)) {
+                    return false;
+                }
+                size_t item = type == kTypeShort ? sizeof(uint16_t) : sizeof(uint32_t);
+                size_t at = entry + 8;
+                if (item * count > sizeof(uint32_t)) {
+                    uint32_t values_offset;
+                    if (!Read(at, values_offset)) {
+                        return false;
+                    }
+                    at = values_offset;
+                }
+                at += i * item;
+                if (type == kTypeShort) {
+                    uint16_t short_value;
+                    if (!Read(at, short_value)) {
+                        return false;
+                    }
+                    value = short_value;
+                    return true;
+                }
+                return Read(at, value);
+            }
+
+            bool ReadCount(size_t entry, uint32_t& count) const {
+                return Read(entry + 4, count);
+            }
+
+        private:
+            const uint8_t* file_;
+            size_t size_;
+        };
+
+        // Pixel data location of the first image of the TIFF
+        struct Layout {
+            uint32_t width{0}, height{0};
+            uint16_t bytes_per_pixel{0};
+            size_t offset{0};
+        };
+
+        // Checks that the first image is one-sampled, uncompressed and stored
+        // in contiguous strips. Returns false if it is not
+        bool FindContiguousLayout(const uint8_t* file, size_t size, Layout& layout) {
+            Header header(file, size);
+            uint16_t order, magic;
+            uint32_t ifd;
+            if (!header.Read(0, order) || !header.Read(2, magic) || !header.Read(4, ifd)) {
+                return false;
+            }
+            // "II" - little endian, "MM" - big endian. 42 - classic TIFF (not BigTIFF)
+            bool little = order == 0x4949;
+            if ((order != 0x4949 && order != 0x4D4D) || little != IsHostLittleEndian() || magic != 42) {
+                return false;
+            }
+
+            uint16_t entries;
+            if (!header.Read(ifd, entries)) {
+                return false;
+            }
+            uint32_t compression = 1, samples = 1, bits = 1, format = 1;
+            size_t offsets_entry = 0, counts_entry = 0;
+            for (size_t i = 0; i < entries; ++i) {
+                size_t entry = ifd + 2 + i * 12;
+                uint16_t tag;
+                if (!header.Read(entry, tag)) {
+                    return false;
+                }
+                bool ok = true;
+                switch (tag) {
+                    case kTagWidth:           ok = header.ReadValue(entry, 0, layout.width); break;
+                    case kTagHeight:          ok = header.ReadValue(entry, 0, layout.height); break;
+                    case kTagBitsPerSample:   ok = header.ReadValue(entry, 0, bits); break;
+                    case kTagCompression:     ok = header.ReadValue(entry, 0, compression); break;
+                    case kTagSamplesPerPixel: ok = header.ReadValue(entry, 0, samples); break;
+                    case kTagSampleFormat:    ok = header.ReadValue(entry, 0, format); break;
+                    case kTagStripOffsets:    offsets_entry = entry; break;
+                    case kTagStripByteCounts: counts_entry = entry; break;
+                    case kTagTileWidth:       return false; // tiled image
+                    default: break;
+                }
+                if (!ok) {
+                    return false;
+                }
+            }
+            if (compression != 1 || samples != 1 || format != 1 || (bits & 7) != 0
+                || bits == 0 || bits > 16 || offsets_entry == 0 || counts_entry == 0) {
+                return false;
+            }
+
+            // Strips must follow each other without gaps
+            uint32_t strips, counts;
+            if (!header.ReadCount(offsets_entry, strips) || !header.ReadCount(counts_entry, counts)
+                || strips != counts || strips == 0) {
+                return false;
+            }
+            uint32_t first;
+            if (!header.ReadValue(offsets_entry, 0, first)) {
+                return false;
+            }
+            size_t end = first;
+            for (uint32_t i = 0; i < strips; ++i) {
+                uint32_t strip_offset, strip_bytes;
+                if (!header.ReadValue(offsets_entry, i, strip_offset)
+                    || !header.ReadValue(counts_entry, i, strip_bytes)
+                    || strip_offset != end) {
+                    return false;
+                }
+                end += strip_bytes;
+            }
+
+            layout.bytes_per_pixel = static_cast<uint16_t>(bits >> 3);
+            layout.offset = first;
+            size_t expected = static_cast<size_t>(layout.width) * layout.height * layout.bytes_per_pixel;
+            return expected > 0 && end - first >= expected && first + expected <= size;
+        }
+
+        // Maps 'bytes' bytes of the file from 'offset' followed by
+        // DATA_SAFE_OFFSET readable bytes and wraps them into a bitmap
+        Bitmap MapPixels(int fd, size_t offset, size_t height, size_t width, uint16_t bytes_per_pixel) {
+            size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_t page_offset = offset - offset % page;
+            size_t in_page = offset - page_offset;
+            size_t bytes = height * width * bytes_per_pixel;
+            size_t total = (in_page + bytes + Bitmap::DATA_SAFE_OFFSET + page - 1) / page * page;
+
+            // Reserve anonymous (zero) pages, so SIMD reads after the last pixel
+            // never go beyond the mapping even if the file ends there
+            void* base = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                throw std::runtime_error("Cannot reserve memory for the image");
+            }
+            size_t file_part = std::min(total, in_page + bytes);
+            // Private mapping: writes to the bitmap never reach the file
+            if (mmap(base, file_part, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                     static_cast<off_t>(page_offset)) == MAP_FAILED) {
+                munmap(base, total);
+                throw std::runtime_error("Cannot map the file");
+            }
+            madvise(base, total, MADV_SEQUENTIAL);
+            madvise(base, total, MADV_WILLNEED);
+
+            return Bitmap(height, width, bytes_per_pixel, static_cast<uint8_t*>(base) + in_page,
+                          [base, total](uint8_t*) { munmap(base, total); });
+        }
+
+        size_t FileSize(int fd) {
+            struct stat st{};
+            if (fstat(fd, &st) != 0) {
+                throw std::runtime_error("Cannot get the size of the file");
+            }
+            return static_cast<size_t>(st.st_size);
+        }
+    } // namespace
+
+    Bitmap MapBitmapFromTIFF(const char* file_path) {
+        FileGuard file{open(file_path, O_RDONLY)};
+        if (file.fd < 0) {
+            throw std::runtime_error("File not existent or not accessible");
+        }
+        size_t size = FileSize(file.fd);
+
+        Layout layout;
+        bool contiguous = false;
+        if (size > 0) {
+            void* header = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+            if (header != MAP_FAILED) {
+                contiguous = FindContiguousLayout(static_cast<const uint8_t*>(header), size, layout);
+                munmap(header, size);
+            }
+        }
+        if (!contiguous) {
+            return ReadBitmapFromTIFF(file_path);
+        }
+        return MapPixels(file.fd, layout.offset, layout.height, layout.width, layout.bytes_per_pixel);
+    }
+
+    Bitmap MapBitmapFromRaw(const char* file_path, size_t height, size_t width,
+                            uint16_t bytes_per_pixel, size_t offset) {
+        FileGuard file{open(file_path, O_RDONLY)};
+        if (file.fd < 0) {
+            throw std::runtime_error("File not existent or not accessible");
+        }
+        if (offset + height * width * bytes_per_pixel > FileSize(file.fd) || height * width == 0) {
+            throw std::runtime_error("File is smaller than the image");
+        }
+        return MapPixels(file.fd, offset, height, width, bytes_per_pixel);
+    }
+} // namespace io
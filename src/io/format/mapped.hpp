@@ -0,0 +1,20 @@
+#pragma once
+#include "../../support/bitmap.hpp"
+
+namespace io {
+    // Maps one-sampled uncompressed TIFF format image to memory.
+    // If pixel data is stored in contiguous strips with the host byte order
+    // returns bitmap over the mapped file without copying (copy-on-write pages).
+    // Otherwise falls back to ReadBitmapFromTIFF
+    //
+    // Exception on failure
+    Bitmap MapBitmapFromTIFF(const char* file_path);
+
+    // Maps headerless raw mosaic to memory without copying
+    // height x width samples of bytes_per_pixel bytes in the host byte order
+    // starting from 'offset' bytes of the file
+    //
+    // Exception on failure
+    Bitmap MapBitmapFromRaw(const char* file_path, size_t height, size_t width,
+                            uint16_t bytes_per_pixel, size_t offset = 0);
+} // namespace io
@@ -32,6 +32,47 @@ namespace io {
         return bmp;
     }
 
+    TIFFStackReader::TIFFStackReader(const char* file_path)
+            : tiff_{TinyTIFFReader_open(file_path)} {
+        if (!tiff_) {
+            throw std::runtime_error("File not existent or not accessible");
+        }
+        frames_ = TinyTIFFReader_countFrames(tiff_);
+        height_ = TinyTIFFReader_getHeight(tiff_);
+        width_ = TinyTIFFReader_getWidth(tiff_);
+    }
+
+    TIFFStackReader::~TIFFStackReader() {
+        TinyTIFFReader_close(tiff_);
+    }
+
+    bool TIFFStackReader::Next(Bitmap& frame) {
+        if (read_ == frames_) {
+            return false;
+        }
+        // The reader is at the first page after opening
+        if (read_ != 0 && !TinyTIFFReader_readNext(tiff_)) {
+            throw std::runtime_error("Cannot read the next page");
+        }
+        ++read_;
+
+        const uint32_t width = TinyTIFFReader_getWidth(tiff_);
+        const uint32_t height = TinyTIFFReader_getHeight(tiff_);
+        const uint16_t bits_per_sample = TinyTIFFReader_getBitsPerSample(tiff_, 0);
+        if ((bits_per_sample & 7) != 0 || bits_per_sample == 0) {
+            throw std::runtime_error("Unsupported bits per sample");
+        }
+
+        frame = Bitmap(height, width, bits_per_sample >> 3);
+        TinyTIFFReader_getSampleData(tiff_, frame.Data(), 0);
+
+        auto eptr = TinyTIFFReader_getLastError(tiff_);
+        if (eptr != nullptr && strcmp(eptr, "") != 0) {
+            throw std::runtime_error(eptr);
+        }
+        return true;
+    }
+
     void WriteGreyscaleToTIFF(const Bitmap& image, const char* filename) {
         TinyTIFFWriterFile* tiffw = TinyTIFFWriter_open(
                 filename,
@@ -2,6 +2,8 @@
 #include "../../support/bitmap.hpp"
 #include "../../support/rgb.hpp"
 
+struct TinyTIFFReaderFile;
+
 namespace io {
     // Reads one-sampled TIFF format image.
     // Works only with one-sampled images
@@ -10,6 +12,33 @@ namespace io {
     // Exception on failure
     Bitmap ReadBitmapFromTIFF(const char *file_path);
 
+    // Reads pages (directories) of a multi-page one-sampled TIFF one after another
+    //
+    // Exception on failure
+    class TIFFStackReader {
+    public:
+        explicit TIFFStackReader(const char* file_path);
+        ~TIFFStackReader();
+
+        TIFFStackReader(const TIFFStackReader&) = delete;
+        TIFFStackReader& operator =(const TIFFStackReader&) = delete;
+
+        // Number of pages
+        size_t Frames() const { return frames_; }
+        // Size of the first page
+        size_t Height() const { return height_; }
+        size_t Width() const { return width_; }
+
+        // Reads the next page to 'frame'. Returns false after the last page
+        bool Next(Bitmap& frame);
+
+    private:
+        TinyTIFFReaderFile* tiff_;
+        size_t frames_;
+        size_t height_, width_;
+        size_t read_{0}; // pages read
+    };
+
     // Saves one-sampled TIFF format image to './filename'.
     // Except on failure
     void WriteGreyscaleToTIFF(const Bitmap& image, const char* filename);
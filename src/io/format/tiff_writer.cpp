@@ -0,0 +1,328 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "tiff_writer.hpp"
+#include "compression.hpp"
+#include "../../support/scheduler.hpp"
+
+namespace io {
+
+    namespace {
+        // TIFF tags of a page
+        constexpr uint16_t kTagWidth           = 256;
+        constexpr uint16_t kTagHeight          = 257;
+        constexpr uint16_t kTagBitsPerSample   = 258;
+        constexpr uint16_t kTagCompression     = 259;
+        constexpr uint16_t kTagPhotometric     = 262;
+        constexpr uint16_t kTagStripOffsets    = 273;
+        constexpr uint16_t kTagSamplesPerPixel = 277;
+        constexpr uint16_t kTagRowsPerStrip    = 278;
+        constexpr uint16_t kTagStripByteCounts = 279;
+        constexpr uint16_t kTagPlanarConfig    = 284;
+        constexpr uint16_t kTagPredictor       = 317;
+
+        constexpr uint16_t kTypeShort = 3;
+        constexpr uint16_t kTypeLong  = 4;
+
+        constexpr uint16_t kPhotometricGrey = 1;
+        constexpr uint16_t kPhotometricRGB  = 2;
+
+        // Classic TIFF keeps offsets in 32 bits
+        constexpr uint64_t kMaxFileSize = UINT32_MAX;
+
+        // Zeros padding batches of strips to whole pages
+        const std::vector<uint8_t>& PagePadding() {
+            static const std::vector<uint8_t> zeros(static_cast<size_t>(sysconf(_SC_PAGESIZE)), 0);
+            return zeros;
+        }
+
+        void WriteAll(int fd, const iovec* parts, size_t count, uint64_t offset) {
+            std::vector<iovec> rest(parts, parts + count);
+            size_t first = 0;
+            while (first < rest.size()) {
+                int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+                ssize_t written = pwritev(fd, rest.data() + first, batch, static_cast<off_t>(offset));
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written < 0) {
+                    throw std::runtime_error("Writing to the file failed");
+                }
+                offset += static_cast<uint64_t>(written);
+                // Skip what was written
+                auto left = static_cast<size_t>(written);
+                while (first < rest.size() && left >= rest[first].iov_len) {
+                    left -= rest[first].iov_len;
+                    ++first;
+                }
+                if (left > 0) {
+                    rest[first].iov_base = static_cast<uint8_t*>(rest[first].iov_base) + left;
+                    rest[first].iov_len -= left;
+                }
+            }
+        }
+
+        void WriteAll(int fd, const void* data, size_t size, uint64_t offset) {
+            iovec part{const_cast<void*>(data), size};
+            WriteAll(fd, &part, 1, offset);
+        }
+
+        // Directory of one page
+        class Directory {
+        public:
+            void Add(uint16_t tag, uint16_t type, std::vector<uint32_t> values) {
+                entries_.push_back(Entry{tag, type, std::move(values)});
+            }
+
+            // Serializes the directory placed at 'offset' of the file,
+            // arrays which do not fit into entries follow it.
+            // Returns position of the 'next directory' field in the result
+            size_t Serialize(uint64_t offset, std::vector<uint8_t>& out) const {
+                size_t size = 2 + entries_.size() * 12 + 4;
+                std::vector<uint8_t> arrays;
+                out.clear();
+                Put<uint16_t>(out, static_cast<uint16_t>(entries_.size()));
+                for (const auto& entry : entries_) {
+                    size_t item = entry.type == kTypeShort ? sizeof(uint16_t) : sizeof(uint32_t);
+                    Put<uint16_t>(out, entry.tag);
+                    Put<uint16_t>(out, entry.type);
+                    Put<uint32_t>(out, static_cast<uint32_t>(entry.values.size()));
+
+                    std::vector<uint8_t> values;
+                    for (uint32_t v : entry.values) {
+                        if (entry.type == kTypeShort) {
+                            Put<uint16_t>(values, static_cast<uint16_t>(v));
+                        }
+                        else {
+                            Put<uint32_t>(values, v);
+                        }
+                    }
+                    if (item * entry.values.size() <= sizeof(uint32_t)) {
+                        values.resize(sizeof(uint32_t), 0);
+                        out.insert(out.end(), values.begin(), values.end());
+                    }
+                    else {
+                        Put<uint32_t>(out, static_cast<uint32_t>(offset + size + arrays.size()));
+                        arrays.insert(arrays.end(), values.begin(), values.end());
+                        // Keep arrays on word boundary
+                        arrays.resize((arrays.size() + 1) & ~static_cast<size_t>(1), 0);
+                    }
+                }
+                size_t next_link = out.size();
+                Put<uint32_t>(out, 0);
+                out.insert(out.end(), arrays.begin(), arrays.end());
+                return next_link;
+            }
+
+        private:
+            struct Entry {
+                uint16_t tag;
+                uint16_t type;
+                std::vector<uint32_t> values;
+            };
+
+            template <typename T>
+            static void Put(std::vector<uint8_t>& out, T value) {
+                auto bytes = reinterpret_cast<const uint8_t*>(&value);
+                out.insert(out.end(), bytes, bytes + sizeof(T));
+            }
+
+            std::vector<Entry> entries_;
+        };
+
+        // Interleaves rows [x_begin, x_end) of the layers into 'out'
+        template <typename T>
+        void Interleave(const Bitmap* const* layers, uint16_t samples, size_t x_begin, size_t x_end, uint8_t* out) {
+            size_t w = layers[0]->Width();
+            auto dst = reinterpret_cast<T*>(out);
+            for (uint16_t s = 0; s < samples; ++s) {
+                auto src = reinterpret_cast<const T*>(layers[s]->Data()) + x_begin * w;
+                for (size_t i = 0; i < (x_end - x_begin) * w; ++i) {
+                    dst[i * samples + s] = src[i];
+                }
+            }
+        }
+    } // namespace
+
+    StripWriter::StripWriter(const char* filename, const StripWriterOptions& options)
+        : options_{options} {
+        fd_ = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot create the file");
+        }
+        if (options_.threads == 0) {
+            options_.threads = sched::DefaultThreads();
+        }
+
+        // Header: byte order of the host, 42, offset of the first directory (set later)
+        const uint16_t one = 1;
+        bool little = *reinterpret_cast<const uint8_t*>(&one) == 1;
+        uint8_t header[8] = {
+            static_cast<uint8_t>(little ? 'I' : 'M'), static_cast<uint8_t>(little ? 'I' : 'M'),
+            0, 0, 0, 0, 0, 0
+        };
+        const uint16_t magic = 42;
+        std::memcpy(header + 2, &magic, sizeof(magic));
+        WriteAll(fd_, header, sizeof(header), 0);
+        end_ = sizeof(header);
+        next_link_ = 4;
+    }
+
+    StripWriter::~StripWriter() {
+        try {
+            Close();
+        }
+        catch (...) {
+        }
+    }
+
+    void StripWriter::Close() {
+        if (fd_ >= 0) {
+            int fd = fd_;
+            fd_ = -1;
+            if (close(fd) != 0) {
+                throw std::runtime_error("Closing the file failed");
+            }
+        }
+    }
+
+    void StripWriter::WriteRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B) {
+        const Bitmap* layers[] = {&R, &G, &B};
+        WritePage(layers, 3, kPhotometricRGB);
+    }
+
+    void StripWriter::WriteRGB(const rgb::BitmapRGB& image) {
+        WriteRGB(image.R, image.G, image.B);
+    }
+
+    void StripWriter::WriteGreyscale(const Bitmap& image) {
+        const Bitmap* layers[] = {&image};
+        WritePage(layers, 1, kPhotometricGrey);
+    }
+
+    void StripWriter::WritePage(const Bitmap* const* layers, uint16_t samples, uint16_t photometric) {
+        if (fd_ < 0) {
+            throw std::runtime_error("The file is closed");
+        }
+        size_t h = layers[0]->Height();
+        size_t w = layers[0]->Width();
+        size_t p = layers[0]->BytesPerPixel();
+        if (p != sizeof(uint8_t) && p != sizeof(uint16_t)) {
+            throw std::runtime_error("Only 8 and 16 bit samples are supported");
+        }
+
+        Compression compression = options_.compression;
+        bool predictor = options_.predictor
+                && (compression == Compression::LZW || compression == Compression::DEFLATE);
+
+        size_t row_bytes = w * samples * p;
+        size_t rows_per_strip = std::max<size_t>(1, options_.strip_bytes / std::max<size_t>(row_bytes, 1));
+        rows_per_strip = std::min(rows_per_strip, std::max<size_t>(h, 1));
+        size_t strips = (h + rows_per_strip - 1) / rows_per_strip;
+
+        std::vector<uint32_t> offsets(strips), byte_counts(strips);
+
+        // Encode a batch of strips concurrently, then write the batch at once.
+        // Aligned batches begin on a page of the file and are padded with zeros
+        // to whole pages, so no page of the file is written partially by two calls
+        size_t page = options_.aligned ? PagePadding().size() : 1;
+        size_t batch = options_.threads * 2;
+        std::vector<std::vector<uint8_t>> encoded(batch);
+        std::vector<std::vector<uint8_t>> raw(batch);
+        for (size_t first = 0; first < strips; first += batch) {
+            size_t count = std::min(batch, strips - first);
+            sched::ParallelFor(count, options_.threads, [&](size_t i) {
+                size_t strip = first + i;
+                size_t x_begin = strip * rows_per_strip;
+                size_t x_end = std::min(x_begin + rows_per_strip, h);
+                size_t size = (x_end - x_begin) * row_bytes;
+
+                auto& buffer = raw[i];
+                buffer.resize(size);
+                if (p == sizeof(uint8_t)) {
+                    Interleave<uint8_t>(layers, samples, x_begin, x_end, buffer.data());
+                    if (predictor) {
+                        ApplyHorizontalPredictor(buffer.data(), x_end - x_begin, w, samples);
+                    }
+                }
+                else {
+                    Interleave<uint16_t>(layers, samples, x_begin, x_end, buffer.data());
+                    if (predictor) {
+                        ApplyHorizontalPredictor(reinterpret_cast<uint16_t*>(buffer.data()),
+                                                 x_end - x_begin, w, samples);
+                    }
+                }
+
+                auto& out = encoded[i];
+                out.clear();
+                switch (compression) {
+                    case Compression::NONE:     out.swap(buffer); break;
+                    case Compression::PACKBITS: EncodePackBits(buffer.data(), size, row_bytes, out); break;
+                    case Compression::LZW:      EncodeLZW(buffer.data(), size, out); break;
+                    case Compression::DEFLATE:  EncodeDeflate(buffer.data(), size, out); break;
+                }
+            });
+
+            std::vector<iovec> parts;
+            end_ = (end_ + page - 1) / page * page;
+            uint64_t offset = end_;
+            for (size_t i = 0; i < count; ++i) {
+                offsets[first + i] = static_cast<uint32_t>(end_);
+                byte_counts[first + i] = static_cast<uint32_t>(encoded[i].size());
+                parts.push_back(iovec{encoded[i].data(), encoded[i].size()});
+                end_ += encoded[i].size();
+                if (end_ > kMaxFileSize) {
+                    throw std::runtime_error("TIFF file exceeds 4 GB");
+                }
+            }
+            if (size_t tail = static_cast<size_t>(end_ % page); tail != 0) {
+                // The next batch or the directory begins after the padding
+                parts.push_back(iovec{const_cast<uint8_t*>(PagePadding().data()), page - tail});
+            }
+            WriteAll(fd_, parts.data(), parts.size(), offset);
+        }
+
+        // Directory begins on a word boundary
+        end_ += end_ & 1;
+
+        Directory directory;
+        directory.Add(kTagWidth, kTypeLong, {static_cast<uint32_t>(w)});
+        directory.Add(kTagHeight, kTypeLong, {static_cast<uint32_t>(h)});
+        directory.Add(kTagBitsPerSample, kTypeShort, std::vector<uint32_t>(samples, static_cast<uint32_t>(p * 8)));
+        directory.Add(kTagCompression, kTypeShort, {static_cast<uint32_t>(compression)});
+        directory.Add(kTagPhotometric, kTypeShort, {photometric});
+        directory.Add(kTagStripOffsets, kTypeLong, offsets);
+        directory.Add(kTagSamplesPerPixel, kTypeShort, {samples});
+        directory.Add(kTagRowsPerStrip, kTypeLong, {static_cast<uint32_t>(rows_per_strip)});
+        directory.Add(kTagStripByteCounts, kTypeLong, byte_counts);
+        directory.Add(kTagPlanarConfig, kTypeShort, {1});
+        if (predictor) {
+            directory.Add(kTagPredictor, kTypeShort, {2});
+        }
+
+        std::vector<uint8_t> serialized;
+        size_t next_link = directory.Serialize(end_, serialized);
+        if (end_ + serialized.size() > kMaxFileSize) {
+            throw std::runtime_error("TIFF file exceeds 4 GB");
+        }
+        WriteAll(fd_, serialized.data(), serialized.size(), end_);
+
+        // Link the directory to the previous one (or to the header)
+        auto directory_offset = static_cast<uint32_t>(end_);
+        WriteAll(fd_, &directory_offset, sizeof(directory_offset), next_link_);
+        next_link_ = end_ + next_link;
+        end_ += serialized.size();
+    }
+
+    void WriteRGBToTIFFStrips(const rgb::BitmapRGB& image, const char* filename,
+                              const StripWriterOptions& options) {
+        StripWriter writer(filename, options);
+        writer.WriteRGB(image);
+        writer.Close();
+    }
+} // namespace io
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include "../../support/bitmap.hpp"
+#include "../../support/rgb.hpp"
+
+namespace io {
+    // Compression of TIFF strips (values are codes of the TIFF Compression tag)
+    enum class Compression : uint16_t {
+        NONE     = 1,
+        LZW      = 5,
+        DEFLATE  = 8,
+        PACKBITS = 32773,
+    };
+
+    struct StripWriterOptions {
+        Compression compression{Compression::NONE};
+        // Horizontal differencing before LZW or Deflate (TIFF Predictor = 2)
+        bool predictor{true};
+        // Uncompressed bytes in one strip (approximately)
+        size_t strip_bytes{1 << 18};
+        // Threads encoding strips. 0 - as much as sched::DefaultThreads()
+        size_t threads{0};
+        // Write batches of strips at page boundaries of the file, padded to whole
+        // pages (up to a page of zeros between batches)
+        bool aligned{true};
+    };
+
+    // Native TIFF writer. Splits every image into strips, encodes batches
+    // of strips concurrently and writes each batch with one page-aligned pwritev call.
+    // Each Write* call adds a page (directory) to the file.
+    // Samples are stored in the host byte order
+    //
+    // Exception on failure
+    class StripWriter {
+    public:
+        explicit StripWriter(const char* filename, const StripWriterOptions& options = {});
+        ~StripWriter();
+
+        StripWriter(const StripWriter&) = delete;
+        StripWriter& operator =(const StripWriter&) = delete;
+
+        // BE CAREFUL: All layers must have one size and bytes per pixel
+        void WriteRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B);
+        void WriteRGB(const rgb::BitmapRGB& image);
+        void WriteGreyscale(const Bitmap& image);
+
+        // Finishes the file. Called by the destructor if it was not called before
+        void Close();
+
+    private:
+        // Writes one page of interleaved 'samples' layers
+        void WritePage(const Bitmap* const* layers, uint16_t samples, uint16_t photometric);
+
+        int fd_{-1};
+        StripWriterOptions options_;
+        uint64_t end_{0};      // current size of the file
+        uint64_t next_link_{0}; // where to write the offset of the next directory
+    };
+
+    // Saves rgb TIFF format image to './filename' with StripWriter
+    // Except on failure
+    void WriteRGBToTIFFStrips(const rgb::BitmapRGB& image, const char* filename,
+                              const StripWriterOptions& options = {});
+} // namespace io
@@ -1,5 +1,20 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include "menon.hpp"
+#include "service/daemon.hpp"
+#include "service/ring.hpp"
+#include "service/shard.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 void Abort(int code = 0) {
     std::cout << "ABORTING\n";
@@ -7,12 +22,184 @@ void Abort(int code = 0) {
 }
 
 void PrintHelpUsage() {
-    std::cout << "Usage: menon <file.tiff>\n";
+    std::cout << "Usage: menon [options] <file.tiff>\n"
+                 "       menon [options] --daemon <socket>\n"
+                 "       menon [options] --ring <input> <output>\n"
+                 "       menon [options] --shards <n> <file.tiff>\n"
+                 "Options:\n"
+                 "  --raw <height> <width>    input is a 16-bit headerless mosaic\n"
+                 "  --compress <method>       none, packbits, lzw or deflate (default none)\n"
+                 "  --autotune                calibrate threads, band and tile sizes for the image\n"
+                 "                            resolution and save them to the profile\n"
+                 "  --profile <file>          tuning profile (default menon.tune)\n"
+                 "  --pages <kind>            image storage pages: normal, transparent or explicit\n"
+                 "                            huge pages (default transparent)\n"
+                 "  --daemon <socket>         serve demosaicing requests on the Unix domain socket\n"
+                 "                            (see service/protocol.hpp)\n"
+                 "  --max-frame-mb <n>        largest frame served with --daemon (default 1024)\n"
+                 "  --ring <input> <output>   demosaic CFA frames of the shared-memory ring <input>\n"
+                 "                            to the new ring <output> (see service/ring.hpp)\n"
+                 "  --shards <n>              demosaic the image by stripes in n worker processes\n"
+                 "                            to result.rgb: interleaved 16-bit RGB without header\n"
+                 "                            (for images larger than the memory of one process,\n"
+                 "                            see service/shard.hpp)\n"
+                 "  --stripe-rows <n>         rows of a stripe with --shards (default about 16M pixels)\n"
+                 "  --worker <fd>             serve requests of service/protocol.hpp on the connected\n"
+                 "                            socket fd (started by --shards)\n"
+                 "  --tone <curve>            write 8-bit RGB mapped by the tone curve: linear, srgb,\n"
+                 "                            gamma:<value> or a file of \"input output\" points\n"
+                 "  --yuv <format>            write result.yuv for an encoder: nv12, i420, i422 or p010\n"
+                 "                            (BT.709, limited range, --tone is not used)\n"
+                 "  --stats <file>            write histograms, zone means and clipped samples\n"
+                 "                            of the image as JSON (single images)\n"
+                 "  --black <r> <g> <b>       black levels of the channels (16-bit units)\n"
+                 "  --wb <r> <g> <b>          white balance gains of the channels\n"
+                 "  --white <level>           saturation level, the range is scaled to 16 bits\n"
+                 "  --frame-workers <n>       frames of a multi-page TIFF demosaiced concurrently\n"
+                 "                            (default chosen by the threads and the memory)\n"
+                 "  --refine-threshold <n>    with define ADAPTIVE_REFINE tiles whose high-pass energy\n"
+                 "                            is below n codes of the mosaic are not refined (default 32,\n"
+                 "                            0 - every tile, see refining/adaptive.hpp)\n";
+}
+
+struct Options {
+    const char* input{nullptr};
+    bool raw{false};
+    bool autotune{false};
+    const char* daemon_socket{nullptr};
+    uint64_t max_frame_bytes{service::kMaxFrameBytes};
+    const char* ring_input{nullptr};
+    const char* ring_output{nullptr};
+    size_t shards{0};       // worker processes, demosaicing in this process if 0
+    size_t stripe_rows{0};  // 0 - service::DefaultStripeRows
+    int worker_fd{-1};      // socket of the coordinator if this process is a worker
+    const char* profile{menon::kTuningProfile};
+    size_t raw_height{0}, raw_width{0};
+    size_t frame_workers{0}; // 0 - SplitStackThreads
+    const char* tone{nullptr}; // 16-bit output if not set
+    const char* yuv{nullptr};  // YCbCr format of result.yuv, RGB TIFF if not set
+    const char* stats{nullptr}; // JSON file of the frame statistics if set
+    std::array<uint16_t, 3> black{0, 0, 0};
+    std::array<float, 3> gains{1, 1, 1};
+    uint16_t white{65535};
+    pre::Correction correction; // built of black, gains and white
+    io::StripWriterOptions write;
+};
+
+// Returns false if arguments are wrong
+bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--daemon" && i + 1 < argc) {
+            options.daemon_socket = argv[++i];
+        }
+        else if (arg == "--max-frame-mb" && i + 1 < argc) {
+            options.max_frame_bytes = uint64_t{std::stoul(argv[++i])} << 20;
+        }
+        else if (arg == "--ring" && i + 2 < argc) {
+            options.ring_input = argv[++i];
+            options.ring_output = argv[++i];
+        }
+        else if (arg == "--shards" && i + 1 < argc) {
+            options.shards = std::stoul(argv[++i]);
+        }
+        else if (arg == "--stripe-rows" && i + 1 < argc) {
+            options.stripe_rows = std::stoul(argv[++i]);
+        }
+        else if (arg == "--worker" && i + 1 < argc) {
+            options.worker_fd = std::stoi(argv[++i]);
+        }
+        else if (arg == "--autotune") {
+            options.autotune = true;
+        }
+        else if (arg == "--profile" && i + 1 < argc) {
+            options.profile = argv[++i];
+        }
+        else if (arg == "--pages" && i + 1 < argc) {
+            std::string kind = argv[++i];
+            auto allocator = mem::Options();
+            if (kind == "normal") {
+                allocator.pages = mem::Pages::NORMAL;
+            }
+            else if (kind == "transparent") {
+                allocator.pages = mem::Pages::TRANSPARENT_HUGE;
+            }
+            else if (kind == "explicit") {
+                allocator.pages = mem::Pages::EXPLICIT_HUGE;
+            }
+            else {
+                return false;
+            }
+            mem::SetAllocatorOptions(allocator);
+        }
+        else if (arg == "--black" && i + 3 < argc) {
+            for (auto& level : options.black) {
+                level = static_cast<uint16_t>(std::stoul(argv[++i]));
+            }
+        }
+        else if (arg == "--wb" && i + 3 < argc) {
+            for (auto& gain : options.gains) {
+                gain = std::stof(argv[++i]);
+            }
+        }
+        else if (arg == "--white" && i + 1 < argc) {
+            options.white = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--tone" && i + 1 < argc) {
+            options.tone = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc) {
+            options.stats = argv[++i];
+        }
+        else if (arg == "--yuv" && i + 1 < argc) {
+            options.yuv = argv[++i];
+        }
+        else if (arg == "--frame-workers" && i + 1 < argc) {
+            options.frame_workers = std::stoul(argv[++i]);
+        }
+        else if (arg == "--refine-threshold" && i + 1 < argc) {
+            auto adaptive = refine::Adaptive();
+            adaptive.threshold = std::stoi(argv[++i]);
+            refine::SetAdaptive(adaptive);
+        }
+        else if (arg == "--raw" && i + 2 < argc) {
+            options.raw = true;
+            options.raw_height = std::stoul(argv[++i]);
+            options.raw_width = std::stoul(argv[++i]);
+        }
+        else if (arg == "--compress" && i + 1 < argc) {
+            std::string method = argv[++i];
+            if (method == "none") {
+                options.write.compression = io::Compression::NONE;
+            }
+            else if (method == "packbits") {
+                options.write.compression = io::Compression::PACKBITS;
+            }
+            else if (method == "lzw") {
+                options.write.compression = io::Compression::LZW;
+            }
+            else if (method == "deflate") {
+                options.write.compression = io::Compression::DEFLATE;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (arg.rfind("--", 0) == 0 || options.input != nullptr) {
+            return false;
+        }
+        else {
+            options.input = argv[i];
+        }
+    }
+    options.correction = pre::Correction::ForColors(options.black, options.gains, options.white);
+    return options.daemon_socket != nullptr || options.ring_input != nullptr
+           || options.worker_fd >= 0 || options.input != nullptr;
 }
 
  Bitmap ReadImage(const char* file_path) {
     try {
-        return io::ReadBitmapFromTIFF(file_path);
+        return io::MapBitmapFromTIFF(file_path);
     }
     catch (const std::exception& e) {
         std::cout << "Reading failed: " << e.what() << '\n';
@@ -21,6 +208,27 @@ void PrintHelpUsage() {
     return Bitmap{};
 }
 
+Bitmap ReadRawImage(const char* file_path, size_t height, size_t width) {
+    try {
+        return io::MapBitmapFromRaw(file_path, height, width, sizeof(uint16_t));
+    }
+    catch (const std::exception& e) {
+        std::cout << "Reading failed: " << e.what() << '\n';
+        Abort();
+    }
+    return Bitmap{};
+}
+
+void WriteRGBImage(const rgb::BitmapRGB& image, const char* file_path, const io::StripWriterOptions& options) {
+    try {
+        io::WriteRGBToTIFFStrips(image, file_path, options);
+    }
+    catch (const std::exception& e) {
+        std::cout << "Writing failed: " << e.what() << '\n';
+        Abort();
+    }
+}
+
 void WriteGreyscaleImage(const Bitmap& image, const char* file_path) {
     try {
         io::WriteGreyscaleToTIFF(image, file_path);
@@ -31,30 +239,313 @@ void WriteGreyscaleImage(const Bitmap& image, const char* file_path) {
     }
 }
 
-void Make16Bit(Bitmap& cfa) {
-    Bitmap cfa16(cfa.Height(), cfa.Width(), sizeof(uint16_t));
-    for (size_t x = 0; x < cfa.Height(); ++x) {
-        for (size_t y = 0; y < cfa.Width(); ++y) {
-            cfa16.Set(x, y, static_cast<uint16_t>(cfa.Get<uint8_t>(x, y)) << 8);
+// Loads parameters of the image resolution from the profile
+// or calibrates and saves them if asked
+void Tune(const Options& options, size_t height, size_t width) {
+    menon::Tuning tuning = menon::CurrentTuning();
+    if (options.autotune) {
+        tuning = menon::Calibrate(height, width, &std::cout);
+        try {
+            menon::SaveTuning(options.profile, height, width, tuning);
+        }
+        catch (const std::exception& e) {
+            std::cout << "Saving tuning failed: " << e.what() << '\n';
         }
     }
-    cfa = std::move(cfa16);
+    else if (!menon::LoadTuning(options.profile, height, width, tuning)) {
+        // Defaults, but pages of the images are still touched by the threads
+        menon::SetTuning(tuning);
+        return;
+    }
+    std::cout << "Tuning: " << tuning.threads << " threads, " << tuning.band_rows << " rows in band, "
+              << tuning.tile_size << " tile size\n";
+    menon::SetTuning(tuning);
+}
+
+// Unpacks the mosaic to 16 bits applying black level, white balance
+// and scaling in the same pass. A mapped 16-bit mosaic is left in place
+// without a correction, with one it is copied out of the mapping (see
+// support/preprocess.hpp). Exception on wrong parameters
+void PrepareMosaic(Bitmap& cfa, const pre::Correction& correction, size_t threads = 0, bool mapped = false) {
+    if (cfa.BytesPerPixel() != sizeof(uint16_t) || !correction.IsIdentity()) {
+        pre::Correct(cfa, correction, threads, mapped);
+    }
+}
+
+// Runs the daemon or the ring until they stop,
+// parameters are loaded per resolution class
+int RunService(const Options& options) {
+    std::string resolution;
+    auto demosaic = [&](const Bitmap& cfa) {
+        std::string current = menon::ResolutionClass(cfa.Height(), cfa.Width());
+        if (current != resolution) {
+            resolution = current;
+            Tune(options, cfa.Height(), cfa.Width());
+        }
+        return menon::Demosaicing(cfa);
+    };
+    try {
+        if (options.worker_fd >= 0) {
+            // Stages print their timings, the coordinator reports the progress
+            std::cout.rdbuf(nullptr);
+            service::ServeConnection(options.worker_fd, demosaic, std::cout);
+            close(options.worker_fd);
+        }
+        else if (options.daemon_socket != nullptr) {
+            service::RunDaemon(options.daemon_socket, demosaic, std::cout, service::kWarmBufferBytes,
+                               options.max_frame_bytes);
+        }
+        else {
+            service::RunRing(options.ring_input, options.ring_output, demosaic, std::cout);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cout << "Service failed: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Tone curve of 8-bit output, or nullptr for 16-bit one
+std::unique_ptr<tone::ToneCurve> LoadToneCurve(const Options& options) {
+    if (options.tone == nullptr) {
+        return nullptr;
+    }
+    try {
+        return std::make_unique<tone::ToneCurve>(tone::ToneCurve::Parse(options.tone));
+    }
+    catch (const std::exception& e) {
+        std::cout << "Tone curve failed: " << e.what() << '\n';
+        Abort();
+    }
+    return nullptr;
+}
+
+// YCbCr format of the output if set
+std::optional<yuv::Format> ParseYUVFormat(const Options& options) {
+    if (options.yuv == nullptr) {
+        return std::nullopt;
+    }
+    try {
+        return yuv::ParseFormat(options.yuv);
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << '\n';
+        Abort();
+    }
+    return std::nullopt;
+}
+
+// Writes the statistics gathered during the demosaicing if asked
+void SaveStats(const Options& options, const stats::Accumulator* accumulator) {
+    if (accumulator == nullptr) {
+        return;
+    }
+    std::ofstream file(options.stats);
+    stats::WriteJSON(accumulator->Result(), file);
+    if (!file) {
+        std::cout << "Writing statistics failed: " << options.stats << '\n';
+    }
+}
+
+// Number of pages of the TIFF, 1 if TinyTIFF cannot read it
+size_t CountPages(const char* file_path) {
+    try {
+        return io::TIFFStackReader(file_path).Frames();
+    }
+    catch (const std::exception&) {
+        return 1;
+    }
+}
+
+// Demosaics every page of a multi-page TIFF to the pages of result.tiff
+int ProcessStack(const Options& options) {
+    try {
+        io::TIFFStackReader reader(options.input);
+        std::cout << "Stack of " << reader.Frames() << " frames " << reader.Width() << " x "
+                  << reader.Height() << '\n';
+        Tune(options, reader.Height(), reader.Width());
+
+        size_t threads = menon::CurrentTuning().threads;
+        auto split = menon::SplitStackThreads(threads, reader.Frames(), reader.Height(), reader.Width(),
+                                              mem::AvailableMemory());
+        if (options.frame_workers != 0) {
+            split.frames = options.frame_workers;
+            split.per_frame = std::max<size_t>(threads / split.frames, 1);
+        }
+        std::cout << "Frame workers: " << split.frames << ", threads per frame: " << split.per_frame << '\n';
+
+        auto yuv_format = ParseYUVFormat(options);
+        // YCbCr is computed from the 16-bit layers
+        auto curve = yuv_format ? nullptr : LoadToneCurve(options);
+        // Frames of a video follow each other in result.yuv
+        std::ofstream yuv_file;
+        std::unique_ptr<io::StripWriter> writer;
+        if (yuv_format) {
+            yuv_file.open("result.yuv", std::ios::binary);
+        }
+        else {
+            writer = std::make_unique<io::StripWriter>("result.tiff", options.write);
+        }
+        size_t frames = menon::DemosaicStack(
+                [&](Bitmap& frame) {
+                    if (!reader.Next(frame)) {
+                        return false;
+                    }
+                    PrepareMosaic(frame, options.correction, split.per_frame);
+                    return true;
+                },
+                [&](const Bitmap& cfa) { return menon::Demosaicing(cfa, curve.get()); },
+                [&](size_t, rgb::BitmapRGB& image) {
+                    if (yuv_format) {
+                        yuv::Write(yuv::Convert(image, *yuv_format, yuv::Matrix::BT709, split.per_frame), yuv_file);
+                    }
+                    else {
+                        writer->WriteRGB(image);
+                    }
+                },
+                split);
+        if (writer) {
+            writer->Close();
+        }
+        else if (!yuv_file.flush()) {
+            throw std::runtime_error("Cannot write result.yuv");
+        }
+#if defined(PERF_COUNTERS)
+        perf::Report(std::cout);
+#endif
+        std::cout << "Writing finished: " << frames << " pages\n";
+    }
+    catch (const std::exception& e) {
+        std::cout << "Stack failed: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Demosaics a single image by stripes in worker processes (service/shard.hpp)
+// and writes the rows of result.rgb as the stripes are finished
+int ProcessSharded(const Options& options) {
+    Bitmap bayer = options.raw
+            ? ReadRawImage(options.input, options.raw_height, options.raw_width)
+            : ReadImage(options.input);
+    size_t h = bayer.Height();
+    size_t w = bayer.Width();
+    size_t stripe_rows = options.stripe_rows != 0 ? options.stripe_rows
+                                                  : service::DefaultStripeRows(h, w, options.shards);
+    std::cout << "Image size: " << w << " x " << h << '\n';
+    std::cout << "Workers: " << options.shards << ", " << stripe_rows << " rows in stripe, "
+              << service::kStripeHalo << " rows of halo\n";
+
+    int out = open("result.rgb", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        std::cout << "Writing failed: cannot create result.rgb\n";
+        return 1;
+    }
+    try {
+        // Rows of the mosaic are corrected while a stripe is copied, so the mosaic
+        // is never unpacked or changed as a whole
+        size_t row_bytes = w * bayer.BytesPerPixel();
+        bool copy = bayer.BytesPerPixel() == sizeof(uint16_t) && options.correction.IsIdentity();
+        auto source = [&](size_t begin, size_t end) {
+            Bitmap stripe(end - begin, w, sizeof(uint16_t));
+            if (copy) {
+                std::memcpy(stripe.Data(), bayer.Data() + begin * row_bytes, (end - begin) * row_bytes);
+                return stripe;
+            }
+            Bitmap rows(end - begin, w, bayer.BytesPerPixel(),
+                        const_cast<uint8_t*>(bayer.Data()) + begin * row_bytes, [](uint8_t*) {});
+            pre::CorrectRows(rows, stripe, options.correction, 0, end - begin);
+            return stripe;
+        };
+        auto output = [&](size_t begin, size_t end, const uint16_t* rgb) {
+            auto bytes = reinterpret_cast<const uint8_t*>(rgb);
+            size_t size = (end - begin) * w * 3 * sizeof(uint16_t);
+            auto offset = static_cast<off_t>(begin * w * 3 * sizeof(uint16_t));
+            while (size != 0) {
+                ssize_t written = pwrite(out, bytes, size, offset);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    throw std::runtime_error("Writing to result.rgb failed");
+                }
+                bytes += written;
+                size -= static_cast<size_t>(written);
+                offset += written;
+            }
+        };
+
+        // Workers are this executable, started before any thread of this process
+        service::LocalWorkers workers("/proc/self/exe", options.shards);
+        service::DemosaicSharded(h, w, source, workers.Sockets(), stripe_rows, output);
+        workers.Stop();
+    }
+    catch (const std::exception& e) {
+        std::cout << "Sharding failed: " << e.what() << '\n';
+        close(out);
+        return 1;
+    }
+    if (close(out) != 0) {
+        std::cout << "Writing failed: result.rgb\n";
+        return 1;
+    }
+    std::cout << "Writing finished\n";
+    return 0;
 }
 
 //#define TEST
 #define NTESTS 100
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
         PrintHelpUsage();
         return 0;
     }
-    auto bayer = ReadImage(argv[1]);
+    if (options.daemon_socket != nullptr || options.ring_input != nullptr || options.worker_fd >= 0) {
+        return RunService(options);
+    }
+    if (options.shards != 0) {
+        return ProcessSharded(options);
+    }
+    if (!options.raw && CountPages(options.input) > 1) {
+        return ProcessStack(options);
+    }
+    Bitmap bayer = options.raw
+            ? ReadRawImage(options.input, options.raw_height, options.raw_width)
+            : ReadImage(options.input);
     std::cout << "Image size: " << bayer.Width() << " x " << bayer.Height() << '\n';
     std::cout << "Bytes per pixel: " << bayer.BytesPerPixel() << '\n';
-    if (bayer.BytesPerPixel() != sizeof(uint16_t)) {
-        Make16Bit(bayer);
+    Tune(options, bayer.Height(), bayer.Width());
+    try {
+        PrepareMosaic(bayer, options.correction, 0, true);
+    }
+    catch (const std::exception& e) {
+        std::cout << "Preprocessing failed: " << e.what() << '\n';
+        Abort();
     }
+    std::unique_ptr<stats::Accumulator> accumulator;
+    if (options.stats != nullptr) {
+        accumulator = std::make_unique<stats::Accumulator>(bayer.Height(), bayer.Width());
+    }
+    if (auto yuv_format = ParseYUVFormat(options)) {
+        auto planes = menon::DemosaicingYUV(bayer, *yuv_format, yuv::Matrix::BT709, accumulator.get());
+        SaveStats(options, accumulator.get());
+#if defined(PERF_COUNTERS)
+        perf::Report(std::cout);
+#endif
+        try {
+            yuv::Save(planes, "result.yuv");
+        }
+        catch (const std::exception& e) {
+            std::cout << "Writing failed: " << e.what() << '\n';
+            Abort();
+        }
+        std::cout << "Writing finished\n";
+        return 0;
+    }
+    auto curve = LoadToneCurve(options);
 
     rgb::BitmapRGB image;
 #if defined(TEST)
@@ -63,17 +554,23 @@ int main(int argc, char* argv[]) {
     for (size_t i = 0; i < NTESTS; ++i) {
         std::cout << "Test " << i << ":\n";
         auto start = std::chrono::system_clock::now();
-        image = menon::Demosaicing(bayer);
+        image = menon::Demosaicing(bayer, curve.get());
         std::cout << "Total test time: ";
         TIMESTAMP
     }
     std::cout << "Total time: ";
     TIMESTAMP
 #else
-    image = menon::Demosaicing(bayer);
+    size_t copied_bytes = Bitmap::CopiedBytes();
+    image = menon::Demosaicing(bayer, curve.get(), accumulator.get());
+    std::cout << "Bytes copied: " << Bitmap::CopiedBytes() - copied_bytes << '\n';
+    SaveStats(options, accumulator.get());
+#endif
+#if defined(PERF_COUNTERS)
+    perf::Report(std::cout);
 #endif
 
-    io::WriteRGBToTIFF(image, "result.tiff");
+    WriteRGBImage(image, "result.tiff", options.write);
     std::cout << "Writing finished\n";
     return 0;
 }
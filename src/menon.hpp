@@ -6,12 +6,26 @@
 
 #include "support/bitmap_arithmetics.hpp"
 #include "io/format/tiff.hpp"
+#include "io/format/mapped.hpp"
+#include "io/format/tiff_writer.hpp"
 #include "interpolation/directional.hpp"
 #include "decision/posteriori.hpp"
 #include "interpolation/rb.hpp"
 #include "support/rgb.hpp"
 #include "refining/lowpass.hpp"
 #include "refining/refine.hpp"
+#include "refining/adaptive.hpp"
+#include "pipeline/wavefront.hpp"
+#include "pipeline/temporal.hpp"
+#include "pipeline/autotune.hpp"
+#include "pipeline/stack.hpp"
+#include "pipeline/liveness.hpp"
+#include "support/scheduler.hpp"
+#include "support/perf.hpp"
+#include "support/tone.hpp"
+#include "support/yuv.hpp"
+#include "support/stats.hpp"
+#include "support/preprocess.hpp"
 
 #define TIMESTAMP { \
 auto now = std::chrono::system_clock::now(); \
@@ -25,60 +39,183 @@ namespace menon {
     // Gets an RGB image from the CFA mosaic using the Menon Decfaing algorithm
     // cfa - RGGB Bayer CFA mosaic.
     // For GRBG remove define RGGB in /CMakeLists.txt row 25
+    // curve - if set, the result has 8-bit layers mapped by the tone curve
+    // stats - if set, gets the statistics of the 16-bit layers (see support/stats.hpp)
     //
-    rgb::BitmapRGB Demosaicing(const Bitmap& cfa) {
+    rgb::BitmapRGB Demosaicing(const Bitmap& cfa, const tone::ToneCurve* curve = nullptr,
+                               stats::Accumulator* stats = nullptr) {
 
 
         auto start = std::chrono::system_clock::now();
         TIMESTAMP
+        // Hardware counters of the stages (define PERF_COUNTERS)
+        [[maybe_unused]] size_t pixels = cfa.Height() * cfa.Width();
 
-#if defined(REFINE)
+#if defined(REFINE) && defined(REFINE16)
+        // Get halved low-pass values in two directions from the mosaic itself
+        auto lpVH_future = lp::GetLowpassFilterVH16Async(cfa);
+#elif defined(REFINE)
         Bitmap cfa32 = std::move(CopyCast32(cfa));
         // Get low-pass values in two directions
         auto lpVH_future = lp::GetLowpassFilterVHAsync(cfa32);
 #endif
 
-        auto green_vh = menon::InterpolateGreenVH(cfa);
+#if defined(WAVEFRONT)
+        const auto& tuning = menon::CurrentTuning();
+        rgb::BitmapRGB output8;
+        menon::BandOutput output;
+#if !defined(REFINE)
+        // Rows are mapped to 8 bits as soon as they are final
+        if (curve != nullptr) {
+            output8 = tone::Create8Bit(cfa.Height(), cfa.Width());
+            output = [&](const menon::Layers& layers, size_t begin, size_t end) {
+                tone::ApplyRows(layers.rb.V, output8.R, *curve, begin, end);
+                tone::ApplyRows(layers.green, output8.G, *curve, begin, end);
+                tone::ApplyRows(layers.rb.H, output8.B, *curve, begin, end);
+            };
+        }
+#endif
+        auto layers = [&]() {
+            PERF_SCOPE("Stage wavefront", pixels)
+            return menon::InterpolateWavefront(cfa, tuning.threads, tuning.band_rows, output,
+                                               menon::Keep::RESULT, stats);
+        }();
+        auto& green = layers.green;
+        auto& rb = layers.rb;
+
+        std::cout << "Wavefront finished " << ' ';
+        TIMESTAMP
+
+#if defined(REFINE)
+        auto& class_diff = layers.diff;
+        auto lpVH = lpVH_future.get();
+#if !defined(ADAPTIVE_REFINE) && defined(REFINE16)
+        auto hpG_future = lp::GetHighpassFilterG16Async(lpVH, green, class_diff);
+        auto hpRR_future = lp::GetHighpassFilterRonR16Async(rb, class_diff);
+        auto hpG = hpG_future.get();
+        auto hpRR = hpRR_future.get();
+#elif !defined(ADAPTIVE_REFINE)
+        auto hpG_future = lp::GetHighpassFilterGAsync(lpVH, green, class_diff);
+        auto hpRR_future = lp::GetHighpassFilterRonRAsync(rb, class_diff);
+        auto hpG = hpG_future.get();
+        auto hpRR = hpRR_future.get();
+#endif
+#endif
+#else
+        // Every stage writes to preallocated buffers,
+        // buffers share storage when their lifetimes do not overlap
+        enum Stage { GREEN_VH, CLASSIFIERS, GREEN, RB_ON_GREEN, RB_ON_RB, RESULT };
+        menon::BufferPlan plan;
+        size_t green_v    = plan.Add(sizeof(uint16_t), GREEN_VH, GREEN);
+        size_t green_h    = plan.Add(sizeof(uint16_t), GREEN_VH, GREEN);
+        size_t gradient_v = plan.Add(sizeof(int16_t), CLASSIFIERS, CLASSIFIERS);
+        size_t gradient_h = plan.Add(sizeof(int16_t), CLASSIFIERS, CLASSIFIERS);
+        size_t diff       = plan.Add(sizeof(int), CLASSIFIERS, RESULT);
+        size_t green_id   = plan.Add(sizeof(uint16_t), GREEN, RESULT);
+        size_t chrom      = plan.Add(sizeof(int16_t), RB_ON_GREEN, RB_ON_GREEN);
+        size_t red        = plan.Add(sizeof(uint16_t), RB_ON_GREEN, RESULT);
+        size_t blue       = plan.Add(sizeof(uint16_t), RB_ON_GREEN, RESULT);
+        menon::BufferPool pool(plan, cfa.Height(), cfa.Width());
+        // Reported with the counters only: Demosaicing is called by the daemon and the API too
+#if defined(PERF_COUNTERS)
+        std::cout << "Buffers: " << plan.BytesPerPixel() << " bytes per pixel instead of "
+                  << plan.UnplannedBytesPerPixel() << '\n';
+#endif
+
+        auto green_vh = menon::ViewVH(pool, green_v, green_h);
+        // Gradients
+        auto temporary = menon::ViewVH(pool, gradient_v, gradient_h);
+        Bitmap class_diff = pool.View(diff);
+        Bitmap green = pool.View(green_id);
+        Bitmap chrominance = pool.View(chrom);
+        auto rb = menon::ViewVH(pool, red, blue);
+
+        {
+            PERF_SCOPE("Stage green VH", pixels)
+            menon::InterpolateGreenVH(cfa, green_vh);
+        }
 
         std::cout << "VH are finished\n" << ' ';
         TIMESTAMP
 
-        auto class_diff = menon::GetClassifierDifference(cfa, green_vh);
+        {
+            PERF_SCOPE("Stage classifiers", pixels)
+            menon::GetClassifierDifference(cfa, green_vh, temporary, class_diff);
+        }
 
         std::cout << "Classifiers found " << ' ';
         TIMESTAMP
 
-        auto green = menon::Posteriori(green_vh, class_diff);
+        {
+            PERF_SCOPE("Stage green", pixels)
+            menon::Posteriori(green_vh, class_diff, green);
+        }
+        if (stats != nullptr) {
+            stats->AddLayer(stats::GREEN, green, sched::DefaultThreads());
+        }
 
         std::cout << "Green layer found " << ' ';
         TIMESTAMP
 
 #if defined(REFINE)
         auto lpVH = lpVH_future.get();
+#if !defined(ADAPTIVE_REFINE) && defined(REFINE16)
+        auto hpG_future = lp::GetHighpassFilterG16Async(lpVH, green, class_diff);
+#elif !defined(ADAPTIVE_REFINE)
         auto hpG_future = lp::GetHighpassFilterGAsync(lpVH, green, class_diff);
 #endif
-        auto rb = menon::InterpolateRBonGreen(cfa, green);
+#endif
+        {
+            PERF_SCOPE("Stage RB on green", pixels)
+            menon::InterpolateRBonGreen(cfa, green, chrominance, rb);
+        }
         std::cout << "RB on Green found " << ' ';
         TIMESTAMP
 
-#if defined(REFINE)
+#if defined(REFINE) && !defined(ADAPTIVE_REFINE)
         auto hpG = hpG_future.get();
-        auto hpRR_future = lp::GetHighpassFilterRonRAsync(rb, class_diff);
 #endif
-        menon::FillRBonRB(rb, class_diff);
+        {
+            PERF_SCOPE("Stage RB on RB", pixels)
+            menon::FillRBonRB(rb, class_diff);
+        }
+        if (stats != nullptr) {
+            stats->AddLayer(stats::RED, rb.V, sched::DefaultThreads());
+            stats->AddLayer(stats::BLUE, rb.H, sched::DefaultThreads());
+        }
         std::cout << "RB on RB found " << ' ';
         TIMESTAMP
-#if defined(REFINE)
-       auto hpRR = hpRR_future.get();
+#if defined(REFINE) && !defined(ADAPTIVE_REFINE)
+        // High-pass of red and blue reads the final rb as in the wavefront
+        // (it ran concurrently with FillRBonRB writing rb before)
+#if defined(REFINE16)
+        auto hpRR = lp::HighpassRonR16(rb, class_diff);
+#else
+        auto hpRR = lp::HighpassRonR(rb, class_diff);
+#endif
 #endif
         std::cout << "Red and blue layers found " << ' ';
         TIMESTAMP
+#endif
 
 #if defined(REFINE)
         // Useless refining
         //refine::RefineRBonG(rb, lpVH, hpG);
-        refine::RefineGonRB(green, hpG, hpRR);
-        refine::RefineRBonRB(rb, hpRR, class_diff);
+        {
+            PERF_SCOPE("Stage refining", pixels)
+#if defined(ADAPTIVE_REFINE)
+            [[maybe_unused]] size_t tiles = refine::AdaptiveRefine(green, rb, lpVH, class_diff, sched::DefaultThreads());
+#if defined(PERF_COUNTERS)
+            std::cout << "Refined tiles: " << tiles << '\n';
+#endif
+#elif defined(REFINE16)
+            refine::RefineGonRB16(green, hpG, hpRR);
+            refine::RefineRBonRB16(rb, hpRR, class_diff);
+#else
+            refine::RefineGonRB(green, hpG, hpRR);
+            refine::RefineRBonRB(rb, hpRR, class_diff);
+#endif
+        }
         std::cout << "Refining finished " << ' ';
         TIMESTAMP
 #endif
@@ -89,21 +226,106 @@ namespace menon {
         //io::WriteGreyscaleToTIFF(rb.H, "blue.tiff");
         //io::WriteGreyscaleToTIFF(CopyCast16(hpG), "hpg.tiff");
 
-        return rgb::BitmapRGB{
+#if defined(WAVEFRONT) && !defined(REFINE)
+        if (curve != nullptr) {
+            return output8;
+        }
+#endif
+#if !defined(WAVEFRONT)
+        // The result owns its storage
+        green = pool.Release(green_id);
+        rb = BitmapVH{pool.Release(red), pool.Release(blue)};
+#endif
+        rgb::BitmapRGB image{
             std::move(rb.V),
             std::move(green),
             std::move(rb.H)
         };
+        if (curve != nullptr) {
+            // One pass over the final layers
+            image = tone::Apply(image, *curve, menon::CurrentTuning().threads);
+            std::cout << "Tone curve applied " << ' ';
+            TIMESTAMP
+        }
+        return image;
+    }
+
+    // Gets the planes of a video encoder (NV12, I420, I422 or P010) from the CFA mosaic.
+    // With WAVEFRONT (without REFINE) luma and chroma are computed from the rows
+    // as soon as they are final, no RGB image is read again
+    yuv::Image DemosaicingYUV(const Bitmap& cfa, yuv::Format format, yuv::Matrix matrix = yuv::Matrix::BT709,
+                              stats::Accumulator* stats = nullptr) {
+        const auto& tuning = menon::CurrentTuning();
+#if defined(WAVEFRONT) && !defined(REFINE)
+        [[maybe_unused]] size_t pixels = cfa.Height() * cfa.Width();
+        auto image = yuv::Create(format, cfa.Height(), cfa.Width());
+        // Bands of even height: 2x2 blocks of chroma do not cross them
+        size_t band_rows = tuning.band_rows + tuning.band_rows % 2;
+        menon::BandOutput output = [&](const menon::Layers& layers, size_t begin, size_t end) {
+            yuv::ConvertRows(layers.rb.V, layers.green, layers.rb.H, image, matrix, begin, end);
+        };
+        {
+            PERF_SCOPE("Stage wavefront", pixels)
+            menon::InterpolateWavefront(cfa, tuning.threads, band_rows, output, menon::Keep::RESULT, stats);
+        }
+        return image;
+#else
+        return yuv::Convert(Demosaicing(cfa, nullptr, stats), format, matrix, tuning.threads);
+#endif
     }
     //
     // Example to load cfa from one-sampled tiff image:
     //      Bitmap cfa = io::ReadImage("cfa.tiff");
+    // or without copying the pixel data of an uncompressed one:
+    //      Bitmap cfa = io::MapBitmapFromTIFF("cfa.tiff");
+    // Black level, white balance and scaling are applied while it is unpacked to 16 bits:
+    //      pre::Correct(cfa, pre::Correction::ForColors({black, black, black}, {r, 1, b}, white));
     //
     // To save result use io::WriteRGBToTIFF(result);
+    // or io::WriteRGBToTIFFStrips(result, "result.tiff", {io::Compression::LZW});
+    // to encode strips concurrently with optional lossless compression
+    //
+    // For 8-bit output pass a tone curve, e.g.
+    //      auto curve = tone::ToneCurve::SRGB();
+    //      auto result = menon::Demosaicing(cfa, &curve);
+    // With WAVEFRONT the rows are mapped inside the pipeline as soon as they are final
+    //
+    // Statistics for auto exposure and white balance are gathered on the way:
+    //      stats::Accumulator accumulator(cfa.Height(), cfa.Width());
+    //      auto result = menon::Demosaicing(cfa, nullptr, &accumulator);
+    //      stats::Stats frame = accumulator.Result();
+    //
+    // For an encoder take the YCbCr planes and write them as raw .yuv:
+    //      auto planes = menon::DemosaicingYUV(cfa, yuv::Format::NV12);
+    //      yuv::Save(planes, "result.yuv");
+    //
+    // For a video from a fixed camera use menon::TemporalDemosaicing:
+    //      menon::TemporalDemosaicing video;
+    //      for (...) { const auto& layers = video.Process(frame); ... video.SkipRatio(); }
+    //
+    // Threads, band height and tile size are taken from menon::CurrentTuning().
+    // To use the parameters calibrated for this host:
+    //      menon::Tuning tuning;
+    //      if (!menon::LoadTuning(menon::kTuningProfile, h, w, tuning)) {
+    //          tuning = menon::Calibrate(h, w);
+    //          menon::SaveTuning(menon::kTuningProfile, h, w, tuning);
+    //      }
+    //      menon::SetTuning(tuning);
     //
     // To disable execution in several threads
     // remove define PARALLEL in /CMakeLists.txt row 19
     //
     // To disable using SSE3 and SSE4.1
     // remove define SIMD in /CMakeLists.txt row 21
+    //
+    // To run the stages one after another with full-frame barriers
+    // remove define WAVEFRONT in /CMakeLists.txt
+    //
+    // To count cycles, instructions, cache, TLB and branch misses of the stages
+    // and arithmetic kernels add define PERF_COUNTERS in /CMakeLists.txt
+    // and print them by perf::Report(std::cout)
+    //
+    // The directional filters mirror the image at its borders.
+    // To get the output of the original implementation (renormalised filter weights)
+    // add define EXACT_BORDERS in /CMakeLists.txt (see support/border.hpp)
 }
\ No newline at end of file
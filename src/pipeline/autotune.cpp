@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "autotune.hpp"
+#include "wavefront.hpp"
+#include "temporal.hpp"
+#include "../support/scheduler.hpp"
+
+namespace menon {
+
+    // Calibration mosaic has at most this many pixels
+    constexpr size_t kCalibrationPixels = 1 << 22;
+    constexpr size_t kCalibrationMinRows = 256;
+    // Runs of every candidate, the fastest one counts
+    constexpr size_t kCalibrationRepeats = 3;
+
+    constexpr size_t kBandCandidates[] = {8, 16, 32, 64, 128};
+    constexpr size_t kTileCandidates[] = {32, 64, 128, 256};
+
+    struct ResolutionLimit {
+        size_t pixels; // the class includes images up to this size
+        const char* name;
+    };
+
+    constexpr ResolutionLimit kResolutionClasses[] = {
+        {size_t{1} << 20, "1MP"},
+        {size_t{1} << 22, "4MP"},
+        {size_t{1} << 24, "16MP"},
+        {size_t{1} << 26, "64MP"},
+    };
+
+    const char* ResolutionClass(size_t h, size_t w) {
+        for (const auto& limit : kResolutionClasses) {
+            if (h * w <= limit.pixels) {
+                return limit.name;
+            }
+        }
+        return "huge";
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Calibration:
+
+    Bitmap CreateSyntheticMosaic(size_t h, size_t w, uint32_t seed) {
+        Bitmap mosaic(h, w, sizeof(uint16_t));
+        uint32_t state = seed | 1;
+        for (size_t x = 0; x < h; ++x) {
+            for (size_t y = 0; y < w; ++y) {
+                // xorshift32
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                uint32_t value = (x * 7 + y * 3) & 0x7FF;
+                value += ((x / 16 + y / 16) & 1) ? 1024 : 0;
+                value += state & 0x3F;
+                mosaic.Set(x, y, static_cast<uint16_t>(std::min<uint32_t>(value, 4095)));
+            }
+        }
+        return mosaic;
+    }
+
+    // Changes several small patches like a moving object would
+    static void MovePatches(Bitmap& mosaic, uint32_t seed) {
+        constexpr size_t kPatches = 8;
+        constexpr size_t kPatchSize = 24;
+        uint32_t state = seed | 1;
+        for (size_t i = 0; i < kPatches; ++i) {
+            state = state * 1664525 + 1013904223;
+            size_t px = (state >> 8) % mosaic.Height();
+            state = state * 1664525 + 1013904223;
+            size_t py = (state >> 8) % mosaic.Width();
+            for (size_t x = px; x < std::min(px + kPatchSize, mosaic.Height()); ++x) {
+                for (size_t y = py; y < std::min(py + kPatchSize, mosaic.Width()); ++y) {
+                    mosaic.Set(x, y, static_cast<uint16_t>(mosaic.Get(x, y) ^ 0x155));
+                }
+            }
+        }
+    }
+
+    // Seconds of the fastest of kCalibrationRepeats runs
+    static double Measure(const std::function<void()>& run) {
+        double best = 0;
+        for (size_t i = 0; i < kCalibrationRepeats; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            if (i == 0 || duration.count() < best) {
+                best = duration.count();
+            }
+        }
+        return best;
+    }
+
+    static std::vector<size_t> ThreadCandidates() {
+        std::vector<size_t> candidates;
+#if defined(PARALLEL)
+        size_t hardware = sched::HardwareThreads();
+        for (size_t threads = 1; threads < hardware; threads <<= 1) {
+            candidates.push_back(threads);
+        }
+        candidates.push_back(hardware);
+#else
+        candidates.push_back(1);
+#endif
+        return candidates;
+    }
+
+    static void Report(std::ostream* log, const char* parameter, size_t value, double seconds) {
+        if (log != nullptr) {
+            *log << "  " << parameter << ' ' << value << ": " << seconds * 1e3 << " ms\n";
+        }
+    }
+
+    Tuning Calibrate(size_t h, size_t w, std::ostream* log) {
+        const char* resolution = ResolutionClass(h, w);
+
+        // The mosaic represents the whole class: images smaller than the class
+        // limit are scaled up to it. Full rows matter for caches,
+        // the number of rows only for the number of bands
+        size_t pixels = std::max<size_t>(h * w, 1);
+        for (const auto& limit : kResolutionClasses) {
+            if (h * w <= limit.pixels) {
+                pixels = limit.pixels;
+                break;
+            }
+        }
+        pixels = std::min(pixels, kCalibrationPixels);
+        w = std::max<size_t>(w, 1);
+        if (h * w < pixels) {
+            w = static_cast<size_t>(w * std::sqrt(static_cast<double>(pixels) / std::max<size_t>(h * w, 1)));
+        }
+        size_t rows = std::max(kCalibrationMinRows, pixels / std::max<size_t>(w, 1));
+        rows = std::max<size_t>(rows & ~size_t{1}, 2);
+        w = std::max<size_t>(w & ~size_t{1}, 2);
+        Bitmap mosaic = CreateSyntheticMosaic(rows, w, 1);
+        Tuning best = DefaultTuning();
+
+        if (log != nullptr) {
+            *log << "Calibrating for " << resolution << " on " << rows << " x " << w << '\n';
+        }
+
+        double best_time = 0;
+        for (size_t threads : ThreadCandidates()) {
+            double time = Measure([&]() { InterpolateWavefront(mosaic, threads, best.band_rows); });
+            Report(log, "threads", threads, time);
+            if (best_time == 0 || time < best_time) {
+                best_time = time;
+                best.threads = threads;
+            }
+        }
+
+        best_time = 0;
+        for (size_t band_rows : kBandCandidates) {
+            double time = Measure([&]() { InterpolateWavefront(mosaic, best.threads, band_rows); });
+            Report(log, "band rows", band_rows, time);
+            if (best_time == 0 || time < best_time) {
+                best_time = time;
+                best.band_rows = band_rows;
+            }
+        }
+
+        // Temporal demosaicing processes frames that differ by a few patches
+        Bitmap moved = mosaic.Copy();
+        MovePatches(moved, 7);
+        best_time = 0;
+        for (size_t tile_size : kTileCandidates) {
+            TemporalDemosaicing video(tile_size, best.threads);
+            video.Process(mosaic);
+            bool odd = false;
+            double time = Measure([&]() {
+                odd = !odd;
+                video.Process(odd ? moved : mosaic);
+            });
+            Report(log, "tile size", tile_size, time);
+            if (best_time == 0 || time < best_time) {
+                best_time = time;
+                best.tile_size = tile_size;
+            }
+        }
+        return best;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Profile:
+
+    struct ProfileEntry {
+        std::string resolution;
+        Tuning tuning;
+    };
+
+    static std::vector<ProfileEntry> ReadProfile(const char* path) {
+        std::vector<ProfileEntry> entries;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            ProfileEntry entry;
+            if (fields >> entry.resolution >> entry.tuning.threads
+                       >> entry.tuning.band_rows >> entry.tuning.tile_size
+                && entry.tuning.threads != 0 && entry.tuning.band_rows != 0) {
+                entries.push_back(entry);
+            }
+        }
+        return entries;
+    }
+
+    bool LoadTuning(const char* path, size_t h, size_t w, Tuning& tuning) {
+        std::string resolution = ResolutionClass(h, w);
+        for (const auto& entry : ReadProfile(path)) {
+            if (entry.resolution == resolution) {
+                tuning = entry.tuning;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void SaveTuning(const char* path, size_t h, size_t w, const Tuning& tuning) {
+        std::string resolution = ResolutionClass(h, w);
+        auto entries = ReadProfile(path);
+        auto it = std::find_if(entries.begin(), entries.end(), [&](const ProfileEntry& entry) {
+            return entry.resolution == resolution;
+        });
+        if (it != entries.end()) {
+            it->tuning = tuning;
+        }
+        else {
+            entries.push_back(ProfileEntry{resolution, tuning});
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Cannot write the tuning profile");
+        }
+        file << "# menon tuning profile: <class> <threads> <band_rows> <tile_size>\n";
+        for (const auto& entry : entries) {
+            file << entry.resolution << ' ' << entry.tuning.threads << ' '
+                 << entry.tuning.band_rows << ' ' << entry.tuning.tile_size << '\n';
+        }
+        if (!file) {
+            throw std::runtime_error("Cannot write the tuning profile");
+        }
+    }
+} // namespace menon
@@ -0,0 +1,37 @@
+#pragma once
+#include <ostream>
+#include "tuning.hpp"
+#include "../support/bitmap.hpp"
+
+namespace menon {
+
+    // Default file of the tuning profile (in the working directory)
+    constexpr const char* kTuningProfile = "menon.tune";
+
+    // Name of the resolution class of h x w images.
+    // Images of one class share parameters in the profile
+    const char* ResolutionClass(size_t h, size_t w);
+
+    // Short calibration run: measures the pipeline on synthetic mosaics
+    // of the h x w class and returns the fastest parameters.
+    // Threads are chosen first, then band height with these threads,
+    // then tile size of the temporal demosaicing.
+    // log - progress of the calibration (may be nullptr)
+    Tuning Calibrate(size_t h, size_t w, std::ostream* log = nullptr);
+
+    // 12-bit h x w mosaic with smooth gradients, edges and noise
+    // (calibration and benchmark input)
+    Bitmap CreateSyntheticMosaic(size_t h, size_t w, uint32_t seed);
+
+    // The profile is a text file of lines
+    //      <class> <threads> <band_rows> <tile_size>
+    // '#' starts a comment
+    //
+    // Returns true and sets 'tuning' if the profile has the class of h x w
+    // Missing or broken profile means no parameters (no exception)
+    bool LoadTuning(const char* path, size_t h, size_t w, Tuning& tuning);
+
+    // Adds or replaces the parameters of the class of h x w in the profile
+    // Exception on failure
+    void SaveTuning(const char* path, size_t h, size_t w, const Tuning& tuning);
+} // namespace menon
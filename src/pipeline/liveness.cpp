@@ -0,0 +1,57 @@
+#include <stdexcept>
+#include "liveness.hpp"
+
+namespace menon {
+
+    size_t BufferPlan::Add(uint16_t bytes_per_pixel, size_t first, size_t last) {
+        size_t slot = 0;
+        while (slot < slots_.size()
+               && (slots_[slot].bytes_per_pixel != bytes_per_pixel || slots_[slot].last >= first)) {
+            ++slot;
+        }
+        if (slot == slots_.size()) {
+            slots_.push_back(Storage{bytes_per_pixel, last});
+        }
+        else {
+            slots_[slot].last = last;
+        }
+        buffers_.push_back(Buffer{bytes_per_pixel, slot});
+        return buffers_.size() - 1;
+    }
+
+    size_t BufferPlan::BytesPerPixel() const {
+        size_t bytes = 0;
+        for (const auto& slot : slots_) {
+            bytes += slot.bytes_per_pixel;
+        }
+        return bytes;
+    }
+
+    size_t BufferPlan::UnplannedBytesPerPixel() const {
+        size_t bytes = 0;
+        for (const auto& buffer : buffers_) {
+            bytes += buffer.bytes_per_pixel;
+        }
+        return bytes;
+    }
+
+    BufferPool::BufferPool(const BufferPlan& plan, size_t h, size_t w) : plan_{plan} {
+        slots_.reserve(plan.Slots());
+        for (size_t slot = 0; slot < plan.Slots(); ++slot) {
+            slots_.emplace_back(h, w, plan.SlotBytesPerPixel(slot));
+        }
+    }
+
+    Bitmap BufferPool::View(size_t buffer) {
+        const Bitmap& storage = slots_[plan_.Slot(buffer)];
+        if (storage.Data() == nullptr) {
+            throw std::logic_error("Storage of the buffer is released");
+        }
+        return Bitmap(storage.Height(), storage.Width(), storage.BytesPerPixel(),
+                      const_cast<uint8_t*>(storage.Data()), [](uint8_t*) {});
+    }
+
+    Bitmap BufferPool::Release(size_t buffer) {
+        return std::move(slots_[plan_.Slot(buffer)]);
+    }
+} // namespace menon
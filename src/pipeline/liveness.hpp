@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include "../support/bitmap.hpp"
+
+namespace menon {
+
+    // Plans storage of the intermediate buffers of a pipeline by their lifetimes.
+    // A buffer lives from the stage writing it first to the last stage reading it
+    // (stage numbers in the order the stages start). Buffers of one pixel size
+    // whose lifetimes do not overlap share a storage slot, e.g. red and blue
+    // may take the storage of green V and H dead after the posteriori decision.
+    //
+    // Buffers are placed as they are added (greedy interval colouring, which is
+    // optimal for intervals added by their first stage).
+    // BE CAREFUL: in the wavefront all stages run at once, a buffer may take a slot
+    // only if its first stage depends on the last readers of the previous buffer
+    // of the slot with halos covering the rows they read
+    class BufferPlan {
+    public:
+        // Adds a buffer alive in stages [first, last] and returns its id
+        // BE CAREFUL: buffers must be added in order of their first stages
+        size_t Add(uint16_t bytes_per_pixel, size_t first, size_t last);
+
+        size_t Slot(size_t buffer) const { return buffers_[buffer].slot; }
+        size_t Slots() const { return slots_.size(); }
+        uint16_t SlotBytesPerPixel(size_t slot) const { return slots_[slot].bytes_per_pixel; }
+
+        // Bytes per pixel of all slots: the peak memory of the plan
+        size_t BytesPerPixel() const;
+        // Bytes per pixel if every buffer had its own storage
+        size_t UnplannedBytesPerPixel() const;
+
+    private:
+        struct Buffer {
+            uint16_t bytes_per_pixel;
+            size_t slot;
+        };
+
+        struct Storage {
+            uint16_t bytes_per_pixel;
+            size_t last; // last stage of the buffer placed last
+        };
+
+        std::vector<Buffer> buffers_;
+        std::vector<Storage> slots_;
+    };
+
+    // Storage of a plan for h x w frames. Every slot is allocated once
+    class BufferPool {
+    public:
+        BufferPool(const BufferPlan& plan, size_t h, size_t w);
+
+        // Non-owning bitmap over the storage of the buffer.
+        // Contents are left by the previous buffer of the slot
+        Bitmap View(size_t buffer);
+
+        // Storage of the buffer to keep after the pool (the result of the pipeline)
+        // BE CAREFUL: views of the slot stay valid only while the result lives
+        Bitmap Release(size_t buffer);
+
+    private:
+        const BufferPlan& plan_;
+        std::vector<Bitmap> slots_;
+    };
+
+    // Views of two buffers as a pair
+    inline BitmapVH ViewVH(BufferPool& pool, size_t v, size_t h) {
+        return BitmapVH{pool.View(v), pool.View(h)};
+    }
+} // namespace menon
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "stack.hpp"
+#include "tuning.hpp"
+
+namespace menon {
+
+    // Rough peak memory of one frame in flight per pixel: the mosaic,
+    // the layers, temporaries and the result waiting for the sink
+    constexpr size_t kFrameBytesPerPixel = 40;
+
+    StackThreads SplitStackThreads(size_t threads, size_t frames, size_t h, size_t w, size_t memory) {
+        threads = std::max<size_t>(threads, 1);
+        size_t concurrent = std::min(threads, std::max<size_t>(frames, 1));
+        if (memory != 0) {
+            size_t frame_bytes = std::max<size_t>(h * w * kFrameBytesPerPixel, 1);
+            concurrent = std::min(concurrent, std::max<size_t>(memory / frame_bytes, 1));
+        }
+        return StackThreads{concurrent, std::max<size_t>(threads / concurrent, 1)};
+    }
+
+    size_t DemosaicStack(const FrameSource& source, const FrameDemosaic& demosaic,
+                         const FrameSink& sink, const StackThreads& split) {
+        Tuning previous = CurrentTuning();
+        Tuning tuning = previous;
+        tuning.threads = std::max<size_t>(split.per_frame, 1);
+        SetTuning(tuning);
+
+        std::mutex source_mutex;
+        size_t next_frame = 0;  // index of the next frame of the source
+        bool source_done = false;
+
+        std::mutex sink_mutex;
+        std::condition_variable turn;
+        size_t next_sink = 0;   // index of the next frame for the sink
+
+        std::exception_ptr error; // guarded by sink_mutex
+        std::atomic<bool> failed{false};
+
+        auto work = [&]() {
+            while (!failed) {
+                Bitmap frame;
+                size_t index;
+                {
+                    std::lock_guard lock(source_mutex);
+                    if (source_done) {
+                        return;
+                    }
+                    try {
+                        if (!source(frame)) {
+                            source_done = true;
+                            return;
+                        }
+                    }
+                    catch (...) {
+                        source_done = true;
+                        std::lock_guard error_lock(sink_mutex);
+                        if (!failed) {
+                            failed = true;
+                            error = std::current_exception();
+                        }
+                        turn.notify_all();
+                        return;
+                    }
+                    index = next_frame++;
+                }
+
+                rgb::BitmapRGB image;
+                std::exception_ptr frame_error;
+                try {
+                    image = demosaic(frame);
+                }
+                catch (...) {
+                    frame_error = std::current_exception();
+                }
+
+                // Results go to the sink in the order of frames
+                std::unique_lock lock(sink_mutex);
+                turn.wait(lock, [&]() { return failed || next_sink == index; });
+                if (failed) {
+                    return;
+                }
+                if (frame_error) {
+                    failed = true;
+                    error = frame_error;
+                    turn.notify_all();
+                    return;
+                }
+                try {
+                    sink(index, image);
+                }
+                catch (...) {
+                    failed = true;
+                    error = std::current_exception();
+                }
+                ++next_sink;
+                turn.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        try {
+            for (size_t i = 1; i < split.frames; ++i) {
+                workers.emplace_back(work);
+            }
+        }
+        catch (...) {
+            // No thread (system_error): the started workers stop and are joined below
+            std::lock_guard lock(sink_mutex);
+            failed = true;
+            error = std::current_exception();
+            turn.notify_all();
+        }
+        work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        SetTuning(previous);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return next_sink;
+    }
+} // namespace menon
@@ -0,0 +1,37 @@
+#pragma once
+#include <functional>
+#include "../support/bitmap.hpp"
+#include "../support/rgb.hpp"
+
+namespace menon {
+
+    // Reads the next frame of a stack. Returns false after the last one
+    using FrameSource = std::function<bool(Bitmap& frame)>;
+    // Demosaicing of one frame (menon::Demosaicing)
+    using FrameDemosaic = std::function<rgb::BitmapRGB(const Bitmap& frame)>;
+    // Takes the result of frame 'index'. Called in the order of frames
+    using FrameSink = std::function<void(size_t index, rgb::BitmapRGB& image)>;
+
+    // Thread budget of a stack
+    struct StackThreads {
+        size_t frames;    // frames demosaiced concurrently
+        size_t per_frame; // threads inside one frame
+    };
+
+    // Splits 'threads' between frames and the work inside a frame.
+    // Frames are independent, so frame-level parallelism scales better, but every
+    // frame in flight holds its layers: as many frames as fit in 'memory' bytes
+    // (0 - unknown) run concurrently, the rest of threads go inside the frames
+    StackThreads SplitStackThreads(size_t threads, size_t frames, size_t h, size_t w, size_t memory);
+
+    // Demosaics every frame of the source and passes the results to the sink in order.
+    // 'split.frames' frames are processed concurrently, each with 'split.per_frame'
+    // threads (set by SetTuning for the time of the call).
+    // The source and the sink are called by one thread at a time.
+    // Returns the number of frames
+    //
+    // Exception of the source, the demosaicing or the sink stops the processing
+    // and is rethrown
+    size_t DemosaicStack(const FrameSource& source, const FrameDemosaic& demosaic,
+                         const FrameSink& sink, const StackThreads& split);
+} // namespace menon
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cstring>
+#include "temporal.hpp"
+#include "../interpolation/directional.hpp"
+#include "../interpolation/rb.hpp"
+#include "../decision/posteriori.hpp"
+
+namespace menon {
+
+    TemporalDemosaicing::TemporalDemosaicing(size_t tile_size, size_t threads)
+        : tile_size_{std::max(tile_size, kPipelineHalo)},
+          threads_{threads} {
+    }
+
+    void TemporalDemosaicing::Reset(const Bitmap& cfa) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+        tiles_x_ = (h + tile_size_ - 1) / tile_size_;
+        tiles_y_ = (w + tile_size_ - 1) / tile_size_;
+
+        prev_cfa_ = cfa.Copy();
+        layers_ = Layers::Create(h, w);
+        grad_diff_ = Bitmap{h, w, sizeof(int16_t)};
+        chrom_ = Bitmap{h, w, sizeof(int16_t)};
+    }
+
+    Region TemporalDemosaicing::Tile(size_t index) const {
+        size_t tx = index / tiles_y_;
+        size_t ty = index % tiles_y_;
+        return Region{
+            tx * tile_size_, std::min((tx + 1) * tile_size_, prev_cfa_.Height()),
+            ty * tile_size_, std::min((ty + 1) * tile_size_, prev_cfa_.Width())
+        };
+    }
+
+    std::vector<char> TemporalDemosaicing::FindChangedTiles(const Bitmap& cfa) {
+        size_t w = cfa.Width();
+        std::vector<char> changed(tiles_x_ * tiles_y_, 0);
+
+        sched::ParallelFor(changed.size(), threads_, [&](size_t i) {
+            Region tile = Tile(i);
+            size_t count = (tile.y_end - tile.y_begin) * sizeof(uint16_t);
+            for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+                size_t offset = (x * w + tile.y_begin) * sizeof(uint16_t);
+                if (std::memcmp(cfa.Data() + offset, prev_cfa_.Data() + offset, count) != 0) {
+                    changed[i] = 1;
+                    break;
+                }
+            }
+            if (changed[i]) {
+                // Remember the new mosaic of the tile
+                for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+                    size_t offset = (x * w + tile.y_begin) * sizeof(uint16_t);
+                    std::memcpy(prev_cfa_.Data() + offset, cfa.Data() + offset, count);
+                }
+            }
+        });
+        return changed;
+    }
+
+    const Layers& TemporalDemosaicing::Process(const Bitmap& cfa) {
+        std::vector<size_t> dirty;
+
+        if (cfa.Height() != prev_cfa_.Height() || cfa.Width() != prev_cfa_.Width()
+            || layers_.green.Data() == nullptr) {
+            Reset(cfa);
+            for (size_t i = 0; i < tiles_x_ * tiles_y_; ++i) {
+                dirty.push_back(i);
+            }
+        }
+        else {
+            auto changed = FindChangedTiles(cfa);
+            // A changed pixel affects results at most kPipelineHalo pixels around,
+            // and that is never farther than the neighbour tile
+            for (size_t tx = 0; tx < tiles_x_; ++tx) {
+                for (size_t ty = 0; ty < tiles_y_; ++ty) {
+                    bool is_dirty = false;
+                    for (size_t nx = (tx > 0 ? tx - 1 : 0); nx <= tx + 1 && nx < tiles_x_; ++nx) {
+                        for (size_t ny = (ty > 0 ? ty - 1 : 0); ny <= ty + 1 && ny < tiles_y_; ++ny) {
+                            is_dirty |= changed[nx * tiles_y_ + ny] != 0;
+                        }
+                    }
+                    if (is_dirty) {
+                        dirty.push_back(tx * tiles_y_ + ty);
+                    }
+                }
+            }
+        }
+
+        size_t total = tiles_x_ * tiles_y_;
+        skip_ratio_ = total > 0 ? 1.0 - static_cast<double>(dirty.size()) / total : 0.0;
+
+        // Every stage is computed for all dirty tiles before the next one starts.
+        // Stages read the previous stage around a tile; outside of dirty tiles
+        // the values of the previous frame are still valid
+        auto for_dirty = [&](auto stage) {
+            sched::ParallelFor(dirty.size(), threads_, [&](size_t i) {
+                stage(Tile(dirty[i]));
+            });
+        };
+        const Bitmap& mosaic = prev_cfa_;
+        for_dirty([&](const Region& r) { InterpolateGreenVHRegion(mosaic, layers_.green_vh, r); });
+        for_dirty([&](const Region& r) { GetGradientDifferenceRegion(mosaic, layers_.green_vh, grad_diff_, r); });
+        for_dirty([&](const Region& r) { SumClassifierRegion(grad_diff_, layers_.diff, r); });
+        for_dirty([&](const Region& r) { PosterioriRegion(layers_.green_vh, layers_.diff, layers_.green, r); });
+        for_dirty([&](const Region& r) { GetColorDifferenceRegion(mosaic, layers_.green, chrom_, r); });
+        for_dirty([&](const Region& r) { InterpolateRBonGreenRegion(mosaic, chrom_, layers_.rb, r); });
+        for_dirty([&](const Region& r) { FillRBonRBRegion(layers_.rb, layers_.diff, r); });
+
+        return layers_;
+    }
+} // namespace menon
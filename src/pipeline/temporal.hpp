@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include "wavefront.hpp"
+#include "../interpolation/filter.hpp"
+#include "tuning.hpp"
+#include "../support/region.hpp"
+#include "../support/scheduler.hpp"
+
+namespace menon {
+
+    // Rows and columns the result of a pixel depends on in the mosaic
+    // (green filter 2 + gradient 2 + 5x5 window 2 + R/B neighbours 1 + 1)
+    constexpr size_t kPipelineHalo = MenonFilter::kOffset + 6;
+
+    // Side of a square tile compared between frames without tuning
+    // Must not be less than kPipelineHalo
+    constexpr size_t kTemporalTileSize = 64;
+
+    // Demosaicing of a video from a fixed camera.
+    // Keeps the layers of the previous frame and recomputes only the tiles
+    // whose mosaic changed, together with the tiles around them (halo).
+    // Other tiles reuse the previous green, direction mask (classifier difference)
+    // and red/blue. So the cost of a frame scales with the motion in the scene.
+    //
+    // NOTE: refining (REFINE) is not applied in this mode
+    class TemporalDemosaicing {
+    public:
+        explicit TemporalDemosaicing(size_t tile_size = CurrentTuning().tile_size,
+                                     size_t threads = sched::DefaultThreads());
+
+        // Demosaics the next frame of the stream
+        // Returned layers are valid until the next call
+        const Layers& Process(const Bitmap& cfa);
+
+        // Part of tiles of the last frame reused from the previous one
+        double SkipRatio() const {
+            return skip_ratio_;
+        }
+
+    private:
+        // Allocates the layers for frames of the cfa size
+        void Reset(const Bitmap& cfa);
+        // Marks tiles where cfa differs from the previous frame and copies them
+        std::vector<char> FindChangedTiles(const Bitmap& cfa);
+        Region Tile(size_t index) const;
+
+        size_t tile_size_;
+        size_t threads_;
+        size_t tiles_x_{0}, tiles_y_{0};
+        double skip_ratio_{0};
+
+        Bitmap prev_cfa_;
+        Layers layers_;
+        // Temporary layers of the pipeline
+        Bitmap grad_diff_;
+        Bitmap chrom_;
+    };
+} // namespace menon
@@ -0,0 +1,31 @@
+#include "tuning.hpp"
+#include "wavefront.hpp"
+#include "temporal.hpp"
+#include "../support/scheduler.hpp"
+#include "../support/allocator.hpp"
+
+namespace menon {
+
+    Tuning DefaultTuning() {
+        return Tuning{sched::HardwareThreads(), kWavefrontBandRows, kTemporalTileSize};
+    }
+
+    static Tuning& Current() {
+        static Tuning tuning = DefaultTuning();
+        return tuning;
+    }
+
+    const Tuning& CurrentTuning() {
+        return Current();
+    }
+
+    void SetTuning(const Tuning& tuning) {
+        Current() = tuning;
+        sched::SetDefaultThreads(tuning.threads);
+        // Pages of new bitmaps are touched band by band by the same number of threads
+        auto options = mem::Options();
+        options.threads = tuning.threads;
+        options.band_rows = tuning.band_rows;
+        mem::SetAllocatorOptions(options);
+    }
+} // namespace menon
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+
+namespace menon {
+
+    // Parameters of the parallel execution
+    // The best ones depend on the image size, caches and cores of the host
+    // (see pipeline/autotune.hpp)
+    struct Tuning {
+        size_t threads;   // threads for the whole-frame work
+        size_t band_rows; // rows in a band of the wavefront
+        size_t tile_size; // side of a tile of the temporal demosaicing
+    };
+
+    // Parameters chosen without calibration
+    Tuning DefaultTuning();
+
+    // Parameters used by Demosaicing and TemporalDemosaicing by default
+    const Tuning& CurrentTuning();
+
+    // Replaces the current parameters
+    // (also sets sched::DefaultThreads and first touch of mem::AllocatorOptions)
+    // BE CAREFUL: call it before the processing starts
+    void SetTuning(const Tuning& tuning);
+} // namespace menon
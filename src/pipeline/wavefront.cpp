@@ -0,0 +1,138 @@
+#include <memory>
+#include "wavefront.hpp"
+#include "liveness.hpp"
+#include "../support/scheduler.hpp"
+#include "../support/perf.hpp"
+#include "../interpolation/directional.hpp"
+#include "../interpolation/rb.hpp"
+#include "../decision/posteriori.hpp"
+
+namespace menon {
+
+    // Rows every stage reads around its band (see region variants of the stages)
+    constexpr size_t kGradientHalo   = 2; // gradient of the chrominance: x + 2
+    constexpr size_t kClassifierHalo = 2; // 5x5 window
+    constexpr size_t kNeighbourHalo  = 1; // R/B from the nearest pixels
+
+    namespace {
+        // Buffers of the wavefront by the stages (in order of their start) writing and reading them
+        struct WavefrontPlan {
+            enum Stage { GREEN_VH, GRADIENTS, CLASSIFIERS, POSTERIORI, CHROMINANCE, RB_ON_GREEN, RB_ON_RB, RESULT };
+
+            BufferPlan plan;
+            size_t green_v  = plan.Add(sizeof(uint16_t), GREEN_VH, POSTERIORI);
+            size_t green_h  = plan.Add(sizeof(uint16_t), GREEN_VH, POSTERIORI);
+            size_t gradient = plan.Add(sizeof(int16_t), GRADIENTS, CLASSIFIERS);
+            size_t diff     = plan.Add(sizeof(int), CLASSIFIERS, RESULT);
+            size_t green    = plan.Add(sizeof(uint16_t), POSTERIORI, RESULT);
+            size_t chrom    = plan.Add(sizeof(int16_t), CHROMINANCE, RB_ON_GREEN);
+            size_t red      = plan.Add(sizeof(uint16_t), RB_ON_GREEN, RESULT);
+            size_t blue     = plan.Add(sizeof(uint16_t), RB_ON_GREEN, RESULT);
+        };
+    } // namespace
+
+    Layers InterpolateWavefront(const Bitmap& cfa, size_t threads, size_t band_rows,
+                                const BandOutput& output, Keep keep, stats::Accumulator* stats) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+
+        Layers layers;
+        // Temporary layers
+        Bitmap grad_diff, chrom;
+
+        WavefrontPlan plan;
+        std::unique_ptr<BufferPool> pool;
+        if (keep == Keep::ALL) {
+            layers = Layers::Create(h, w);
+            grad_diff = Bitmap(h, w, sizeof(int16_t));
+            chrom = Bitmap(h, w, sizeof(int16_t));
+        }
+        else {
+            pool = std::make_unique<BufferPool>(plan.plan, h, w);
+            layers.green_vh = ViewVH(*pool, plan.green_v, plan.green_h);
+            layers.diff = pool->View(plan.diff);
+            layers.green = pool->View(plan.green);
+            layers.rb = ViewVH(*pool, plan.red, plan.blue);
+            grad_diff = pool->View(plan.gradient);
+            chrom = pool->View(plan.chrom);
+        }
+
+        sched::Wavefront wavefront(h, band_rows);
+
+        // Counters of a stage are summed over its bands under the names of the
+        // stage by stage pipeline (menon.hpp), a band is counted by the thread running it
+        size_t green_vh = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage green VH", (end - begin) * w)
+            InterpolateGreenVHRegion(cfa, layers.green_vh, Region::Rows(begin, end, w));
+        });
+        size_t gradients = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage classifiers", (end - begin) * w)
+            GetGradientDifferenceRegion(cfa, layers.green_vh, grad_diff, Region::Rows(begin, end, w));
+        });
+        wavefront.AddDependency(gradients, green_vh, kGradientHalo);
+
+        size_t classifiers = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage classifiers", 0) // the pixels are counted by the gradients
+            SumClassifierRegion(grad_diff, layers.diff, Region::Rows(begin, end, w));
+        });
+        wavefront.AddDependency(classifiers, gradients, kClassifierHalo);
+
+        size_t posteriori = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage green", (end - begin) * w)
+            PosterioriRegion(layers.green_vh, layers.diff, layers.green, Region::Rows(begin, end, w));
+            if (stats != nullptr) {
+                stats->AddRows(stats::GREEN, layers.green, begin, end);
+            }
+        });
+        wavefront.AddDependency(posteriori, green_vh, 0);
+        wavefront.AddDependency(posteriori, classifiers, 0);
+        if (pool) {
+            // Green takes the storage of the gradients, the chrominance and red the one
+            // of green V, H: rows of a band are written only when no classifier (and so
+            // no gradient or posteriori band) reads them any more
+            wavefront.AddDependency(posteriori, classifiers, kClassifierHalo);
+        }
+
+        size_t chrominance = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage RB on green", (end - begin) * w)
+            GetColorDifferenceRegion(cfa, layers.green, chrom, Region::Rows(begin, end, w));
+        });
+        wavefront.AddDependency(chrominance, posteriori, 0);
+
+        size_t rb_on_green = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage RB on green", 0) // the pixels are counted by the chrominance
+            InterpolateRBonGreenRegion(cfa, chrom, layers.rb, Region::Rows(begin, end, w));
+        });
+        wavefront.AddDependency(rb_on_green, chrominance, kNeighbourHalo);
+
+        size_t rb_on_rb = wavefront.AddStage([&](size_t begin, size_t end) {
+            PERF_SCOPE("Stage RB on RB", (end - begin) * w)
+            FillRBonRBRegion(layers.rb, layers.diff, Region::Rows(begin, end, w));
+            if (stats != nullptr) {
+                stats->AddRows(stats::RED, layers.rb.V, begin, end);
+                stats->AddRows(stats::BLUE, layers.rb.H, begin, end);
+            }
+        });
+        wavefront.AddDependency(rb_on_rb, rb_on_green, kNeighbourHalo);
+        wavefront.AddDependency(rb_on_rb, classifiers, 0);
+
+        if (output) {
+            // FillRBonRBRegion writes only the rows of its band
+            size_t finished = wavefront.AddStage([&](size_t begin, size_t end) {
+                PERF_SCOPE("Stage output", (end - begin) * w)
+                output(layers, begin, end);
+            });
+            wavefront.AddDependency(finished, rb_on_rb, 0);
+        }
+
+        wavefront.Run(threads);
+        if (pool) {
+            // The result owns its storage
+            layers.green_vh = BitmapVH{};
+            layers.diff = pool->Release(plan.diff);
+            layers.green = pool->Release(plan.green);
+            layers.rb = BitmapVH{pool->Release(plan.red), pool->Release(plan.blue)};
+        }
+        return layers;
+    }
+} // namespace menon
@@ -0,0 +1,52 @@
+#pragma once
+#include <functional>
+#include "../support/bitmap.hpp"
+#include "../support/stats.hpp"
+
+namespace menon {
+
+    // Layers computed by the Menon demosaicing before refining
+    struct Layers {
+        BitmapVH green_vh; // green interpolated vertically (V) and horizontally (H)
+        Bitmap diff;       // classifier difference, Bitmap<int>
+        Bitmap green;
+        BitmapVH rb;       // rb.V is red, rb.H is blue
+
+        // Allocates all layers for h x w mosaic
+        static Layers Create(size_t h, size_t w) {
+            return Layers{
+                BitmapVH::Create(h, w, sizeof(uint16_t)),
+                Bitmap{h, w, sizeof(int)},
+                Bitmap{h, w, sizeof(uint16_t)},
+                BitmapVH::Create(h, w, sizeof(uint16_t))
+            };
+        }
+    };
+
+    // Height of a band of rows scheduled as one task
+    constexpr size_t kWavefrontBandRows = 32;
+
+    // Called for the rows [begin, end) of a band as soon as its layers are final,
+    // concurrently for different bands
+    using BandOutput = std::function<void(const Layers& layers, size_t begin, size_t end)>;
+
+    // Layers InterpolateWavefront returns
+    enum class Keep {
+        ALL,    // every layer (for TemporalDemosaicing and the checks)
+        RESULT, // diff, green and rb; storage of the dead layers is reused (BufferPlan)
+    };
+
+    // Computes all layers of the demosaicing without full-frame barriers
+    // between the stages: every stage works on bands of rows and starts a band
+    // as soon as the rows it reads are finished by the previous stages.
+    // The result is the same as InterpolateGreenVH -> ... -> FillRBonRB produce
+    // with the simple (non-SIMD) arithmetics.
+    // 'output' (if set) is the last stage, e.g. conversion of finished rows
+    // while they are still in cache.
+    // With Keep::RESULT green takes the storage of the gradients, the chrominance and red
+    // the one of green V and H: 12 instead of 18 bytes per pixel, green_vh of the result is empty
+    // 'stats' (if set) gets the rows of green and red, blue as soon as their stages finish them
+    Layers InterpolateWavefront(const Bitmap& cfa, size_t threads, size_t band_rows = kWavefrontBandRows,
+                                const BandOutput& output = {}, Keep keep = Keep::ALL,
+                                stats::Accumulator* stats = nullptr);
+} // namespace menon
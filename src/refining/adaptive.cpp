@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstdlib>
+#include "adaptive.hpp"
+#include "fixed16.hpp"
+#include "../support/border.hpp"
+#include "../support/pf.hpp"
+#include "../support/scheduler.hpp"
+#include "../support/strided.hpp"
+#include "../support/perf.hpp"
+
+namespace refine {
+
+    namespace {
+        uint16_t Clamp(int v) {
+            return static_cast<uint16_t>(std::min(std::max(v, 0), UINT16_MAX));
+        }
+
+        // Marks active[j] the tiles of a row of tiles [x_begin, x_end) where a second difference
+        // of the low-pass along its direction reaches 'limit'. The low-pass of FilterVH is
+        // a sum of two neighbours (scale 2), the one of FilterVH16 their average (scale 1),
+        // so the difference is one of the mosaic (same color, two pixels apart) in its codes.
+        // The low-pass of the first and last rows and columns has a neighbour out of the image,
+        // so tiles with pixels less than three pixels away from the borders are active.
+        // Rows are read one by one, a tile is not read after it is marked
+        template <typename T>
+        void MarkActive(const BitmapVH& lpVH, size_t x_begin, size_t x_end, size_t tile,
+                        int limit, int scale, char* active) {
+            size_t h = lpVH.V.Height();
+            size_t w = lpVH.V.Width();
+            size_t tiles = (w + tile - 1) / tile;
+            bool inside_rows = x_begin >= 3 && x_end + 3 <= h;
+            for (size_t j = 0; j < tiles; ++j) {
+                active[j] = !inside_rows || j * tile < 3 || std::min((j + 1) * tile, w) + 3 > w;
+            }
+            auto lpv = reinterpret_cast<const T*>(lpVH.V.Data());
+            auto lph = reinterpret_cast<const T*>(lpVH.H.Data());
+            for (size_t x = x_begin; x < x_end; ++x) {
+                const T* v = lpv + x * w;
+                const T* hr = lph + x * w;
+                for (size_t j = 0; j < tiles; ++j) {
+                    if (active[j]) {
+                        continue;
+                    }
+                    size_t y_end = (j + 1) * tile;
+                    int tile_max = 0;
+                    // Vectorized by the compiler
+                    for (size_t y = j * tile; y < y_end; ++y) {
+                        int along_v = 2 * static_cast<int>(v[y]) - static_cast<int>(v[y - 2 * w]) - static_cast<int>(v[y + 2 * w]);
+                        int along_h = 2 * static_cast<int>(hr[y]) - static_cast<int>(hr[y - 2]) - static_cast<int>(hr[y + 2]);
+                        tile_max = std::max(tile_max, std::max(std::abs(along_v), std::abs(along_h)));
+                    }
+                    active[j] = tile_max >= limit * scale;
+                }
+            }
+        }
+
+        // RefineGonRB and RefineRBonRB of the region in one pass, in place: the corrections
+        // of a red/blue pixel read its own values and green pixels of rb, which no tile
+        // changes, so every correction is computed once with the high-pass filters
+        // of lowpass.cpp and written at once
+        void RefineTile(Bitmap& green, BitmapVH& rb, const BitmapVH& lpVH, const Bitmap& diff,
+                        const Region& region) {
+            size_t h = green.Height();
+            size_t w = green.Width();
+            auto g = reinterpret_cast<uint16_t*>(green.Data());
+            auto r = reinterpret_cast<const uint16_t*>(rb.V.Data());
+            auto lpv = reinterpret_cast<const int*>(lpVH.V.Data());
+            auto lph = reinterpret_cast<const int*>(lpVH.H.Data());
+            auto d = reinterpret_cast<const int*>(diff.Data());
+
+            for (size_t x = region.x_begin; x < region.x_end; ++x) {
+                SIZE_T_PF(x)
+                bool is_red_row = (~x) & 1;
+                const Bitmap& known = is_red_row ? rb.V : rb.H;
+                Bitmap& other = is_red_row ? rb.H : rb.V;
+                auto c = reinterpret_cast<uint16_t*>(other.Data());
+                size_t row_pos = x * w;
+                border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                    constexpr bool kInside = decltype(inside)::value;
+                    size_t y = begin + ((begin & 1) != pf);
+#if defined(SIMD)
+                    if constexpr (kInside) {
+                        auto k = reinterpret_cast<const uint16_t*>(known.Data());
+                        for (; y + strided::kLast < end; y += strided::kStep) {
+                            size_t i = row_pos + y;
+                            __m128i use_h = strided::LoadI32(d + i);
+                            auto sum = [&](const uint16_t* p) {
+                                __m128i along  = _mm_add_epi32(strided::LoadU16(p + i - 1), strided::LoadU16(p + i + 1));
+                                __m128i across = _mm_add_epi32(strided::LoadU16(p + i - w), strided::LoadU16(p + i + w));
+                                return strided::SelectNegative(use_h, along, across);
+                            };
+                            // The high-pass of red and blue starts from red on every row as HighpassRonR does
+                            __m128i red = strided::LoadU16(r + i);
+                            __m128i hp_rr = _mm_sub_epi32(_mm_add_epi32(red, red), sum(k));
+                            __m128i gv = strided::LoadU16(g + i);
+                            __m128i cv = strided::LoadU16(c + i);
+                            __m128i lp = strided::SelectNegative(use_h, strided::LoadI32(lph + i), strided::LoadI32(lpv + i));
+                            __m128i hp_g = _mm_sub_epi32(_mm_add_epi32(gv, gv), lp);
+                            __m128i his_hp = _mm_sub_epi32(_mm_add_epi32(cv, cv), sum(c));
+                            strided::StoreU16(g + i, _mm_add_epi32(gv, strided::Div3(_mm_sub_epi32(hp_rr, hp_g))));
+                            strided::StoreU16(c + i, _mm_add_epi32(cv, strided::Div3(_mm_sub_epi32(hp_rr, his_hp))));
+                        }
+                    }
+#endif
+                    for (; y < end; y += 2) {
+                        size_t i = row_pos + y;
+                        // check if delta_H < delta_V => use H
+                        bool use_h = d[i] < 0;
+                        size_t x1 = use_h ? x : x - 1, y1 = use_h ? y - 1 : y;
+                        size_t x2 = use_h ? x : x + 1, y2 = use_h ? y + 1 : y;
+                        int hp_rr = 2 * r[i] - border::Get<kInside, uint16_t>(known, x1, y1)
+                                             - border::Get<kInside, uint16_t>(known, x2, y2);
+                        int hp_g = 2 * g[i] - (use_h ? lph[i] : lpv[i]);
+                        int his_hp = 2 * c[i] - border::Get<kInside, uint16_t>(other, x1, y1)
+                                              - border::Get<kInside, uint16_t>(other, x2, y2);
+                        g[i] = Clamp(g[i] + (hp_rr - hp_g) / 3);
+                        c[i] = Clamp(c[i] + (hp_rr - his_hp) / 3);
+                    }
+                });
+            }
+        }
+
+        // RefineTile of the 16-bit refining with the filters of lowpass16.cpp
+        // and the arithmetics of fixed16.hpp
+        void RefineTile16(Bitmap& green, BitmapVH& rb, const BitmapVH& lpVH, const Bitmap& diff,
+                          const Region& region) {
+            size_t h = green.Height();
+            size_t w = green.Width();
+            auto g = reinterpret_cast<uint16_t*>(green.Data());
+            auto r = reinterpret_cast<const uint16_t*>(rb.V.Data());
+            auto lpv = reinterpret_cast<const uint16_t*>(lpVH.V.Data());
+            auto lph = reinterpret_cast<const uint16_t*>(lpVH.H.Data());
+            auto d = reinterpret_cast<const int*>(diff.Data());
+
+            for (size_t x = region.x_begin; x < region.x_end; ++x) {
+                SIZE_T_PF(x)
+                bool is_red_row = (~x) & 1;
+                const Bitmap& known = is_red_row ? rb.V : rb.H;
+                Bitmap& other = is_red_row ? rb.H : rb.V;
+                auto c = reinterpret_cast<uint16_t*>(other.Data());
+                size_t row_pos = x * w;
+                border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                    constexpr bool kInside = decltype(inside)::value;
+                    size_t y = begin + ((begin & 1) != pf);
+#if defined(SIMD)
+                    if constexpr (kInside) {
+                        auto k = reinterpret_cast<const uint16_t*>(known.Data());
+                        for (; y + strided::kLast16 < end; y += strided::kStep16) {
+                            size_t i = row_pos + y;
+                            __m128i use_h = strided::NegativeEven16(d + i);
+                            auto avg = [&](const uint16_t* p) {
+                                __m128i along  = _mm_avg_epu16(strided::LoadEven16(p + i - 1), strided::LoadEven16(p + i + 1));
+                                __m128i across = _mm_avg_epu16(strided::LoadEven16(p + i - w), strided::LoadEven16(p + i + w));
+                                return fixed16::Select(use_h, along, across);
+                            };
+                            __m128i hp_rr = fixed16::HalfDiff(strided::LoadEven16(r + i), avg(k));
+                            __m128i gv = strided::LoadEven16(g + i);
+                            __m128i cv = strided::LoadEven16(c + i);
+                            __m128i lp = fixed16::Select(use_h, strided::LoadEven16(lph + i), strided::LoadEven16(lpv + i));
+                            __m128i his_hp = fixed16::HalfDiff(cv, avg(c));
+                            strided::StoreEven16(g + i, fixed16::Correct(gv, hp_rr, fixed16::HalfDiff(gv, lp)));
+                            strided::StoreEven16(c + i, fixed16::Correct(cv, hp_rr, his_hp));
+                        }
+                    }
+#endif
+                    for (; y < end; y += 2) {
+                        size_t i = row_pos + y;
+                        // check if delta_H < delta_V => use H
+                        bool use_h = d[i] < 0;
+                        size_t x1 = use_h ? x : x - 1, y1 = use_h ? y - 1 : y;
+                        size_t x2 = use_h ? x : x + 1, y2 = use_h ? y + 1 : y;
+                        int hp_rr = fixed16::HalfDiff(r[i], fixed16::Avg(border::Get<kInside, uint16_t>(known, x1, y1),
+                                                                         border::Get<kInside, uint16_t>(known, x2, y2)));
+                        int his_hp = fixed16::HalfDiff(c[i], fixed16::Avg(border::Get<kInside, uint16_t>(other, x1, y1),
+                                                                          border::Get<kInside, uint16_t>(other, x2, y2)));
+                        int hp_g = fixed16::HalfDiff(g[i], use_h ? lph[i] : lpv[i]);
+                        g[i] = fixed16::Correct(g[i], hp_rr, hp_g);
+                        c[i] = fixed16::Correct(c[i], hp_rr, his_hp);
+                    }
+                });
+            }
+        }
+    } // namespace
+
+    std::vector<Region> ActiveTiles(const BitmapVH& lpVH, size_t threads, const AdaptiveOptions& options) {
+        size_t h = lpVH.V.Height();
+        size_t w = lpVH.V.Width();
+        size_t tile = std::max<size_t>(options.tile_size, 1);
+        bool bits16 = lpVH.V.BytesPerPixel() == sizeof(uint16_t);
+        size_t tile_rows = (h + tile - 1) / tile;
+        size_t tile_columns = (w + tile - 1) / tile;
+
+        std::vector<char> active(tile_rows * tile_columns, 1);
+        if (options.threshold > 0) {
+            sched::ParallelFor(tile_rows, threads, [&](size_t i) {
+                size_t x_end = std::min((i + 1) * tile, h);
+                char* row = active.data() + i * tile_columns;
+                if (bits16) {
+                    MarkActive<uint16_t>(lpVH, i * tile, x_end, tile, options.threshold, 1, row);
+                    return;
+                }
+                MarkActive<int>(lpVH, i * tile, x_end, tile, options.threshold, 2, row);
+            });
+        }
+        std::vector<Region> tiles;
+        for (size_t i = 0; i < tile_rows; ++i) {
+            for (size_t j = 0; j < tile_columns; ++j) {
+                if (active[i * tile_columns + j]) {
+                    tiles.push_back(Region{i * tile, std::min((i + 1) * tile, h),
+                                           j * tile, std::min((j + 1) * tile, w)});
+                }
+            }
+        }
+        return tiles;
+    }
+
+    size_t AdaptiveRefine(Bitmap& green, BitmapVH& rb, const BitmapVH& lpVH, const Bitmap& diff,
+                          size_t threads, const AdaptiveOptions& options) {
+        PERF_SCOPE("AdaptiveRefine", diff.Height() * diff.Width())
+        auto tiles = ActiveTiles(lpVH, threads, options);
+        size_t count = tiles.size();
+        // Runs of active tiles in a row of tiles are refined as one region:
+        // its rows are read as long lines as the full-frame refining does
+        std::vector<Region> runs;
+        for (const auto& tile : tiles) {
+            if (!runs.empty() && runs.back().x_begin == tile.x_begin && runs.back().y_end == tile.y_begin) {
+                runs.back().y_end = tile.y_end;
+                continue;
+            }
+            runs.push_back(tile);
+        }
+        // 16-bit low-pass of FilterVH16 means the 16-bit refining
+        bool bits16 = lpVH.V.BytesPerPixel() == sizeof(uint16_t);
+        sched::ParallelFor(runs.size(), threads, [&](size_t i) {
+            if (bits16) {
+                RefineTile16(green, rb, lpVH, diff, runs[i]);
+                return;
+            }
+            RefineTile(green, rb, lpVH, diff, runs[i]);
+        });
+        return count;
+    }
+} // namespace refine
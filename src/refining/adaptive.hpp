@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "../support/bitmap.hpp"
+#include "../support/region.hpp"
+
+// Refining only where the mosaic has detail (define ADAPTIVE_REFINE with REFINE).
+// The frame is split into tiles and a tile is refined only if its high-pass
+// energy reaches the threshold: the largest second difference of the mosaic
+// (same color, two pixels apart) taken from the low-pass, a cheap read-only pass
+// stopping at the first row that reaches it. Tiles at the borders are refined. Refined tiles get exactly the values
+// of the full-frame refining in one pass: each correction is computed once and
+// written in place, without the high-pass buffers.
+//
+// On achromatic content (white-balanced grey, equal levels of the channels)
+// pixels of the skipped tiles differ from the full-frame refining by less than
+// twice the threshold (checked by check/differential.cpp). On flat colored
+// regions the high-pass of red and blue is not zero (HighpassRonR starts from red
+// on every row): their skipped corrections are up to 2/3 of the difference of red
+// and blue whatever the threshold is.
+namespace refine {
+
+    struct AdaptiveOptions {
+        size_t tile_size{32};
+        // High-pass energy of a refined tile, in codes of the 16-bit mosaic:
+        // tiles with less are not refined. 0 - every tile.
+        // Default 32: deviation below 64 codes (0.1% of the range) on achromatic content
+        int threshold{32};
+    };
+
+    inline AdaptiveOptions& Adaptive() {
+        static AdaptiveOptions options;
+        return options;
+    }
+
+    // BE CAREFUL: call it before the processing starts
+    inline void SetAdaptive(const AdaptiveOptions& options) {
+        Adaptive() = options;
+    }
+
+    // Tiles of the frame to refine, found in 'threads' threads
+    // lpVH as of AdaptiveRefine
+    std::vector<Region> ActiveTiles(const BitmapVH& lpVH, size_t threads, const AdaptiveOptions& options);
+
+    // Refines green, red and blue on the active tiles in 'threads' threads:
+    // RefineGonRB and RefineRBonRB with their high-pass filters tile by tile.
+    // lpVH - FilterVH of the 32-bit mosaic, or FilterVH16 of the mosaic
+    //        for the 16-bit refining (REFINE16)
+    // Returns the number of refined tiles
+    size_t AdaptiveRefine(Bitmap& green, BitmapVH& rb, const BitmapVH& lpVH, const Bitmap& diff,
+                          size_t threads, const AdaptiveOptions& options = Adaptive());
+} // namespace refine
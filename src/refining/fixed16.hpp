@@ -0,0 +1,85 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+// Arithmetics of the 16-bit refining (define REFINE16).
+// The 32-bit refining keeps low-pass values lp = a + b of two neighbours
+// (17 bits) and high-pass values hp = 2 * v - lp (18 bits with the sign).
+// Here they are halved to fit 16-bit lanes:
+//
+//      lp16 = (a + b + 1) / 2                 uint16_t
+//      hp16 = floor((v - lp16) / 2)           int16_t, hp is in [4 * hp16, 4 * hp16 + 3]
+//
+// and a correction (hp_a - hp_b) / 3 becomes 4 / 3 * (hp16_a - hp16_b),
+// taken as 2 * e + round(2 * e / 3) of e = floor((hp16_a - hp16_b) / 2).
+// No step overflows: differences are halved by the rounding average and
+// the correction is added with unsigned saturation.
+//
+// A refined value differs from the one of the 32-bit refining by at most
+// kMaxError: with hp_a - hp_b = 8 * e + r, r in [-3, 7], the exact correction
+// is 8 / 3 * e + [-1, 7 / 3], rounding of the third and the truncating division
+// of the 32-bit refining add less than 1 / 2 and 1, so the difference is in [-3, 2]
+// (checked by check/differential.cpp on random and extreme mosaics).
+namespace fixed16 {
+
+    constexpr int kMaxError = 3;
+
+    // Low-pass of two neighbours halved
+    inline int Avg(int a, int b) {
+        return (a + b + 1) >> 1;
+    }
+
+    // floor((v - n) / 2) of 16-bit v and n
+    inline int HalfDiff(int v, int n) {
+        return (v - n) >> 1;
+    }
+
+    // v + 4 / 3 * (hp_a - hp_b) clamped to [0, UINT16_MAX]
+    inline uint16_t Correct(int v, int hp_a, int hp_b) {
+        int e = HalfDiff(hp_a, hp_b);
+        // round(2 * e / 3) as _mm_mulhrs_epi16(e, 21845) computes it
+        int third = (e * 21845 + (1 << 14)) >> 15;
+        return static_cast<uint16_t>(std::min(std::max(v + 2 * e + third, 0), UINT16_MAX));
+    }
+} // namespace fixed16
+
+#if defined(SIMD)
+#include <immintrin.h>
+
+namespace fixed16 {
+
+    // HalfDiff of unsigned lanes: the rounding average of v and ~n
+    // is floor((v - n) / 2) + 0x8000
+    inline __m128i HalfDiff(__m128i v, __m128i n) {
+        const __m128i sign = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+        __m128i not_n = _mm_xor_si128(n, _mm_set1_epi16(-1));
+        return _mm_xor_si128(_mm_avg_epu16(v, not_n), sign);
+    }
+
+    // HalfDiff of signed lanes
+    inline __m128i HalfDiffSigned(__m128i a, __m128i b) {
+        const __m128i sign = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+        return HalfDiff(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+    }
+
+    // mask ? negative : other, mask is all bits set or zero in a lane
+    inline __m128i Select(__m128i mask, __m128i negative, __m128i other) {
+        return _mm_blendv_epi8(other, negative, mask);
+    }
+
+    // Correct of the lanes. e and its third have one sign, so adding them
+    // one by one with saturation gives the clamped sum
+    inline __m128i Correct(__m128i v, __m128i hp_a, __m128i hp_b) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i e = HalfDiffSigned(hp_a, hp_b);
+        __m128i third = _mm_mulhrs_epi16(e, _mm_set1_epi16(21845));
+        __m128i up_e = _mm_max_epi16(e, zero);
+        __m128i up_third = _mm_max_epi16(third, zero);
+        // -32768 becomes 32767: the sum is clamped to 0 either way
+        __m128i down_e = _mm_max_epi16(_mm_subs_epi16(zero, e), zero);
+        __m128i down_third = _mm_max_epi16(_mm_subs_epi16(zero, third), zero);
+        v = _mm_adds_epu16(_mm_adds_epu16(_mm_adds_epu16(v, up_e), up_e), up_third);
+        return _mm_subs_epu16(_mm_subs_epu16(_mm_subs_epu16(v, down_e), down_e), down_third);
+    }
+} // namespace fixed16
+#endif
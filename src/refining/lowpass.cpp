@@ -1,6 +1,9 @@
 #include <thread>
 #include "../support/bitmap_arithmetics.hpp"
+#include "../support/border.hpp"
 #include "../support/pf.hpp"
+#include "../support/region.hpp"
+#include "../support/strided.hpp"
 #include "lowpass.hpp"
 
 #include <iostream>
@@ -42,6 +45,34 @@ namespace lp {
         return lp;
     }
 
+    void FilterVHRegion(const Bitmap& cfa, BitmapVH& lp, const Region& region) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+        auto c = reinterpret_cast<const uint16_t*>(cfa.Data());
+        auto lpv = reinterpret_cast<int*>(lp.V.Data());
+        auto lph = reinterpret_cast<int*>(lp.H.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            size_t row_pos = x * w;
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                if constexpr (kInside) {
+                    // Vectorized by the compiler
+                    for (size_t i = row_pos + begin; i < row_pos + end; ++i) {
+                        lpv[i] = c[i - w] + c[i + w];
+                        lph[i] = c[i - 1] + c[i + 1];
+                    }
+                }
+                else {
+                    for (size_t y = begin; y < end; ++y) {
+                        lpv[row_pos + y] = border::Get<false, uint16_t>(cfa, x-1, y) + border::Get<false, uint16_t>(cfa, x+1, y);
+                        lph[row_pos + y] = border::Get<false, uint16_t>(cfa, x, y-1) + border::Get<false, uint16_t>(cfa, x, y+1);
+                    }
+                }
+            });
+        }
+    }
+
     void SubLowpassGonGreen(Bitmap& hp, const Bitmap& green, const Bitmap& diff) {
         auto data = reinterpret_cast<int*>(hp.Data());
 
@@ -50,16 +81,20 @@ namespace lp {
         size_t row_pos = 0;
         for (size_t x = 0; x < h; ++x) {
             SIZE_T_PF(x)
-            for (size_t y = 1-pf; y < w; y += 2) {
-                // check if delta_H < delta_V => use H
-                if (diff.Get<int>(x, y) < 0) {
-                    data[row_pos + y] -= green.GetSafe<uint16_t>(x, y-1);
-                    data[row_pos + y] -= green.GetSafe<uint16_t>(x, y+1);
-                } else {
-                    data[row_pos + y] -= green.GetSafe<uint16_t>(x-1, y);
-                    data[row_pos + y] -= green.GetSafe<uint16_t>(x+1, y);
+            // Bounds are checked only near the border
+            border::ForEachRowPart(x, 0, w, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                for (size_t y = begin + ((begin & 1) == pf); y < end; y += 2) {
+                    // check if delta_H < delta_V => use H
+                    if (diff.Get<int>(x, y) < 0) {
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(green, x, y-1);
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(green, x, y+1);
+                    } else {
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(green, x-1, y);
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(green, x+1, y);
+                    }
                 }
-            }
+            });
             row_pos += w;
         }
     }
@@ -85,11 +120,10 @@ namespace lp {
         }
     }
 
-    Bitmap HighpassG(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+    Bitmap HighpassGSimple(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
         // Get hp = 2 * green
-        auto green32 = CopyCast32(green);
-        Bitmap hp = green32;
-        AddShifted(hp, green32, 0, 0);
+        Bitmap hp = CopyCast32(green);
+        Add(hp, hp);
 #if defined(PARALLEL)
         std::thread on_green([&](){
             SubLowpassGonGreen(hp, green, diff);
@@ -106,7 +140,7 @@ namespace lp {
         return hp;
     }
 
-    Bitmap HighpassRonR(const BitmapVH& rb, const Bitmap& diff) {
+    Bitmap HighpassRonRSimple(const BitmapVH& rb, const Bitmap& diff) {
         //auto r32 = CopyCast32(rb.V);
         //auto b32 = CopyCast32(rb.H);
 
@@ -123,22 +157,184 @@ namespace lp {
         for (size_t x = 0; x < h; ++x) {
             SIZE_T_PF(x)
             bool is_red_row = (~x) & 1;
-            for (size_t y = pf; y < w; y += 2) {
-                // check if delta_H < delta_V => use H
-                const Bitmap& c = (is_red_row ? rb.V : rb.H);
-                if (diff.Get<int>(x, y) < 0) {
-                    data[row_pos + y] -= c.GetSafe<uint16_t>(x, y-1);
-                    data[row_pos + y] -= c.GetSafe<uint16_t>(x, y+1);
-                } else {
-                    data[row_pos + y] -= c.GetSafe<uint16_t>(x-1, y);
-                    data[row_pos + y] -= c.GetSafe<uint16_t>(x+1, y);
+            const Bitmap& c = (is_red_row ? rb.V : rb.H);
+            border::ForEachRowPart(x, 0, w, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                for (size_t y = begin + ((begin & 1) != pf); y < end; y += 2) {
+                    // check if delta_H < delta_V => use H
+                    if (diff.Get<int>(x, y) < 0) {
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(c, x, y-1);
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(c, x, y+1);
+                    } else {
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(c, x-1, y);
+                        data[row_pos + y] -= border::Get<kInside, uint16_t>(c, x+1, y);
+                    }
                 }
-            }
+            });
             row_pos += w;
         }
         return hp;
     }
 
+    // Both phases of a row in one pass: with SIMD lanes of the green pixels and
+    // of the others are interleaved to whole vectors, so hp is written once
+    // without a copy of green
+    void HighpassGRegion(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff,
+                         Bitmap& hp, const Region& region) {
+        size_t h = green.Height();
+        size_t w = green.Width();
+        auto data = reinterpret_cast<int*>(hp.Data());
+        auto g   = reinterpret_cast<const uint16_t*>(green.Data());
+        auto d   = reinterpret_cast<const int*>(diff.Data());
+        auto lpv = reinterpret_cast<const int*>(lpVH.V.Data());
+        auto lph = reinterpret_cast<const int*>(lpVH.H.Data());
+
+#if defined(SIMD)
+        // 2 * green - low-pass of the pixels i, i + 2, i + 4, i + 6
+        auto on_green = [&](size_t i) {
+            __m128i v = strided::LoadU16(g + i);
+            __m128i along  = _mm_add_epi32(strided::LoadU16(g + i - 1), strided::LoadU16(g + i + 1));
+            __m128i across = _mm_add_epi32(strided::LoadU16(g + i - w), strided::LoadU16(g + i + w));
+            return _mm_sub_epi32(_mm_add_epi32(v, v), strided::SelectNegative(strided::LoadI32(d + i), along, across));
+        };
+        auto on_rb = [&](size_t i) {
+            __m128i v = strided::LoadU16(g + i);
+            __m128i lp = strided::SelectNegative(strided::LoadI32(d + i), strided::LoadI32(lph + i), strided::LoadI32(lpv + i));
+            return _mm_sub_epi32(_mm_add_epi32(v, v), lp);
+        };
+#endif
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x)
+            size_t row_pos = x * w;
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin;
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kStep <= end; y += strided::kStep) {
+                        size_t i = row_pos + y;
+                        bool rb_first = (y & 1) == pf;
+                        __m128i even = rb_first ? on_rb(i) : on_green(i);
+                        __m128i odd  = rb_first ? on_green(i + 1) : on_rb(i + 1);
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_unpacklo_epi32(even, odd));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i + 4), _mm_unpackhi_epi32(even, odd));
+                    }
+                }
+#endif
+                for (; y < end; ++y) {
+                    size_t i = row_pos + y;
+                    int v = 2 * g[i];
+                    // check if delta_H < delta_V => use H
+                    if ((y & 1) == pf) {
+                        v -= d[i] < 0 ? lph[i] : lpv[i];
+                    }
+                    else if (d[i] < 0) {
+                        v -= border::Get<kInside, uint16_t>(green, x, y-1);
+                        v -= border::Get<kInside, uint16_t>(green, x, y+1);
+                    } else {
+                        v -= border::Get<kInside, uint16_t>(green, x-1, y);
+                        v -= border::Get<kInside, uint16_t>(green, x+1, y);
+                    }
+                    data[i] = v;
+                }
+            });
+        }
+    }
+
+    // In one pass as HighpassGRegion: 2 * red on green pixels
+    // and 2 * red - low-pass of the pixel color on the others
+    void HighpassRonRRegion(const BitmapVH& rb, const Bitmap& diff, Bitmap& hp, const Region& region) {
+        size_t h = diff.Height();
+        size_t w = diff.Width();
+        auto data = reinterpret_cast<int*>(hp.Data());
+        auto r = reinterpret_cast<const uint16_t*>(rb.V.Data());
+        auto d = reinterpret_cast<const int*>(diff.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x)
+            bool is_red_row = (~x) & 1;
+            const Bitmap& color = (is_red_row ? rb.V : rb.H);
+            size_t row_pos = x * w;
+
+#if defined(SIMD)
+            auto c = reinterpret_cast<const uint16_t*>(color.Data());
+            auto on_green = [&](size_t i) {
+                __m128i v = strided::LoadU16(r + i);
+                return _mm_add_epi32(v, v);
+            };
+            auto on_rb = [&](size_t i) {
+                __m128i v = strided::LoadU16(r + i);
+                __m128i along  = _mm_add_epi32(strided::LoadU16(c + i - 1), strided::LoadU16(c + i + 1));
+                __m128i across = _mm_add_epi32(strided::LoadU16(c + i - w), strided::LoadU16(c + i + w));
+                return _mm_sub_epi32(_mm_add_epi32(v, v), strided::SelectNegative(strided::LoadI32(d + i), along, across));
+            };
+#endif
+
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin;
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kStep <= end; y += strided::kStep) {
+                        size_t i = row_pos + y;
+                        bool rb_first = (y & 1) == pf;
+                        __m128i even = rb_first ? on_rb(i) : on_green(i);
+                        __m128i odd  = rb_first ? on_green(i + 1) : on_rb(i + 1);
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_unpacklo_epi32(even, odd));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i + 4), _mm_unpackhi_epi32(even, odd));
+                    }
+                }
+#endif
+                for (; y < end; ++y) {
+                    size_t i = row_pos + y;
+                    int v = 2 * r[i];
+                    if ((y & 1) == pf) {
+                        // check if delta_H < delta_V => use H
+                        if (d[i] < 0) {
+                            v -= border::Get<kInside, uint16_t>(color, x, y-1);
+                            v -= border::Get<kInside, uint16_t>(color, x, y+1);
+                        } else {
+                            v -= border::Get<kInside, uint16_t>(color, x-1, y);
+                            v -= border::Get<kInside, uint16_t>(color, x+1, y);
+                        }
+                    }
+                    data[i] = v;
+                }
+            });
+        }
+    }
+
+#if defined(SIMD)
+    Bitmap HighpassGWithSIMD(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+        Bitmap hp(green.Height(), green.Width(), sizeof(int));
+        HighpassGRegion(lpVH, green, diff, hp, Region::Rows(0, green.Height(), green.Width()));
+        return hp;
+    }
+
+    Bitmap HighpassRonRWithSIMD(const BitmapVH& rb, const Bitmap& diff) {
+        Bitmap hp(diff.Height(), diff.Width(), sizeof(int));
+        HighpassRonRRegion(rb, diff, hp, Region::Rows(0, diff.Height(), diff.Width()));
+        return hp;
+    }
+#endif
+
+    Bitmap HighpassG(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+#if defined(SIMD)
+        return HighpassGWithSIMD(lpVH, green, diff);
+#else
+        return HighpassGSimple(lpVH, green, diff);
+#endif
+    }
+
+    Bitmap HighpassRonR(const BitmapVH& rb, const Bitmap& diff) {
+#if defined(SIMD)
+        return HighpassRonRWithSIMD(rb, diff);
+#else
+        return HighpassRonRSimple(rb, diff);
+#endif
+    }
+
 //////////////////////////////////////////////////////////////////////////////////
 // Async run:
 
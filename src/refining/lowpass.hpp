@@ -1,6 +1,7 @@
 #pragma once
 #include <future>
 #include "../support/bitmap.hpp"
+#include "../support/region.hpp"
 
 namespace lp {
     // Computes Low-pass filter for each pixel
@@ -12,6 +13,10 @@ namespace lp {
     // returns pixels after FIR [1 0 1] for two directions
     // To get high-pass R: hpR = (2 * R - lpR) / 3
 
+    // FilterVH of the 16-bit mosaic itself writing only pixels of the region
+    // to preallocated lp - pair of Bitmap<int>. Safe to call concurrently for disjoint regions
+    void FilterVHRegion(const Bitmap& cfa, BitmapVH& lp, const Region& region);
+
 
     // Computes High-pass filter for each GREEN pixel
     // lpVH  - simplified low-pass filter for two directions
@@ -26,6 +31,21 @@ namespace lp {
     // Returns Bitmap<int>
     Bitmap HighpassRonR(const BitmapVH& rb, const Bitmap& diff);
 
+    // HighpassG and HighpassRonR writing only pixels of the region to preallocated
+    // hp - Bitmap<int>. Safe to call concurrently for disjoint regions
+    void HighpassGRegion(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff,
+                         Bitmap& hp, const Region& region);
+    void HighpassRonRRegion(const BitmapVH& rb, const Bitmap& diff, Bitmap& hp, const Region& region);
+
+    // Variants of HighpassG and HighpassRonR. The operations choose one of them by define SIMD.
+    // All variants must give the same result (see check/differential.hpp)
+    Bitmap HighpassGSimple(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    Bitmap HighpassRonRSimple(const BitmapVH& rb, const Bitmap& diff);
+#if defined(SIMD)
+    Bitmap HighpassGWithSIMD(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    Bitmap HighpassRonRWithSIMD(const BitmapVH& rb, const Bitmap& diff);
+#endif
+
     // Computes simplified low-pass filter for every pixel asynchronously
     std::future<BitmapVH> GetLowpassFilterVHAsync(const Bitmap& cfa32);
 
@@ -34,4 +54,36 @@ namespace lp {
 
     // Computes high-pass R/B filter for every R/B pixel asynchronously; R for R and B for B
     std::future<Bitmap> GetHighpassFilterRonRAsync(const BitmapVH& rb, const Bitmap& diff);
+
+//////////////////////////////////////////////////////////////////////////////////
+// 16-bit buffers (define REFINE16, see fixed16.hpp):
+
+    // Halved low-pass of the mosaic itself, no 32-bit copy is needed
+    // cfa - bayer mosaic, Bitmap<uint16_t>
+    // Returns a pair of Bitmap<uint16_t>: (a + b + 1) / 2 of the two neighbours
+    BitmapVH FilterVH16(const Bitmap& cfa);
+
+    // HighpassG and HighpassRonR of the halved low-pass
+    // Return Bitmap<int16_t> of floor(hp / 4) of the 32-bit high-pass
+    Bitmap HighpassG16(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    Bitmap HighpassRonR16(const BitmapVH& rb, const Bitmap& diff);
+
+    // lp - pair of Bitmap<uint16_t>, hp - Bitmap<int16_t>. Safe to call concurrently for disjoint regions
+    void FilterVH16Region(const Bitmap& cfa, BitmapVH& lp, const Region& region);
+    void HighpassG16Region(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff,
+                           Bitmap& hp, const Region& region);
+    void HighpassRonR16Region(const BitmapVH& rb, const Bitmap& diff, Bitmap& hp, const Region& region);
+
+    BitmapVH FilterVH16Simple(const Bitmap& cfa);
+    Bitmap HighpassG16Simple(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    Bitmap HighpassRonR16Simple(const BitmapVH& rb, const Bitmap& diff);
+#if defined(SIMD)
+    BitmapVH FilterVH16WithSIMD(const Bitmap& cfa);
+    Bitmap HighpassG16WithSIMD(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    Bitmap HighpassRonR16WithSIMD(const BitmapVH& rb, const Bitmap& diff);
+#endif
+
+    std::future<BitmapVH> GetLowpassFilterVH16Async(const Bitmap& cfa);
+    std::future<Bitmap> GetHighpassFilterG16Async(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff);
+    std::future<Bitmap> GetHighpassFilterRonR16Async(const BitmapVH& rb, const Bitmap& diff);
 } // namespace lp
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include <thread>
+#include "../support/border.hpp"
+#include "../support/pf.hpp"
+#include "../support/region.hpp"
+#include "../support/strided.hpp"
+#include "fixed16.hpp"
+#include "lowpass.hpp"
+
+// 16-bit buffers of the refining, arithmetics in fixed16.hpp
+namespace lp {
+
+    BitmapVH FilterVH16Simple(const Bitmap& cfa) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+        BitmapVH lp = BitmapVH::Create(h, w, sizeof(uint16_t));
+        for (size_t x = 0; x < h; ++x) {
+            for (size_t y = 0; y < w; ++y) {
+                lp.V.Set(x, y, static_cast<uint16_t>(fixed16::Avg(cfa.GetSafe<uint16_t>(x-1, y),
+                                                                   cfa.GetSafe<uint16_t>(x+1, y))));
+                lp.H.Set(x, y, static_cast<uint16_t>(fixed16::Avg(cfa.GetSafe<uint16_t>(x, y-1),
+                                                                   cfa.GetSafe<uint16_t>(x, y+1))));
+            }
+        }
+        return lp;
+    }
+
+    Bitmap HighpassG16Simple(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+        size_t h = green.Height();
+        size_t w = green.Width();
+        Bitmap hp(h, w, sizeof(int16_t));
+        for (size_t x = 0; x < h; ++x) {
+            SIZE_T_PF(x)
+            for (size_t y = 0; y < w; ++y) {
+                int lp;
+                // check if delta_H < delta_V => use H
+                if ((y & 1) == pf) {
+                    lp = (diff.Get<int>(x, y) < 0 ? lpVH.H : lpVH.V).Get<uint16_t>(x, y);
+                }
+                else if (diff.Get<int>(x, y) < 0) {
+                    lp = fixed16::Avg(green.GetSafe<uint16_t>(x, y-1), green.GetSafe<uint16_t>(x, y+1));
+                } else {
+                    lp = fixed16::Avg(green.GetSafe<uint16_t>(x-1, y), green.GetSafe<uint16_t>(x+1, y));
+                }
+                hp.Set(x, y, static_cast<int16_t>(fixed16::HalfDiff(green.Get<uint16_t>(x, y), lp)));
+            }
+        }
+        return hp;
+    }
+
+    Bitmap HighpassRonR16Simple(const BitmapVH& rb, const Bitmap& diff) {
+        size_t h = diff.Height();
+        size_t w = diff.Width();
+        Bitmap hp(h, w, sizeof(int16_t));
+        for (size_t x = 0; x < h; ++x) {
+            SIZE_T_PF(x)
+            bool is_red_row = (~x) & 1;
+            const Bitmap& c = (is_red_row ? rb.V : rb.H);
+            for (size_t y = 0; y < w; ++y) {
+                int r = rb.V.Get<uint16_t>(x, y);
+                // 2 * red of the 32-bit high-pass on green pixels
+                int v = r >> 1;
+                if ((y & 1) == pf) {
+                    int lp;
+                    if (diff.Get<int>(x, y) < 0) {
+                        lp = fixed16::Avg(c.GetSafe<uint16_t>(x, y-1), c.GetSafe<uint16_t>(x, y+1));
+                    } else {
+                        lp = fixed16::Avg(c.GetSafe<uint16_t>(x-1, y), c.GetSafe<uint16_t>(x+1, y));
+                    }
+                    v = fixed16::HalfDiff(r, lp);
+                }
+                hp.Set(x, y, static_cast<int16_t>(v));
+            }
+        }
+        return hp;
+    }
+
+    // Vertical and horizontal averages: with SIMD 8 pixels a vector
+    void FilterVH16Region(const Bitmap& cfa, BitmapVH& lp, const Region& region) {
+        size_t h = cfa.Height();
+        size_t w = cfa.Width();
+        auto lpv = reinterpret_cast<uint16_t*>(lp.V.Data());
+        auto lph = reinterpret_cast<uint16_t*>(lp.H.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            size_t row_pos = x * w;
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin;
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    auto c = reinterpret_cast<const uint16_t*>(cfa.Data());
+                    for (; y + strided::kStep <= end; y += strided::kStep) {
+                        size_t i = row_pos + y;
+                        auto load = [&](size_t j) {
+                            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + j));
+                        };
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(lpv + i), _mm_avg_epu16(load(i - w), load(i + w)));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(lph + i), _mm_avg_epu16(load(i - 1), load(i + 1)));
+                    }
+                }
+#endif
+                for (; y < end; ++y) {
+                    size_t i = row_pos + y;
+                    lpv[i] = static_cast<uint16_t>(fixed16::Avg(border::Get<kInside, uint16_t>(cfa, x-1, y),
+                                                                border::Get<kInside, uint16_t>(cfa, x+1, y)));
+                    lph[i] = static_cast<uint16_t>(fixed16::Avg(border::Get<kInside, uint16_t>(cfa, x, y-1),
+                                                                border::Get<kInside, uint16_t>(cfa, x, y+1)));
+                }
+            });
+        }
+    }
+
+    // Both phases of a row in one pass as HighpassGRegion does:
+    // with SIMD 8 pixels of every phase are interleaved to two vectors
+    void HighpassG16Region(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff,
+                           Bitmap& hp, const Region& region) {
+        size_t h = green.Height();
+        size_t w = green.Width();
+        auto data = reinterpret_cast<int16_t*>(hp.Data());
+        auto g   = reinterpret_cast<const uint16_t*>(green.Data());
+        auto d   = reinterpret_cast<const int*>(diff.Data());
+        auto lpv = reinterpret_cast<const uint16_t*>(lpVH.V.Data());
+        auto lph = reinterpret_cast<const uint16_t*>(lpVH.H.Data());
+
+#if defined(SIMD)
+        // Pixels i, i + 2, ..., i + 14
+        auto on_green = [&](size_t i) {
+            __m128i along  = _mm_avg_epu16(strided::LoadEven16(g + i - 1), strided::LoadEven16(g + i + 1));
+            __m128i across = _mm_avg_epu16(strided::LoadEven16(g + i - w), strided::LoadEven16(g + i + w));
+            __m128i lp = fixed16::Select(strided::NegativeEven16(d + i), along, across);
+            return fixed16::HalfDiff(strided::LoadEven16(g + i), lp);
+        };
+        auto on_rb = [&](size_t i) {
+            __m128i lp = fixed16::Select(strided::NegativeEven16(d + i),
+                                         strided::LoadEven16(lph + i), strided::LoadEven16(lpv + i));
+            return fixed16::HalfDiff(strided::LoadEven16(g + i), lp);
+        };
+#endif
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x)
+            size_t row_pos = x * w;
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin;
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kStep16 <= end; y += strided::kStep16) {
+                        size_t i = row_pos + y;
+                        bool rb_first = (y & 1) == pf;
+                        __m128i even = rb_first ? on_rb(i) : on_green(i);
+                        __m128i odd  = rb_first ? on_green(i + 1) : on_rb(i + 1);
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_unpacklo_epi16(even, odd));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i + 8), _mm_unpackhi_epi16(even, odd));
+                    }
+                }
+#endif
+                for (; y < end; ++y) {
+                    size_t i = row_pos + y;
+                    int lp;
+                    // check if delta_H < delta_V => use H
+                    if ((y & 1) == pf) {
+                        lp = d[i] < 0 ? lph[i] : lpv[i];
+                    }
+                    else if (d[i] < 0) {
+                        lp = fixed16::Avg(border::Get<kInside, uint16_t>(green, x, y-1),
+                                          border::Get<kInside, uint16_t>(green, x, y+1));
+                    } else {
+                        lp = fixed16::Avg(border::Get<kInside, uint16_t>(green, x-1, y),
+                                          border::Get<kInside, uint16_t>(green, x+1, y));
+                    }
+                    data[i] = static_cast<int16_t>(fixed16::HalfDiff(g[i], lp));
+                }
+            });
+        }
+    }
+
+    void HighpassRonR16Region(const BitmapVH& rb, const Bitmap& diff, Bitmap& hp, const Region& region) {
+        size_t h = diff.Height();
+        size_t w = diff.Width();
+        auto data = reinterpret_cast<int16_t*>(hp.Data());
+        auto r = reinterpret_cast<const uint16_t*>(rb.V.Data());
+        auto d = reinterpret_cast<const int*>(diff.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x)
+            bool is_red_row = (~x) & 1;
+            const Bitmap& color = (is_red_row ? rb.V : rb.H);
+            size_t row_pos = x * w;
+
+#if defined(SIMD)
+            auto c = reinterpret_cast<const uint16_t*>(color.Data());
+            auto on_green = [&](size_t i) {
+                return _mm_srli_epi16(strided::LoadEven16(r + i), 1);
+            };
+            auto on_rb = [&](size_t i) {
+                __m128i along  = _mm_avg_epu16(strided::LoadEven16(c + i - 1), strided::LoadEven16(c + i + 1));
+                __m128i across = _mm_avg_epu16(strided::LoadEven16(c + i - w), strided::LoadEven16(c + i + w));
+                __m128i lp = fixed16::Select(strided::NegativeEven16(d + i), along, across);
+                return fixed16::HalfDiff(strided::LoadEven16(r + i), lp);
+            };
+#endif
+
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin;
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kStep16 <= end; y += strided::kStep16) {
+                        size_t i = row_pos + y;
+                        bool rb_first = (y & 1) == pf;
+                        __m128i even = rb_first ? on_rb(i) : on_green(i);
+                        __m128i odd  = rb_first ? on_green(i + 1) : on_rb(i + 1);
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_unpacklo_epi16(even, odd));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i + 8), _mm_unpackhi_epi16(even, odd));
+                    }
+                }
+#endif
+                for (; y < end; ++y) {
+                    size_t i = row_pos + y;
+                    int v = r[i] >> 1;
+                    if ((y & 1) == pf) {
+                        int lp;
+                        // check if delta_H < delta_V => use H
+                        if (d[i] < 0) {
+                            lp = fixed16::Avg(border::Get<kInside, uint16_t>(color, x, y-1),
+                                              border::Get<kInside, uint16_t>(color, x, y+1));
+                        } else {
+                            lp = fixed16::Avg(border::Get<kInside, uint16_t>(color, x-1, y),
+                                              border::Get<kInside, uint16_t>(color, x+1, y));
+                        }
+                        v = fixed16::HalfDiff(r[i], lp);
+                    }
+                    data[i] = static_cast<int16_t>(v);
+                }
+            });
+        }
+    }
+
+#if defined(SIMD)
+    BitmapVH FilterVH16WithSIMD(const Bitmap& cfa) {
+        BitmapVH lp = BitmapVH::Create(cfa.Height(), cfa.Width(), sizeof(uint16_t));
+        FilterVH16Region(cfa, lp, Region::Rows(0, cfa.Height(), cfa.Width()));
+        return lp;
+    }
+
+    Bitmap HighpassG16WithSIMD(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+        Bitmap hp(green.Height(), green.Width(), sizeof(int16_t));
+        HighpassG16Region(lpVH, green, diff, hp, Region::Rows(0, green.Height(), green.Width()));
+        return hp;
+    }
+
+    Bitmap HighpassRonR16WithSIMD(const BitmapVH& rb, const Bitmap& diff) {
+        Bitmap hp(diff.Height(), diff.Width(), sizeof(int16_t));
+        HighpassRonR16Region(rb, diff, hp, Region::Rows(0, diff.Height(), diff.Width()));
+        return hp;
+    }
+#endif
+
+    BitmapVH FilterVH16(const Bitmap& cfa) {
+#if defined(SIMD)
+        return FilterVH16WithSIMD(cfa);
+#else
+        return FilterVH16Simple(cfa);
+#endif
+    }
+
+    Bitmap HighpassG16(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+#if defined(SIMD)
+        return HighpassG16WithSIMD(lpVH, green, diff);
+#else
+        return HighpassG16Simple(lpVH, green, diff);
+#endif
+    }
+
+    Bitmap HighpassRonR16(const BitmapVH& rb, const Bitmap& diff) {
+#if defined(SIMD)
+        return HighpassRonR16WithSIMD(rb, diff);
+#else
+        return HighpassRonR16Simple(rb, diff);
+#endif
+    }
+
+//////////////////////////////////////////////////////////////////////////////////
+// Async run:
+
+    std::future<BitmapVH> GetLowpassFilterVH16Async(const Bitmap& cfa) {
+        std::promise<BitmapVH> result;
+        auto future = result.get_future();
+#if defined(PARALLEL)
+        std::thread lowpass([&cfa, p{std::move(result)}]() mutable {
+            p.set_value(FilterVH16(cfa));
+        });
+        lowpass.detach();
+#else
+        result.set_value(FilterVH16(cfa));
+#endif
+        return future;
+    }
+
+    std::future<Bitmap> GetHighpassFilterG16Async(const BitmapVH& lpVH, const Bitmap& green, const Bitmap& diff) {
+        std::promise<Bitmap> result;
+        auto future = result.get_future();
+#if defined(PARALLEL)
+        std::thread highpass([&, p{std::move(result)}]() mutable {
+            p.set_value(HighpassG16(lpVH, green, diff));
+        });
+        highpass.detach();
+#else
+        result.set_value(HighpassG16(lpVH, green, diff));
+#endif
+        return future;
+    }
+
+    std::future<Bitmap> GetHighpassFilterRonR16Async(const BitmapVH& rb, const Bitmap& diff) {
+        std::promise<Bitmap> result;
+        auto future = result.get_future();
+#if defined(PARALLEL)
+        std::thread highpass([&, p{std::move(result)}]() mutable {
+            p.set_value(HighpassRonR16(rb, diff));
+        });
+        highpass.detach();
+#else
+        result.set_value(HighpassRonR16(rb, diff));
+#endif
+        return future;
+    }
+} // namespace lp
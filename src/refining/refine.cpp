@@ -2,12 +2,17 @@
 #include <thread>
 #include "../support/bitmap.hpp"
 #include "../support/bitmap_arithmetics.hpp"
+#include "../support/border.hpp"
 #include "../support/pf.hpp"
+#include "../support/strided.hpp"
+#include "refine.hpp"
 
 namespace refine {
 
+    // Variants are declared in the header
+
     // odd = 0 for red and 1 for blue
-    void RefineConG(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd) {
+    void RefineConGSimple(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd) {
         size_t h = c.Height();
         size_t w = c.Width();
         auto c32 = CopyCast32(c);
@@ -26,6 +31,46 @@ namespace refine {
         }
     }
 
+#if defined(SIMD)
+    // 2 * C is taken in the loop instead of a 32-bit copy of C
+    void RefineConGWithSIMD(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd) {
+        size_t h = c.Height();
+        size_t w = c.Width();
+        auto data = reinterpret_cast<uint16_t*>(c.Data());
+        auto hp = reinterpret_cast<const int*>(hpG.Data());
+
+        for (size_t x = 0; x < h; ++x) {
+            SIZE_T_PF(x)
+            bool is_c_row = (x & 1) == odd;
+            auto lp = reinterpret_cast<const int*>((is_c_row ? lpVH.H : lpVH.V).Data());
+            size_t row_pos = x * w;
+            size_t y = 1 - pf;
+            for (; y + strided::kLast < w; y += strided::kStep) {
+                size_t i = row_pos + y;
+                __m128i v = strided::LoadU16(data + i);
+                __m128i hpC = _mm_sub_epi32(_mm_add_epi32(v, v), strided::LoadI32(lp + i));
+                __m128i delta = strided::Div3(_mm_sub_epi32(strided::LoadI32(hp + i), hpC));
+                strided::StoreU16(data + i, _mm_add_epi32(v, delta));
+            }
+            for (; y < w; y += 2) {
+                size_t i = row_pos + y;
+                int v = data[i];
+                int hpC = 2 * v - lp[i];
+                int normalized = v + (hp[i] - hpC) / 3;
+                data[i] = static_cast<uint16_t>(std::min(std::max(normalized, 0), UINT16_MAX));
+            }
+        }
+    }
+#endif
+
+    void RefineConG(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd) {
+#if defined(SIMD)
+        RefineConGWithSIMD(c, lpVH, hpG, odd);
+#else
+        RefineConGSimple(c, lpVH, hpG, odd);
+#endif
+    }
+
     // Refines red and blue colors ONLY FOR GREEN PIXELS
     void RefineRBonG(BitmapVH& rb, const BitmapVH& lpVH, const Bitmap& hpG) {
 #if defined(PARALLEL)
@@ -39,7 +84,7 @@ namespace refine {
 #endif
     }
 
-    void RefineGonRB(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+    void RefineGonRBSimple(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
         for (size_t x = 0; x < green.Height(); ++x) {
             SIZE_T_PF(x);
             for (size_t y = pf; y < green.Width(); y += 2) {
@@ -51,28 +96,131 @@ namespace refine {
         }
     }
 
-    void RefineRBonRB(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+    void RefineRBonRBSimple(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
         size_t h = rb.V.Height();
         size_t w = rb.V.Width();
         for (size_t x = 0; x < h; ++x) {
             SIZE_T_PF(x);
             bool is_red_row = (~x) & 1;
             Bitmap& c = (is_red_row ? rb.H : rb.V);
-            for (size_t y = pf; y < w; y += 2) {
-                int v = c.Get<uint16_t>(x, y);
-                int his_hp = v << 1;
-                int my_hp  = hpRR.Get<int>(x, y);
-                if (diff.Get<int>(x, y) < 0) {
-                    his_hp -= c.GetSafe<uint16_t>(x, y-1);
-                    his_hp -= c.GetSafe<uint16_t>(x, y+1);
-                } else {
-                    his_hp -= c.GetSafe<uint16_t>(x-1, y);
-                    his_hp -= c.GetSafe<uint16_t>(x+1, y);
+            // Bounds are checked only near the border
+            border::ForEachRowPart(x, 0, w, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                for (size_t y = begin + ((begin & 1) != pf); y < end; y += 2) {
+                    int v = c.Get<uint16_t>(x, y);
+                    int his_hp = v << 1;
+                    int my_hp  = hpRR.Get<int>(x, y);
+                    if (diff.Get<int>(x, y) < 0) {
+                        his_hp -= border::Get<kInside, uint16_t>(c, x, y-1);
+                        his_hp -= border::Get<kInside, uint16_t>(c, x, y+1);
+                    } else {
+                        his_hp -= border::Get<kInside, uint16_t>(c, x-1, y);
+                        his_hp -= border::Get<kInside, uint16_t>(c, x+1, y);
+                    }
+                    v += (my_hp - his_hp) / 3;
+                    uint16_t new_c = std::min(std::max(v, 0), UINT16_MAX);
+                    c.Set(x, y, new_c);
                 }
-                v += (my_hp - his_hp) / 3;
-                uint16_t new_c = std::min(std::max(v, 0), UINT16_MAX);
-                c.Set(x, y, new_c);
+            });
+        }
+    }
+
+    void RefineGonRBRegion(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR, const Region& region) {
+        size_t w = green.Width();
+        auto g = reinterpret_cast<uint16_t*>(green.Data());
+        auto hp_g = reinterpret_cast<const int*>(hpG.Data());
+        auto hp_rr = reinterpret_cast<const int*>(hpRR.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x);
+            size_t row_pos = x * w;
+            size_t y = region.y_begin + ((region.y_begin & 1) != pf);
+#if defined(SIMD)
+            for (; y + strided::kLast < region.y_end; y += strided::kStep) {
+                size_t i = row_pos + y;
+                __m128i delta = strided::Div3(_mm_sub_epi32(strided::LoadI32(hp_rr + i), strided::LoadI32(hp_g + i)));
+                strided::StoreU16(g + i, _mm_add_epi32(strided::LoadU16(g + i), delta));
+            }
+#endif
+            for (; y < region.y_end; y += 2) {
+                size_t i = row_pos + y;
+                int v = g[i] + (hp_rr[i] - hp_g[i]) / 3;
+                g[i] = static_cast<uint16_t>(std::min(std::max(v, 0), UINT16_MAX));
             }
         }
     }
+
+    void RefineRBonRBRegion(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff, const Region& region) {
+        size_t h = rb.V.Height();
+        size_t w = rb.V.Width();
+        auto hp = reinterpret_cast<const int*>(hpRR.Data());
+        auto d = reinterpret_cast<const int*>(diff.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x);
+            bool is_red_row = (~x) & 1;
+            Bitmap& c = (is_red_row ? rb.H : rb.V);
+            auto data = reinterpret_cast<uint16_t*>(c.Data());
+            size_t row_pos = x * w;
+            // Vector part on the interior, the rest as RefineRBonRBSimple does it
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin + ((begin & 1) != pf);
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kLast < end; y += strided::kStep) {
+                        size_t i = row_pos + y;
+                        __m128i v = strided::LoadU16(data + i);
+                        __m128i along  = _mm_add_epi32(strided::LoadU16(data + i - 1), strided::LoadU16(data + i + 1));
+                        __m128i across = _mm_add_epi32(strided::LoadU16(data + i - w), strided::LoadU16(data + i + w));
+                        __m128i his_hp = _mm_sub_epi32(_mm_add_epi32(v, v),
+                                                       strided::SelectNegative(strided::LoadI32(d + i), along, across));
+                        __m128i delta = strided::Div3(_mm_sub_epi32(strided::LoadI32(hp + i), his_hp));
+                        strided::StoreU16(data + i, _mm_add_epi32(v, delta));
+                    }
+                }
+#endif
+                for (; y < end; y += 2) {
+                    size_t i = row_pos + y;
+                    int v = data[i];
+                    int his_hp = v << 1;
+                    if (d[i] < 0) {
+                        his_hp -= border::Get<kInside, uint16_t>(c, x, y-1);
+                        his_hp -= border::Get<kInside, uint16_t>(c, x, y+1);
+                    } else {
+                        his_hp -= border::Get<kInside, uint16_t>(c, x-1, y);
+                        his_hp -= border::Get<kInside, uint16_t>(c, x+1, y);
+                    }
+                    v += (hp[i] - his_hp) / 3;
+                    data[i] = static_cast<uint16_t>(std::min(std::max(v, 0), UINT16_MAX));
+                }
+            });
+        }
+    }
+
+#if defined(SIMD)
+    void RefineGonRBWithSIMD(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+        RefineGonRBRegion(green, hpG, hpRR, Region::Rows(0, green.Height(), green.Width()));
+    }
+
+    void RefineRBonRBWithSIMD(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+        RefineRBonRBRegion(rb, hpRR, diff, Region::Rows(0, diff.Height(), diff.Width()));
+    }
+#endif
+
+    void RefineGonRB(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+#if defined(SIMD)
+        RefineGonRBWithSIMD(green, hpG, hpRR);
+#else
+        RefineGonRBSimple(green, hpG, hpRR);
+#endif
+    }
+
+    void RefineRBonRB(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+#if defined(SIMD)
+        RefineRBonRBWithSIMD(rb, hpRR, diff);
+#else
+        RefineRBonRBSimple(rb, hpRR, diff);
+#endif
+    }
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "../support/bitmap.hpp"
+#include "../support/region.hpp"
 
 namespace refine {
 
@@ -11,4 +12,35 @@ namespace refine {
 
     // Refines r/b color ONLY FOR R/B PIXELS
     void RefineRBonRB(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+
+    // Region variants. Change only pixels of the region,
+    // so they are safe to call concurrently for disjoint regions
+    void RefineGonRBRegion(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR, const Region& region);
+    void RefineRBonRBRegion(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff, const Region& region);
+
+    // Operation variants. Operations above choose one of them by define SIMD.
+    // All variants of an operation must give the same result (see check/differential.hpp)
+    // odd = 0 for red and 1 for blue
+    void RefineConGSimple(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd);
+    void RefineGonRBSimple(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR);
+    void RefineRBonRBSimple(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+#if defined(SIMD)
+    void RefineConGWithSIMD(Bitmap& c, const BitmapVH& lpVH, const Bitmap& hpG, int odd);
+    void RefineGonRBWithSIMD(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR);
+    void RefineRBonRBWithSIMD(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+#endif
+
+    // 16-bit buffers (define REFINE16, see fixed16.hpp):
+    // hpG, hpRR - Bitmap<int16_t> of lp::HighpassG16 and lp::HighpassRonR16.
+    // Results differ from the 32-bit refining by at most fixed16::kMaxError
+    void RefineGonRB16(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR);
+    void RefineRBonRB16(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+    void RefineGonRB16Region(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR, const Region& region);
+    void RefineRBonRB16Region(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff, const Region& region);
+    void RefineGonRB16Simple(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR);
+    void RefineRBonRB16Simple(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+#if defined(SIMD)
+    void RefineGonRB16WithSIMD(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR);
+    void RefineRBonRB16WithSIMD(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff);
+#endif
 }
@@ -0,0 +1,135 @@
+#include "../support/border.hpp"
+#include "../support/pf.hpp"
+#include "../support/strided.hpp"
+#include "fixed16.hpp"
+#include "refine.hpp"
+
+// 16-bit buffers of the refining, arithmetics in fixed16.hpp
+namespace refine {
+
+    void RefineGonRB16Simple(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+        for (size_t x = 0; x < green.Height(); ++x) {
+            SIZE_T_PF(x);
+            for (size_t y = pf; y < green.Width(); y += 2) {
+                green.Set(x, y, fixed16::Correct(green.Get<uint16_t>(x, y),
+                                                 hpRR.Get<int16_t>(x, y), hpG.Get<int16_t>(x, y)));
+            }
+        }
+    }
+
+    void RefineRBonRB16Simple(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+        size_t h = rb.V.Height();
+        size_t w = rb.V.Width();
+        for (size_t x = 0; x < h; ++x) {
+            SIZE_T_PF(x);
+            bool is_red_row = (~x) & 1;
+            Bitmap& c = (is_red_row ? rb.H : rb.V);
+            for (size_t y = pf; y < w; y += 2) {
+                int v = c.Get<uint16_t>(x, y);
+                int lp;
+                if (diff.Get<int>(x, y) < 0) {
+                    lp = fixed16::Avg(c.GetSafe<uint16_t>(x, y-1), c.GetSafe<uint16_t>(x, y+1));
+                } else {
+                    lp = fixed16::Avg(c.GetSafe<uint16_t>(x-1, y), c.GetSafe<uint16_t>(x+1, y));
+                }
+                c.Set(x, y, fixed16::Correct(v, hpRR.Get<int16_t>(x, y), fixed16::HalfDiff(v, lp)));
+            }
+        }
+    }
+
+    void RefineGonRB16Region(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR, const Region& region) {
+        size_t w = green.Width();
+        auto g = reinterpret_cast<uint16_t*>(green.Data());
+        auto hp_g = reinterpret_cast<const int16_t*>(hpG.Data());
+        auto hp_rr = reinterpret_cast<const int16_t*>(hpRR.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x);
+            size_t row_pos = x * w;
+            size_t y = region.y_begin + ((region.y_begin & 1) != pf);
+#if defined(SIMD)
+            for (; y + strided::kLast16 < region.y_end; y += strided::kStep16) {
+                size_t i = row_pos + y;
+                __m128i v = fixed16::Correct(strided::LoadEven16(g + i),
+                                             strided::LoadEven16(hp_rr + i), strided::LoadEven16(hp_g + i));
+                strided::StoreEven16(g + i, v);
+            }
+#endif
+            for (; y < region.y_end; y += 2) {
+                size_t i = row_pos + y;
+                g[i] = fixed16::Correct(g[i], hp_rr[i], hp_g[i]);
+            }
+        }
+    }
+
+    void RefineRBonRB16Region(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff, const Region& region) {
+        size_t h = rb.V.Height();
+        size_t w = rb.V.Width();
+        auto hp = reinterpret_cast<const int16_t*>(hpRR.Data());
+        auto d = reinterpret_cast<const int*>(diff.Data());
+
+        for (size_t x = region.x_begin; x < region.x_end; ++x) {
+            SIZE_T_PF(x);
+            bool is_red_row = (~x) & 1;
+            Bitmap& c = (is_red_row ? rb.H : rb.V);
+            auto data = reinterpret_cast<uint16_t*>(c.Data());
+            size_t row_pos = x * w;
+            border::ForEachRowPart(x, region.y_begin, region.y_end, h, w, [&](auto inside, size_t begin, size_t end) {
+                constexpr bool kInside = decltype(inside)::value;
+                size_t y = begin + ((begin & 1) != pf);
+#if defined(SIMD)
+                if constexpr (kInside) {
+                    for (; y + strided::kLast16 < end; y += strided::kStep16) {
+                        size_t i = row_pos + y;
+                        __m128i v = strided::LoadEven16(data + i);
+                        __m128i along  = _mm_avg_epu16(strided::LoadEven16(data + i - 1), strided::LoadEven16(data + i + 1));
+                        __m128i across = _mm_avg_epu16(strided::LoadEven16(data + i - w), strided::LoadEven16(data + i + w));
+                        __m128i lp = fixed16::Select(strided::NegativeEven16(d + i), along, across);
+                        __m128i his_hp = fixed16::HalfDiff(v, lp);
+                        strided::StoreEven16(data + i, fixed16::Correct(v, strided::LoadEven16(hp + i), his_hp));
+                    }
+                }
+#endif
+                for (; y < end; y += 2) {
+                    size_t i = row_pos + y;
+                    int v = data[i];
+                    int lp;
+                    if (d[i] < 0) {
+                        lp = fixed16::Avg(border::Get<kInside, uint16_t>(c, x, y-1),
+                                          border::Get<kInside, uint16_t>(c, x, y+1));
+                    } else {
+                        lp = fixed16::Avg(border::Get<kInside, uint16_t>(c, x-1, y),
+                                          border::Get<kInside, uint16_t>(c, x+1, y));
+                    }
+                    data[i] = fixed16::Correct(v, hp[i], fixed16::HalfDiff(v, lp));
+                }
+            });
+        }
+    }
+
+#if defined(SIMD)
+    void RefineGonRB16WithSIMD(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+        RefineGonRB16Region(green, hpG, hpRR, Region::Rows(0, green.Height(), green.Width()));
+    }
+
+    void RefineRBonRB16WithSIMD(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+        RefineRBonRB16Region(rb, hpRR, diff, Region::Rows(0, diff.Height(), diff.Width()));
+    }
+#endif
+
+    void RefineGonRB16(Bitmap& green, const Bitmap& hpG, const Bitmap& hpRR) {
+#if defined(SIMD)
+        RefineGonRB16WithSIMD(green, hpG, hpRR);
+#else
+        RefineGonRB16Simple(green, hpG, hpRR);
+#endif
+    }
+
+    void RefineRBonRB16(BitmapVH& rb, const Bitmap& hpRR, const Bitmap& diff) {
+#if defined(SIMD)
+        RefineRBonRB16WithSIMD(rb, hpRR, diff);
+#else
+        RefineRBonRB16Simple(rb, hpRR, diff);
+#endif
+    }
+} // namespace refine
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "daemon.hpp"
+#include "pattern.hpp"
+#include "socket_io.hpp"
+#include "../io/format/mapped.hpp"
+#include "../support/allocator.hpp"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace service {
+
+    static bool ReplyError(int fd, Status status, const std::string& message) {
+        ResponseHeader header{kResponseMagic, status, 0, 0, message.size()};
+        return WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, message.data(), message.size());
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Requests:
+
+    // Reads the mosaic of a FRAME or PATH request, 'consumed' is set when
+    // the payload is read
+    // Returns false and sets 'error' if the request is wrong
+    static bool ReadMosaic(int fd, const RequestHeader& request, uint64_t max_frame_bytes,
+                           Bitmap& mosaic, std::string& error, bool& consumed) {
+        if (request.kind == FRAME) {
+            uint64_t bytes = uint64_t{request.height} * request.width * sizeof(uint16_t);
+            if (request.height == 0 || request.width == 0 || request.payload != bytes) {
+                error = "Frame size does not match its dimensions";
+                return false;
+            }
+            if (bytes > max_frame_bytes) {
+                error = "Frame exceeds " + std::to_string(max_frame_bytes) + " bytes";
+                return false;
+            }
+            mosaic = Bitmap(request.height, request.width, sizeof(uint16_t));
+            if (!ReadAll(fd, mosaic.Data(), bytes)) {
+                error = "Connection closed";
+                return false;
+            }
+            consumed = true;
+            return true;
+        }
+
+        if (request.payload == 0 || request.payload >= PATH_MAX) {
+            error = "Wrong path length";
+            return false;
+        }
+        std::string path(request.payload, '\0');
+        if (!ReadAll(fd, path.data(), path.size())) {
+            error = "Connection closed";
+            return false;
+        }
+        consumed = true;
+        mosaic = io::MapBitmapFromTIFF(path.c_str());
+        if (mosaic.BytesPerPixel() != sizeof(uint16_t)) {
+            error = "Only 16-bit mosaics are supported";
+            return false;
+        }
+        return true;
+    }
+
+    // Serves one request. Returns false if the connection must be closed
+    static bool Serve(int fd, const RequestHeader& request, const Demosaic& demosaic,
+                      uint64_t max_frame_bytes, std::vector<uint16_t>& packed, std::ostream& log) {
+        if (request.pattern > PATTERN_BGGR || request.reply > SHARED_MEMORY) {
+            ReplyError(fd, BAD_REQUEST, "Unknown pattern or reply");
+            return false;
+        }
+
+        Bitmap mosaic;
+        std::string error;
+        bool consumed = false;
+        try {
+            if (!ReadMosaic(fd, request, max_frame_bytes, mosaic, error, consumed)) {
+                // A wrong file after its path is read keeps the connection in sync
+                return ReplyError(fd, BAD_REQUEST, error) && consumed;
+            }
+        }
+        catch (const std::exception& e) {
+            // The connection is in sync only if the payload is read
+            // (not if the allocation of the mosaic failed)
+            return ReplyError(fd, FAILED, e.what()) && consumed;
+        }
+
+        size_t h = mosaic.Height();
+        size_t w = mosaic.Width();
+        auto mirrors = MirrorsToNative(static_cast<Pattern>(request.pattern));
+        if (!CanMirror(h, w, mirrors)) {
+            return ReplyError(fd, BAD_REQUEST, "The pattern needs an even size along the mirror");
+        }
+
+        rgb::BitmapRGB image;
+        try {
+            MirrorBitmap(mosaic, mirrors);
+            image = demosaic(mosaic);
+            MirrorBitmap(image.R, mirrors);
+            MirrorBitmap(image.G, mirrors);
+            MirrorBitmap(image.B, mirrors);
+        }
+        catch (const std::exception& e) {
+            return ReplyError(fd, FAILED, e.what());
+        }
+
+        size_t bytes = h * w * 3 * sizeof(uint16_t);
+        log << "Served " << h << " x " << w << (request.reply == INLINE ? " inline\n" : " in shared memory\n");
+
+        if (request.reply == INLINE) {
+            packed.resize(h * w * 3);
+            rgb::PackRGB(image.R, image.G, image.B, packed.data());
+            ResponseHeader header{kResponseMagic, OK, static_cast<uint32_t>(h), static_cast<uint32_t>(w), bytes};
+            return WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, packed.data(), bytes);
+        }
+
+        int memory = memfd_create("menon-rgb", MFD_CLOEXEC);
+        if (memory < 0 || ftruncate(memory, static_cast<off_t>(bytes)) != 0) {
+            if (memory >= 0) {
+                close(memory);
+            }
+            return ReplyError(fd, FAILED, std::string("Shared memory failed: ") + std::strerror(errno));
+        }
+        void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+        if (mapped == MAP_FAILED) {
+            close(memory);
+            return ReplyError(fd, FAILED, std::string("Shared memory failed: ") + std::strerror(errno));
+        }
+        rgb::PackRGB(image.R, image.G, image.B, static_cast<uint16_t*>(mapped));
+        munmap(mapped, bytes);
+
+        ResponseHeader header{kResponseMagic, OK, static_cast<uint32_t>(h), static_cast<uint32_t>(w), 0};
+        bool sent = WriteAll(fd, &header, sizeof(header), memory);
+        close(memory);
+        return sent;
+    }
+
+    bool ServeConnection(int fd, const Demosaic& demosaic, std::ostream& log, uint64_t max_frame_bytes) {
+        // Packed RGB of inline replies, kept between requests
+        std::vector<uint16_t> packed;
+        RequestHeader request;
+        while (ReadAll(fd, &request, sizeof(request))) {
+            if (request.magic != kRequestMagic) {
+                ReplyError(fd, BAD_REQUEST, "Wrong magic");
+                return true;
+            }
+            if (request.kind == SHUTDOWN) {
+                ResponseHeader header{kResponseMagic, OK, 0, 0, 0};
+                WriteAll(fd, &header, sizeof(header));
+                return false;
+            }
+            if (request.kind != FRAME && request.kind != PATH) {
+                ReplyError(fd, BAD_REQUEST, "Unknown request");
+                return true;
+            }
+            if (!Serve(fd, request, demosaic, max_frame_bytes, packed, log)) {
+                return true;
+            }
+        }
+        return true;
+    }
+
+    void RunDaemon(const char* socket_path, const Demosaic& demosaic, std::ostream& log, size_t warm_bytes,
+                   uint64_t max_frame_bytes) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (std::strlen(socket_path) >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path is too long");
+        }
+        std::strcpy(address.sun_path, socket_path);
+
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+            throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+        }
+        unlink(socket_path);
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, 16) != 0) {
+            std::string reason = std::strerror(errno);
+            close(listener);
+            throw std::runtime_error("Cannot listen on " + std::string(socket_path) + ": " + reason);
+        }
+
+        // Keep the pages of released bitmaps for the next requests
+        mem::BlockCache cache(warm_bytes);
+        auto previous = mem::CurrentAllocator();
+        mem::SetAllocator(cache.AsAllocator());
+
+        log << "Listening on " << socket_path << '\n';
+        bool running = true;
+        while (running) {
+            int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                break;
+            }
+            running = ServeConnection(connection, demosaic, log, max_frame_bytes);
+            close(connection);
+        }
+
+        mem::SetAllocator(previous);
+        close(listener);
+        unlink(socket_path);
+        log << "Daemon stopped\n";
+    }
+} // namespace service
@@ -0,0 +1,42 @@
+#pragma once
+#include <functional>
+#include <ostream>
+#include "protocol.hpp"
+#include "../support/bitmap.hpp"
+#include "../support/rgb.hpp"
+
+namespace service {
+
+    // Demosaicing of a mosaic with the native pattern (menon::Demosaicing)
+    using Demosaic = std::function<rgb::BitmapRGB(const Bitmap&)>;
+
+    // Bitmaps of released images kept for the next requests by default
+    constexpr size_t kWarmBufferBytes = size_t{2} << 30;
+
+    // Largest FRAME payload served by default (512 megapixels): the mosaic is
+    // allocated by the header before its payload arrives
+    constexpr uint64_t kMaxFrameBytes = uint64_t{1} << 30;
+
+    // Long-lived daemon: listens on the Unix domain socket 'socket_path'
+    // and serves requests of service/protocol.hpp until SHUTDOWN.
+    // Connections are served one after another, requests of a connection in order.
+    //
+    // Other patterns are mirrored to the native one and the result back
+    // (the dimension along the mirror must be even).
+    // Released bitmaps are kept up to 'warm_bytes' (mem::BlockCache), so images
+    // of a repeated size do not map and fault in new pages.
+    //
+    // Frames larger than 'max_frame_bytes' and paths longer than PATH_MAX are
+    // rejected before anything is allocated.
+    //
+    // Exception if the socket cannot be created. Failed requests are replied
+    // with an error status and do not stop the daemon. A connection is closed
+    // after a reply if the payload of the request was not read
+    void RunDaemon(const char* socket_path, const Demosaic& demosaic, std::ostream& log,
+                   size_t warm_bytes = kWarmBufferBytes, uint64_t max_frame_bytes = kMaxFrameBytes);
+
+    // Serves requests of one connected socket in order until the peer closes it
+    // (workers of service/shard.hpp). Returns false after SHUTDOWN
+    bool ServeConnection(int fd, const Demosaic& demosaic, std::ostream& log,
+                         uint64_t max_frame_bytes = kMaxFrameBytes);
+} // namespace service
@@ -0,0 +1,52 @@
+#pragma once
+#include <algorithm>
+#include "protocol.hpp"
+#include "../support/bitmap.hpp"
+
+// Mosaics of any Bayer pattern for the pipeline built for one (define RGGB)
+namespace service {
+
+    // The pattern the pipeline is built for (define RGGB in /CMakeLists.txt)
+    inline Pattern NativePattern() {
+#if defined(RGGB)
+        return PATTERN_RGGB;
+#else
+        return PATTERN_GRBG;
+#endif
+    }
+
+    // Mirrors of the image turning a pattern to the native one
+    struct Mirrors {
+        bool rows;    // upside down
+        bool columns; // left to right
+    };
+
+    inline Mirrors MirrorsToNative(Pattern pattern) {
+        // Mirroring the columns swaps the pixels of every row of the 2x2 block,
+        // mirroring the rows swaps the rows of the block
+        auto bits = static_cast<uint32_t>(pattern) ^ static_cast<uint32_t>(NativePattern());
+        return Mirrors{(bits & 2) != 0, (bits & 1) != 0};
+    }
+
+    // Mirroring changes the pattern only along an even dimension
+    inline bool CanMirror(size_t height, size_t width, const Mirrors& mirrors) {
+        return (!mirrors.rows || height % 2 == 0) && (!mirrors.columns || width % 2 == 0);
+    }
+
+    // Mirrors a 16-bit bitmap in place
+    inline void MirrorBitmap(Bitmap& b, const Mirrors& mirrors) {
+        size_t h = b.Height();
+        size_t w = b.Width();
+        auto data = reinterpret_cast<uint16_t*>(b.Data());
+        if (mirrors.columns) {
+            for (size_t x = 0; x < h; ++x) {
+                std::reverse(data + x * w, data + (x + 1) * w);
+            }
+        }
+        if (mirrors.rows) {
+            for (size_t x = 0; x < h / 2; ++x) {
+                std::swap_ranges(data + x * w, data + (x + 1) * w, data + (h - 1 - x) * w);
+            }
+        }
+    }
+} // namespace service
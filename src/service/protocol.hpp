@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+
+// Protocol of the daemon mode (see service/daemon.hpp)
+//
+// A client connects to the Unix domain socket and sends requests one after another
+// over the connection. Every request is a RequestHeader followed by 'payload' bytes:
+//  - FRAME: height x width 16-bit CFA samples in the host byte order
+//  - PATH:  path of a one-sampled 16-bit TIFF (not null-terminated),
+//           height and width are ignored
+//  - SHUTDOWN: no payload, the daemon stops after the reply
+//
+// The reply is a ResponseHeader followed by 'payload' bytes:
+//  - status OK, INLINE:        height x width x 3 16-bit samples (RGBRGB...)
+//  - status OK, SHARED_MEMORY: no payload, the RGB samples are in a memfd passed
+//                              with the header as SCM_RIGHTS ancillary data
+//                              (the client maps it and closes the descriptor)
+//  - other status:             error message (not null-terminated)
+namespace service {
+
+    constexpr uint32_t kRequestMagic  = 0x51524E4D; // "MNRQ"
+    constexpr uint32_t kResponseMagic = 0x53524E4D; // "MNRS"
+
+    enum RequestKind : uint32_t {
+        FRAME    = 1,
+        PATH     = 2,
+        SHUTDOWN = 3,
+    };
+
+    // Order of the top-left 2x2 block of the mosaic
+    // (not RGGB and so on: RGGB is the define of the native pattern)
+    enum Pattern : uint32_t {
+        PATTERN_RGGB = 0,
+        PATTERN_GRBG = 1,
+        PATTERN_GBRG = 2,
+        PATTERN_BGGR = 3,
+    };
+
+    enum Reply : uint32_t {
+        INLINE        = 0,
+        SHARED_MEMORY = 1,
+    };
+
+    enum Status : uint32_t {
+        OK          = 0,
+        BAD_REQUEST = 1,
+        FAILED      = 2,
+    };
+
+    struct RequestHeader {
+        uint32_t magic;
+        uint32_t kind;    // RequestKind
+        uint32_t height;
+        uint32_t width;
+        uint32_t pattern; // Pattern
+        uint32_t reply;   // Reply
+        uint64_t payload; // bytes after the header
+    };
+
+    struct ResponseHeader {
+        uint32_t magic;
+        uint32_t status;  // Status
+        uint32_t height;
+        uint32_t width;
+        uint64_t payload; // bytes after the header
+    };
+} // namespace service
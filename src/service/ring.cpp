@@ -0,0 +1,242 @@
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "ring.hpp"
+#include "pattern.hpp"
+#include "../support/bitmap.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace service {
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring needs lock-free 64-bit atomics");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "The ring needs lock-free 32-bit atomics");
+
+    constexpr size_t kPage = 4096;
+
+    static size_t RoundUp(size_t bytes) {
+        return (bytes + kPage - 1) / kPage * kPage;
+    }
+
+    // Busy waits first: the other process usually answers within microseconds
+    class Backoff {
+    public:
+        void Wait() {
+            ++spins_;
+            if (spins_ < kSpins) {
+                return;
+            }
+            if (spins_ < kSpins + kYields) {
+                std::this_thread::yield();
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+    private:
+        static constexpr size_t kSpins = 4096;
+        static constexpr size_t kYields = 256;
+        size_t spins_{0};
+    };
+
+    static std::runtime_error Error(const std::string& what, const char* name) {
+        return std::runtime_error(what + " " + name + ": " + std::strerror(errno));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Region:
+
+    FrameRing::FrameRing(uint8_t* base, size_t size)
+            : base_{base}, size_{size}, header_{reinterpret_cast<RingHeader*>(base)} {
+    }
+
+    FrameRing::FrameRing(FrameRing&& other) noexcept
+            : base_{other.base_}, size_{other.size_}, header_{other.header_} {
+        other.base_ = nullptr;
+        other.header_ = nullptr;
+    }
+
+    FrameRing::~FrameRing() {
+        if (base_ != nullptr) {
+            munmap(base_, size_);
+        }
+    }
+
+    FrameRing FrameRing::Create(const char* name, size_t slots, size_t slot_bytes) {
+        if (slots == 0) {
+            throw std::invalid_argument("Ring must have slots");
+        }
+        size_t stride = kPage + RoundUp(slot_bytes + Bitmap::DATA_SAFE_OFFSET);
+        size_t size = RoundUp(sizeof(RingHeader)) + slots * stride;
+
+        shm_unlink(name);
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            throw Error("Cannot create ring", name);
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            close(fd);
+            shm_unlink(name);
+            throw Error("Cannot resize ring", name);
+        }
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            shm_unlink(name);
+            throw Error("Cannot map ring", name);
+        }
+
+        // The region is zeroed by ftruncate
+        auto header = new (base) RingHeader;
+        header->slots = static_cast<uint32_t>(slots);
+        header->slot_bytes = slot_bytes;
+        header->slot_stride = stride;
+        header->closed.store(0, std::memory_order_relaxed);
+        header->head.store(0, std::memory_order_relaxed);
+        header->tail.store(0, std::memory_order_relaxed);
+        // The consumer checks the magic: it must be the last
+        header->magic.store(kRingMagic, std::memory_order_release);
+        return FrameRing(static_cast<uint8_t*>(base), size);
+    }
+
+    FrameRing FrameRing::Open(const char* name) {
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) {
+            throw Error("Cannot open ring", name);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(RingHeader)) {
+            close(fd);
+            throw std::runtime_error(std::string("Ring is not ready: ") + name);
+        }
+        auto size = static_cast<size_t>(info.st_size);
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw Error("Cannot map ring", name);
+        }
+
+        FrameRing ring(static_cast<uint8_t*>(base), size);
+        const auto* header = ring.header_;
+        // Pairs with the store of Create: the other fields are read after it
+        if (header->magic.load(std::memory_order_acquire) != kRingMagic
+            || RoundUp(sizeof(RingHeader)) + header->slots * header->slot_stride > size) {
+            throw std::runtime_error(std::string("Ring is broken or not ready: ") + name);
+        }
+        return ring;
+    }
+
+    void FrameRing::Remove(const char* name) {
+        shm_unlink(name);
+    }
+
+    FrameSlot FrameRing::Slot(uint64_t index) const {
+        uint8_t* slot = base_ + RoundUp(sizeof(RingHeader)) + (index % header_->slots) * header_->slot_stride;
+        return FrameSlot{reinterpret_cast<SlotHeader*>(slot), slot + kPage, header_->slot_bytes};
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Producer:
+
+    FrameSlot FrameRing::Acquire() {
+        // Only the producer writes head
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        if (head - header_->tail.load(std::memory_order_acquire) >= header_->slots) {
+            return FrameSlot{nullptr, nullptr, 0};
+        }
+        return Slot(head);
+    }
+
+    FrameSlot FrameRing::WaitAcquire() {
+        Backoff backoff;
+        FrameSlot slot;
+        while (!(slot = Acquire())) {
+            backoff.Wait();
+        }
+        return slot;
+    }
+
+    void FrameRing::Publish() {
+        header_->head.fetch_add(1, std::memory_order_release);
+    }
+
+    void FrameRing::Close() {
+        header_->closed.store(1, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Consumer:
+
+    FrameSlot FrameRing::Peek() {
+        // Only the consumer writes tail
+        uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        if (tail == header_->head.load(std::memory_order_acquire)) {
+            return FrameSlot{nullptr, nullptr, 0};
+        }
+        return Slot(tail);
+    }
+
+    FrameSlot FrameRing::WaitPeek() {
+        Backoff backoff;
+        while (true) {
+            // Closed is checked before head: frames published before closing are not lost
+            bool closed = header_->closed.load(std::memory_order_acquire) != 0;
+            FrameSlot slot = Peek();
+            if (slot || closed) {
+                return slot;
+            }
+            backoff.Wait();
+        }
+    }
+
+    void FrameRing::Release() {
+        header_->tail.fetch_add(1, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Demosaicing:
+
+    void RunRing(const char* input, const char* output, const Demosaic& demosaic, std::ostream& log) {
+        auto in = FrameRing::Open(input);
+        auto out = FrameRing::Create(output, in.Slots(), in.SlotBytes() * 3);
+        log << "Demosaicing frames of " << input << " to " << output << '\n';
+
+        while (auto slot = in.WaitPeek()) {
+            SlotHeader frame = *slot.header;
+            size_t bytes = size_t{frame.height} * frame.width * sizeof(uint16_t);
+            auto mirrors = MirrorsToNative(static_cast<Pattern>(frame.pattern));
+            if (frame.bytes_per_pixel != sizeof(uint16_t) || frame.pattern > PATTERN_BGGR
+                || bytes == 0 || bytes > slot.capacity || !CanMirror(frame.height, frame.width, mirrors)) {
+                log << "Skipped frame " << frame.sequence << ": unsupported format\n";
+                in.Release();
+                continue;
+            }
+
+            rgb::BitmapRGB image;
+            {
+                // The frame is read in place (and mirrored in place if needed)
+                Bitmap cfa(frame.height, frame.width, sizeof(uint16_t), slot.data, [](uint8_t*) {});
+                MirrorBitmap(cfa, mirrors);
+                image = demosaic(cfa);
+            }
+            in.Release();
+            MirrorBitmap(image.R, mirrors);
+            MirrorBitmap(image.G, mirrors);
+            MirrorBitmap(image.B, mirrors);
+
+            auto result = out.WaitAcquire();
+            *result.header = SlotHeader{frame.height, frame.width, frame.pattern,
+                                        3 * sizeof(uint16_t), frame.sequence, bytes * 3};
+            rgb::PackRGB(image.R, image.G, image.B, reinterpret_cast<uint16_t*>(result.data));
+            out.Publish();
+        }
+        out.Close();
+        log << "Input ring closed\n";
+    }
+} // namespace service
@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include "daemon.hpp"
+#include "protocol.hpp"
+
+// Ring of frames in POSIX shared memory (shm_open) for one producer and one consumer
+// in different processes. Frames are written and read in place, slots are handed
+// over by lock-free head/tail indices, so the handoff takes microseconds.
+//
+// Layout of the region: RingHeader, then 'slots' slots of SlotHeader + data,
+// every slot data starts on a page and has Bitmap::DATA_SAFE_OFFSET readable bytes
+// after 'slot_bytes', so a Bitmap may wrap it without copying.
+//
+// Producer:                              Consumer:
+//      auto ring = FrameRing::Create(        auto ring = FrameRing::Open("/cfa");
+//              "/cfa", 4, bytes);            while (auto slot = ring.WaitPeek()) {
+//      auto slot = ring.WaitAcquire();           // read slot.header and slot.data
+//      // write slot.header, slot.data           ring.Release();
+//      ring.Publish();                       }
+//      ...
+//      ring.Close(); // no more frames
+namespace service {
+
+    constexpr uint32_t kRingMagic = 0x474E524D; // "MRNG"
+
+    struct RingHeader {
+        std::atomic<uint32_t> magic; // stored last (release), so the fields below are valid
+        uint32_t slots;
+        uint64_t slot_bytes;  // capacity of the slot data
+        uint64_t slot_stride; // bytes from one slot header to the next one
+        std::atomic<uint32_t> closed; // the producer will not publish any more
+        // Separate cache lines: written by different processes
+        alignas(64) std::atomic<uint64_t> head; // frames published
+        alignas(64) std::atomic<uint64_t> tail; // frames released by the consumer
+    };
+
+    struct SlotHeader {
+        uint32_t height;
+        uint32_t width;
+        uint32_t pattern;         // Pattern
+        uint32_t bytes_per_pixel;
+        uint64_t sequence;        // number of the frame given by the producer
+        uint64_t bytes;           // bytes of the data used
+    };
+
+    struct FrameSlot {
+        SlotHeader* header;
+        uint8_t* data;
+        size_t capacity; // slot_bytes
+
+        explicit operator bool() const { return data != nullptr; }
+    };
+
+    class FrameRing {
+    public:
+        // Creates (or recreates) the region 'name' ("/name" of shm_open)
+        // Exception on failure
+        static FrameRing Create(const char* name, size_t slots, size_t slot_bytes);
+
+        // Opens the region created by the other process
+        // Exception on failure
+        static FrameRing Open(const char* name);
+
+        // Removes the name of the region (mapped regions stay valid)
+        static void Remove(const char* name);
+
+        FrameRing(FrameRing&& other) noexcept;
+        FrameRing& operator=(FrameRing&&) = delete;
+        FrameRing(const FrameRing&) = delete;
+        ~FrameRing();
+
+        size_t Slots() const { return header_->slots; }
+        size_t SlotBytes() const { return header_->slot_bytes; }
+
+        // Producer: the next free slot or empty slot if the ring is full
+        FrameSlot Acquire();
+        // Producer: waits for a free slot
+        FrameSlot WaitAcquire();
+        // Producer: hands the acquired slot to the consumer
+        void Publish();
+        // Producer: no more frames, WaitPeek of the consumer returns empty slot
+        void Close();
+
+        // Consumer: the oldest published slot or empty slot if there is none
+        FrameSlot Peek();
+        // Consumer: waits for a published slot, empty slot if the ring is closed
+        FrameSlot WaitPeek();
+        // Consumer: gives the peeked slot back to the producer
+        void Release();
+
+    private:
+        FrameRing(uint8_t* base, size_t size);
+        FrameSlot Slot(uint64_t index) const;
+
+        uint8_t* base_;
+        size_t size_;
+        RingHeader* header_;
+    };
+
+    // Demosaics CFA frames of the ring 'input' in place and writes RGB frames
+    // (RGBRGB... 16-bit) to the ring 'output' created with the same number of slots,
+    // until the input is closed. Then closes the output.
+    // Patterns are handled as in RunDaemon.
+    // Exception if the rings cannot be opened or created
+    void RunRing(const char* input, const char* output, const Demosaic& demosaic, std::ostream& log);
+} // namespace service
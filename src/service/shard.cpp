@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "shard.hpp"
+#include "pattern.hpp"
+#include "protocol.hpp"
+#include "socket_io.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace service {
+
+    std::vector<Stripe> SplitStripes(size_t h, size_t rows) {
+        rows = std::max<size_t>(rows + rows % 2, 2);
+        std::vector<Stripe> stripes;
+        for (size_t begin = 0; begin < h; begin += rows) {
+            size_t end = std::min(begin + rows, h);
+            stripes.push_back(Stripe{begin, end, begin > kStripeHalo ? begin - kStripeHalo : 0,
+                                     std::min(end + kStripeHalo, h)});
+        }
+        return stripes;
+    }
+
+    size_t DefaultStripeRows(size_t h, size_t w, size_t workers) {
+        size_t rows = std::max<size_t>(kStripePixels / std::max<size_t>(w, 1), 1);
+        rows = std::min(rows, (h + workers - 1) / std::max<size_t>(workers, 1));
+        return std::max<size_t>(rows + rows % 2, 2);
+    }
+
+    // Demosaics one stripe by the worker and passes its rows to 'output'
+    // Exception on failure
+    static void DemosaicStripe(int fd, const Stripe& stripe, size_t w, const StripeSource& source,
+                               std::vector<uint16_t>& rgb, const StripeOutput& output) {
+        size_t rows = stripe.halo_end - stripe.halo_begin;
+        Bitmap mosaic = source(stripe.halo_begin, stripe.halo_end);
+        if (mosaic.Height() != rows || mosaic.Width() != w || mosaic.BytesPerPixel() != sizeof(uint16_t)) {
+            throw std::runtime_error("Stripe source returned a wrong bitmap");
+        }
+
+        uint64_t bytes = uint64_t{rows} * w * sizeof(uint16_t);
+        RequestHeader request{kRequestMagic, FRAME, static_cast<uint32_t>(rows), static_cast<uint32_t>(w),
+                              NativePattern(), INLINE, bytes};
+        if (!WriteAll(fd, &request, sizeof(request)) || !WriteAll(fd, mosaic.Data(), bytes)) {
+            throw std::runtime_error("Worker closed the connection");
+        }
+
+        ResponseHeader response;
+        if (!ReadAll(fd, &response, sizeof(response)) || response.magic != kResponseMagic) {
+            throw std::runtime_error("Worker closed the connection");
+        }
+        if (response.status != OK) {
+            std::string message(response.payload, '\0');
+            ReadAll(fd, message.data(), message.size());
+            throw std::runtime_error("Worker failed: " + message);
+        }
+        if (response.height != rows || response.width != w || response.payload != bytes * 3) {
+            throw std::runtime_error("Worker replied a wrong size");
+        }
+        rgb.resize(rows * w * 3);
+        if (!ReadAll(fd, rgb.data(), response.payload)) {
+            throw std::runtime_error("Worker closed the connection");
+        }
+        output(stripe.begin, stripe.end, rgb.data() + (stripe.begin - stripe.halo_begin) * w * 3);
+    }
+
+    void DemosaicSharded(size_t h, size_t w, const StripeSource& source, const std::vector<int>& workers,
+                         size_t stripe_rows, const StripeOutput& output) {
+        if (workers.empty()) {
+            throw std::invalid_argument("No workers");
+        }
+        if (h > UINT32_MAX || w > UINT32_MAX) {
+            throw std::invalid_argument("Image is too large for the protocol");
+        }
+        auto stripes = SplitStripes(h, stripe_rows);
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        // A thread per worker: workers take stripes as fast as they demosaic them
+        std::vector<std::thread> threads;
+        for (int fd : workers) {
+            threads.emplace_back([&, fd]() {
+                // Reply of the worker, kept between its stripes
+                std::vector<uint16_t> rgb;
+                try {
+                    for (size_t i = next++; i < stripes.size() && !failed; i = next++) {
+                        DemosaicStripe(fd, stripes[i], w, source, rgb, output);
+                    }
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed = true;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Local workers:
+
+    LocalWorkers::LocalWorkers(const char* executable, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+                Stop();
+                throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+            }
+            std::string fd = std::to_string(pair[1]);
+            pid_t pid = fork();
+            if (pid == 0) {
+                // The end of the worker survives exec, the ends of other workers do not
+                fcntl(pair[1], F_SETFD, 0);
+                execl(executable, executable, "--worker", fd.c_str(), static_cast<char*>(nullptr));
+                _exit(127);
+            }
+            close(pair[1]);
+            if (pid < 0) {
+                close(pair[0]);
+                Stop();
+                throw std::runtime_error(std::string("Cannot start worker: ") + std::strerror(errno));
+            }
+            sockets_.push_back(pair[0]);
+            processes_.push_back(pid);
+        }
+    }
+
+    LocalWorkers::~LocalWorkers() {
+        Stop();
+    }
+
+    void LocalWorkers::Stop() {
+        for (int fd : sockets_) {
+            RequestHeader request{kRequestMagic, SHUTDOWN, 0, 0, NativePattern(), INLINE, 0};
+            ResponseHeader response;
+            // A worker which failed has closed its socket already
+            if (WriteAll(fd, &request, sizeof(request))) {
+                ReadAll(fd, &response, sizeof(response));
+            }
+            close(fd);
+        }
+        for (pid_t pid : processes_) {
+            int status;
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+            }
+        }
+        sockets_.clear();
+        processes_.clear();
+    }
+} // namespace service
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <sys/types.h>
+#include "../pipeline/temporal.hpp"
+#include "../support/bitmap.hpp"
+
+// Demosaicing of mosaics too large for the memory of one process
+// (stitched scans, aerial captures) by worker processes.
+//
+// The coordinator splits the mosaic into horizontal stripes of even height
+// and sends every stripe with kStripeHalo rows above and below it as a FRAME
+// request of service/protocol.hpp. A worker demosaics it as a whole image and
+// replies RGB inline, the coordinator keeps the rows of the stripe only.
+// A result row depends on the mosaic at most kStripeHalo rows around it and
+// the halo is even, so the CFA phase of a stripe is the one of the image and
+// the stitched result is exactly the one of a single process, without seams.
+//
+// Workers are connected stream sockets: local ones are processes of this
+// executable serving a socketpair (LocalWorkers), ones on other hosts may be
+// connected over TCP and served with the same requests.
+//
+// BE CAREFUL: with ADAPTIVE_REFINE tiles are chosen per stripe, so tiles
+// near the stripe borders may be refined unlike the single-process result
+namespace service {
+
+    // Rows sent above and below a stripe: the halo of the pipeline
+    // (one more row for the refining) rounded up to even
+#if defined(REFINE)
+    constexpr size_t kStripeHalo = (menon::kPipelineHalo + 2) & ~size_t{1};
+#else
+    constexpr size_t kStripeHalo = (menon::kPipelineHalo + 1) & ~size_t{1};
+#endif
+
+    // Pixels of a stripe with the default height
+    constexpr size_t kStripePixels = size_t{1} << 24;
+
+    struct Stripe {
+        size_t begin, end;           // rows of the result
+        size_t halo_begin, halo_end; // rows of the mosaic sent to a worker
+    };
+
+    // Stripes of 'rows' rows (even, the last one may be shorter) covering h rows
+    std::vector<Stripe> SplitStripes(size_t h, size_t rows);
+
+    // Even height of stripes of about kStripePixels, at least one stripe per worker
+    size_t DefaultStripeRows(size_t h, size_t w, size_t workers);
+
+    // Returns rows [begin, end) of the mosaic as Bitmap<uint16_t> of the native pattern
+    // Called concurrently for different rows
+    using StripeSource = std::function<Bitmap(size_t begin, size_t end)>;
+
+    // Gets rows [begin, end) of the result as interleaved RGB (RGBRGB..., w pixels a row)
+    // Called concurrently for different stripes
+    using StripeOutput = std::function<void(size_t begin, size_t end, const uint16_t* rgb)>;
+
+    // Demosaics the stripes of an h x w mosaic by the workers, every worker takes
+    // the next stripe when it has replied the previous one.
+    // Exception if a worker fails or closes its socket, the stripes already
+    // sent to other workers are finished first
+    void DemosaicSharded(size_t h, size_t w, const StripeSource& source, const std::vector<int>& workers,
+                         size_t stripe_rows, const StripeOutput& output);
+
+    // Processes of 'executable' started as "<executable> --worker <fd>", where fd is
+    // their end of a socketpair
+    class LocalWorkers {
+    public:
+        // Exception if a process cannot be started
+        LocalWorkers(const char* executable, size_t count);
+        ~LocalWorkers();
+
+        LocalWorkers(const LocalWorkers&) = delete;
+        LocalWorkers& operator =(const LocalWorkers&) = delete;
+
+        const std::vector<int>& Sockets() const {
+            return sockets_;
+        }
+
+        // Sends SHUTDOWN, closes the sockets and waits for the processes.
+        // Called by the destructor if it was not called before
+        void Stop();
+
+    private:
+        std::vector<int> sockets_;
+        std::vector<pid_t> processes_;
+    };
+} // namespace service
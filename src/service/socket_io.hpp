@@ -0,0 +1,63 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/socket.h>
+
+// Whole messages over a stream socket (Unix domain or TCP),
+// the requests of service/protocol.hpp and their replies
+namespace service {
+
+    // Returns false if the peer closed the connection before 'size' bytes
+    inline bool ReadAll(int fd, void* data, size_t size) {
+        auto bytes = static_cast<uint8_t*>(data);
+        while (size != 0) {
+            ssize_t n = recv(fd, bytes, size, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // 'descriptor' >= 0 is passed with the first bytes as SCM_RIGHTS
+    inline bool WriteAll(int fd, const void* data, size_t size, int descriptor = -1) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        while (size != 0) {
+            iovec part{const_cast<uint8_t*>(bytes), size};
+            msghdr message{};
+            message.msg_iov = &part;
+            message.msg_iovlen = 1;
+
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+            if (descriptor >= 0) {
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+                cmsghdr* header = CMSG_FIRSTHDR(&message);
+                header->cmsg_level = SOL_SOCKET;
+                header->cmsg_type = SCM_RIGHTS;
+                header->cmsg_len = CMSG_LEN(sizeof(int));
+                std::memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+            }
+
+            ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            descriptor = -1;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+} // namespace service
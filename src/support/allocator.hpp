@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Storage of pixel data of Bitmap
+namespace mem {
+
+    // Frees a block of pixel data
+    using Release = std::function<void(uint8_t*)>;
+
+    struct Block {
+        uint8_t* data;
+        Release release;
+    };
+
+    // Allocates 'bytes' for an image of 'rows' rows
+    // Exception on failure
+    using Allocator = std::function<Block(size_t bytes, size_t rows)>;
+
+    enum class Pages {
+        NORMAL,           // operator new, pages are touched by the first writer
+        TRANSPARENT_HUGE, // mmap aligned to 2 MB + madvise(MADV_HUGEPAGE)
+        EXPLICIT_HUGE,    // mmap(MAP_HUGETLB), TRANSPARENT_HUGE if no huge pages are reserved
+    };
+
+    constexpr size_t kAlignment = 128;
+    constexpr size_t kHugePageSize = size_t{2} << 20;
+
+    struct AllocatorOptions {
+        Pages pages{Pages::TRANSPARENT_HUGE};
+        // Smaller blocks are always NORMAL
+        size_t min_huge_bytes{kHugePageSize * 4};
+        // Pages of a mapped block are touched by 'threads' threads band by band:
+        // band i (of 'band_rows' rows) by thread i % threads, so page faults of
+        // the block are taken in parallel. It is not a NUMA placement: sched::Wavefront
+        // hands the bands out dynamically, so a band is not used by the thread touching it.
+        // 0 threads - no first touch (pages are placed by the first writer)
+        size_t threads{0};
+        size_t band_rows{32};
+    };
+
+    inline AllocatorOptions& Options() {
+        static AllocatorOptions options;
+        return options;
+    }
+
+    // BE CAREFUL: call it before the processing starts
+    inline void SetAllocatorOptions(const AllocatorOptions& options) {
+        Options() = options;
+    }
+
+    // Bytes of physical memory available now without swapping (0 - unknown)
+    inline size_t AvailableMemory() {
+#if defined(__linux__) && defined(_SC_AVPHYS_PAGES)
+        long pages = sysconf(_SC_AVPHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        if (pages > 0 && page_size > 0) {
+            return static_cast<size_t>(pages) * static_cast<size_t>(page_size);
+        }
+#endif
+        return 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Allocators:
+
+    // Aligned operator new
+    inline Block AllocateAligned(size_t bytes, size_t /*rows*/) {
+        return Block{
+            new (std::align_val_t{kAlignment}) uint8_t[bytes],
+            [](uint8_t* data) { ::operator delete[](data, std::align_val_t{kAlignment}); }
+        };
+    }
+
+#if defined(__linux__)
+    // Touches one byte of every page of the block as described in AllocatorOptions
+    inline void FirstTouch(uint8_t* data, size_t bytes, size_t rows, size_t page_size) {
+        const auto& options = Options();
+        size_t threads = std::min(options.threads, bytes / page_size);
+        if (threads < 2 || rows == 0) {
+            return;
+        }
+        size_t band_bytes = std::max<size_t>(bytes / rows, 1) * std::max<size_t>(options.band_rows, 1);
+        size_t bands = (bytes + band_bytes - 1) / band_bytes;
+
+        auto touch = [=](size_t thread) {
+            for (size_t band = thread; band < bands; band += threads) {
+                size_t begin = band * band_bytes;
+                size_t end = std::min(begin + band_bytes, bytes);
+                // the first page of the band may be shared with the previous one
+                for (size_t pos = (begin + page_size - 1) / page_size * page_size; pos < end; pos += page_size) {
+                    reinterpret_cast<volatile uint8_t*>(data)[pos] = 0;
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back(touch, i);
+        }
+        touch(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Anonymous mapping with huge pages
+    inline Block AllocateHugePages(size_t bytes, size_t rows, Pages pages) {
+        size_t size = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        auto release = [size](uint8_t* data) { munmap(data, size); };
+
+#if defined(MAP_HUGETLB)
+        if (pages == Pages::EXPLICIT_HUGE) {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                auto data = static_cast<uint8_t*>(p);
+                FirstTouch(data, bytes, rows, kHugePageSize);
+                return Block{data, release};
+            }
+        }
+#endif
+        // Reserve one more huge page to align the block to the huge page size
+        void* p = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        auto raw = static_cast<uint8_t*>(p);
+        auto data = reinterpret_cast<uint8_t*>(
+                (reinterpret_cast<uintptr_t>(raw) + kHugePageSize - 1) / kHugePageSize * kHugePageSize);
+        // Unmap the unused head and tail
+        size_t head = data - raw;
+        if (head != 0) {
+            munmap(raw, head);
+        }
+        if (head != kHugePageSize) {
+            munmap(data + size, kHugePageSize - head);
+        }
+#if defined(MADV_HUGEPAGE)
+        madvise(data, size, MADV_HUGEPAGE);
+#endif
+        // Touch every small page: huge pages may be not available
+        FirstTouch(data, bytes, rows, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+        return Block{data, release};
+    }
+#endif
+
+    // Allocator chosen by the options
+    inline Block AllocateByOptions(size_t bytes, size_t rows) {
+#if defined(__linux__)
+        const auto& options = Options();
+        if (options.pages != Pages::NORMAL && bytes >= options.min_huge_bytes) {
+            return AllocateHugePages(bytes, rows, options.pages);
+        }
+#endif
+        return AllocateAligned(bytes, rows);
+    }
+
+    inline Allocator& CurrentAllocator() {
+        static Allocator allocator = AllocateByOptions;
+        return allocator;
+    }
+
+    // Replaces the allocator of all new bitmaps (e.g. by a NUMA-aware one)
+    // BE CAREFUL: call it before the processing starts
+    inline void SetAllocator(Allocator allocator) {
+        CurrentAllocator() = std::move(allocator);
+    }
+
+    // Returned block is aligned at least to kAlignment
+    inline Block Allocate(size_t bytes, size_t rows) {
+        return CurrentAllocator()(bytes, rows);
+    }
+
+    // Keeps released blocks (up to max_bytes) and gives them to new bitmaps
+    // of the same size. So a long-lived process demosaicing images of one size
+    // does not map and fault in new pages for every image:
+    //
+    //      mem::BlockCache cache(size_t{1} << 30);
+    //      mem::SetAllocator(cache.AsAllocator());
+    //
+    // Bitmaps may outlive the cache: their blocks are freed on release then
+    class BlockCache {
+    public:
+        explicit BlockCache(size_t max_bytes, Allocator upstream = AllocateByOptions)
+                : state_{std::make_shared<State>()} {
+            state_->max_bytes = max_bytes;
+            state_->upstream = std::move(upstream);
+        }
+
+        Allocator AsAllocator() const {
+            auto state = state_;
+            return [state](size_t bytes, size_t rows) { return Take(state, bytes, rows); };
+        }
+
+        // Bytes of blocks waiting for reuse
+        size_t CachedBytes() const {
+            std::lock_guard lock(state_->mutex);
+            return state_->cached_bytes;
+        }
+
+    private:
+        struct State {
+            std::mutex mutex;
+            std::multimap<size_t, Block> free; // by size
+            size_t cached_bytes{0};
+            size_t max_bytes{0};
+            Allocator upstream;
+
+            ~State() {
+                for (auto& [bytes, block] : free) {
+                    block.release(block.data);
+                }
+            }
+        };
+
+        static Block Take(const std::shared_ptr<State>& state, size_t bytes, size_t rows) {
+            Block block{nullptr, Release{}};
+            {
+                std::lock_guard lock(state->mutex);
+                auto it = state->free.find(bytes);
+                if (it != state->free.end()) {
+                    block = std::move(it->second);
+                    state->free.erase(it);
+                    state->cached_bytes -= bytes;
+                }
+            }
+            if (block.data == nullptr) {
+                block = state->upstream(bytes, rows);
+            }
+            auto release = std::move(block.release);
+            return Block{block.data, [state, bytes, release](uint8_t* data) {
+                GiveBack(state, bytes, Block{data, release});
+            }};
+        }
+
+        static void GiveBack(const std::shared_ptr<State>& state, size_t bytes, Block block) {
+            {
+                std::lock_guard lock(state->mutex);
+                if (state->cached_bytes + bytes <= state->max_bytes) {
+                    state->free.emplace(bytes, std::move(block));
+                    state->cached_bytes += bytes;
+                    return;
+                }
+            }
+            block.release(block.data);
+        }
+
+        std::shared_ptr<State> state_;
+    };
+} // namespace mem
@@ -1,15 +1,21 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <cassert>
 #include <cstring>
+#include <functional>
+#include <new>
 #include <vector>
+#include "allocator.hpp"
 
 // Class of pixel array with only one channel
-// Copyable
+// Copyable only explicitly (Copy, CopyFrom)
 // Trivially movable
 class Bitmap {
 public:
+    // Frees pixel data when the bitmap is destroyed
+    using Release = mem::Release;
     // Type of the maximum sample(pixel) size.
     // Used in 'Get' function to make it able to return code of each size.
     using LARGEST_TYPE = uint32_t;
@@ -21,21 +27,30 @@ public:
     Bitmap() = default;
 
     Bitmap(size_t height, size_t width, uint16_t bytes_per_pixel)
+            : Bitmap(height, width, bytes_per_pixel,
+                     mem::Allocate(height * width * bytes_per_pixel + DATA_SAFE_OFFSET, height)) {
+    }
+
+    // Wraps external pixel data without copying (e.g. a memory-mapped file)
+    // release(data) is called when the bitmap is destroyed
+    // BE CAREFUL: DATA_SAFE_OFFSET bytes after the last pixel must be readable
+    Bitmap(size_t height, size_t width, uint16_t bytes_per_pixel, uint8_t* data, Release release)
             : h_{height},
               w_{width},
               p_{bytes_per_pixel},
-              data_{new (std::align_val_t{ 128 }) uint8_t[height * width * bytes_per_pixel + DATA_SAFE_OFFSET]},
+              data_{data, std::move(release)},
               mask_{(static_cast<LARGEST_TYPE>(1) << (bytes_per_pixel << 3)) - 1} {
     }
 
-    // Copyable
-    Bitmap(const Bitmap& other)
-      : Bitmap(std::move(other.Copy())) {
-    }
-    Bitmap& operator =(const Bitmap& other) {
-        return *this = std::move(other.Copy());;
+    // Takes the pixel data of the block (see support/allocator.hpp)
+    Bitmap(size_t height, size_t width, uint16_t bytes_per_pixel, mem::Block block)
+            : Bitmap(height, width, bytes_per_pixel, block.data, std::move(block.release)) {
     }
 
+    // Copying a frame is expensive, so it must be explicit
+    Bitmap(const Bitmap& other) = delete;
+    Bitmap& operator =(const Bitmap& other) = delete;
+
     // Trivially movable
     Bitmap(Bitmap&&) = default;
     Bitmap& operator =(Bitmap&&) = default;
@@ -60,10 +75,25 @@ public:
     // Copies current bitmap
     Bitmap Copy() const {
         Bitmap cp(h_, w_, p_);
-        std::copy(data_.get(), data_.get() + h_*w_*p_, cp.data_.get());
+        cp.CopyFrom(*this);
         return cp;
     }
 
+    // Copies pixels of other to the preallocated bitmap
+    // BE CAREFUL: sizes must be equal
+    void CopyFrom(const Bitmap& other) {
+        assert(h_ == other.h_ && w_ == other.w_ && p_ == other.p_);
+        size_t bytes = h_ * w_ * p_;
+        std::memcpy(data_.get(), other.data_.get(), bytes);
+        copied_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Bytes copied by Copy and CopyFrom of all bitmaps since the start.
+    // The difference of two calls is the memory traffic spent on copies
+    static size_t CopiedBytes() {
+        return copied_bytes_.load(std::memory_order_relaxed);
+    }
+
     // Returns the value of pixel (x, y) of Bitmap
     // 0 <= x < height, 0 <= y < width
     LARGEST_TYPE Get(size_t x, size_t y) const {
@@ -109,11 +139,13 @@ public:
     }
 
 private:
-    std::unique_ptr<uint8_t> data_{nullptr};
+    std::unique_ptr<uint8_t, Release> data_{nullptr, Release{}};
     size_t w_{0}; // width
     size_t h_{0}; // height
     size_t p_{0}; // bytes per pixel
     LARGEST_TYPE mask_{0}; // mask to get first p_ bytes from LARGEST_TYPE
+
+    static inline std::atomic<size_t> copied_bytes_{0};
 };
 
 // a pair of bitmaps with different orientation
@@ -1,6 +1,8 @@
 #include <cmath>
 #include <thread>
 #include "bitmap_arithmetics.hpp"
+#include "scheduler.hpp"
+#include "perf.hpp"
 
 // Allow to execute operations concurrently
 //#define OPS_PARALLEL
@@ -11,28 +13,10 @@
 #include "emmintrin.h"
 #endif
 
-//Operation variants (only headers):
-void AddShiftedSimple(Bitmap& b1, const Bitmap& b2, int dx, int dy);
-void SubShiftedSimple(Bitmap& b1, const Bitmap& b2, int dx, int dy);
-void AddShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy);
-void SubShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy);
-
-void AbsSimple(Bitmap& b);
-void AbsWithSIMD(Bitmap& b);
-
-void SubWithSIMD(Bitmap& b1, const Bitmap& b2);
-void ShiftSimple(Bitmap& b, int offset);
-void ShiftWithSIMD(Bitmap& b, int offset);
-void SubDiv2Simple(Bitmap& b1, const Bitmap& b2);
-void SubDiv2WithSIMD(Bitmap& b1, const Bitmap& b2);
-
-Bitmap CopyCast32Simple(const Bitmap& b);
-Bitmap CopyCast32WithSIMD(const Bitmap& b);
-Bitmap CopyCast16Simple(const Bitmap& b);
-//Bitmap CopyCast16WithSIMD(const Bitmap& b);
-
+// Operation variants are declared in the header
 
 void AddShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy) {
+    PERF_SCOPE("AddShifted", b1.Height() * b1.Width())
 #ifdef SIMD
     AddShiftedWithSIMD(b1, b2, dx, dy);
 #else
@@ -41,6 +25,7 @@ void AddShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy) {
 }
 
 void SubShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy) {
+    PERF_SCOPE("SubShifted", b1.Height() * b1.Width())
 #ifdef SIMD
     SubShiftedWithSIMD(b1, b2, dx, dy);
 #else
@@ -49,10 +34,15 @@ void SubShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy) {
 }
 
 void Sub(Bitmap& b1, const Bitmap& b2) {
+    Sub(b1, b2, b1);
+}
+
+void Sub(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
+    PERF_SCOPE("Sub", b1.Height() * b1.Width())
 #if defined(SIMD)
-    SubWithSIMD(b1, b2);
+    SubWithSIMD(b1, b2, dest);
 #else
-    SubShiftedSimple(b1, b2, 0, 0);
+    SubSimple(b1, b2, dest);
 #endif
 }
 
@@ -61,6 +51,7 @@ void Add(Bitmap& b1, const Bitmap& b2) {
 }
 
 Bitmap CopyCast32(const Bitmap& b) {
+    PERF_SCOPE("CopyCast32", b.Height() * b.Width())
 #if defined(SIMD)
     return CopyCast32WithSIMD(b);
 #else
@@ -69,11 +60,16 @@ Bitmap CopyCast32(const Bitmap& b) {
 }
 
 Bitmap CopyCast16(const Bitmap& b) {
-    // No such SIMD instruction
+    PERF_SCOPE("CopyCast16", b.Height() * b.Width())
+#if defined(SIMD)
+    return CopyCast16WithSIMD(b);
+#else
     return CopyCast16Simple(b);
+#endif
 }
 
 void Abs(Bitmap& b) {
+    PERF_SCOPE("Abs", b.Height() * b.Width())
 #if defined(SIMD)
     AbsWithSIMD(b);
 #else
@@ -81,7 +77,17 @@ void Abs(Bitmap& b) {
 #endif
 }
 
+void Div2(Bitmap& b) {
+    PERF_SCOPE("Div2", b.Height() * b.Width())
+#if defined(SIMD)
+    Div2WithSIMD(b);
+#else
+    Div2Simple(b);
+#endif
+}
+
 void Shift(Bitmap& b, int offset) {
+    PERF_SCOPE("Shift", b.Height() * b.Width())
 #if defined(SIMD)
     ShiftWithSIMD(b, offset);
 #else
@@ -90,10 +96,15 @@ void Shift(Bitmap& b, int offset) {
 }
 
 void SubDiv2(Bitmap& b1, const Bitmap& b2) {
+    SubDiv2(b1, b2, b1);
+}
+
+void SubDiv2(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
+    PERF_SCOPE("SubDiv2", b1.Height() * b1.Width())
 #if defined(SIMD)
-    SubDiv2WithSIMD(b1, b2);
+    SubDiv2WithSIMD(b1, b2, dest);
 #else
-    SubDiv2Simple(b1, b2);
+    SubDiv2Simple(b1, b2, dest);
 #endif
 }
 
@@ -175,7 +186,8 @@ void SubDiv2(Bitmap& b1, const Bitmap& b2) {
 
 #define SIMD_SHIFTED_OPERATION_MULTITHREAD(PREPARE, IN_CYCLE, IN_REST)             \
     {                                                                              \
-        size_t threads = std::thread::hardware_concurrency() >> 1;                 \
+        /* V and H are processed concurrently, each takes half of threads */       \
+        size_t threads = std::max<size_t>(sched::DefaultThreads() >> 1, 1);        \
         std::vector<std::thread> parts;                                            \
         for (size_t i = 0; i < threads; ++i) {                                     \
             parts.emplace_back([&, i](){                                           \
@@ -221,7 +233,7 @@ void SubDiv2(Bitmap& b1, const Bitmap& b2) {
         }                                              \
     }
 
-    void Div2(Bitmap& b) {
+    void Div2Simple(Bitmap& b) {
         FOR_EVERY_PIXEL(b, {
             // like signed short
             b.Set(x, y, static_cast<int16_t>(b.Get<int16_t>(x, y) / 2));
@@ -275,6 +287,20 @@ void SubShiftedSimple(Bitmap& b1, const Bitmap& b2, int dx, int dy) {
     }
 }
 
+void SubSimple(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
+    switch(b1.BytesPerPixel()) {
+        case sizeof(uint16_t):
+        FOR_EVERY_PIXEL(b1, {
+            // like signed short
+            dest.Set(x, y, static_cast<int16_t>(b1.Get<int16_t>(x, y) - b2.Get<int16_t>(x, y)));
+        }) break;
+        case sizeof(int):
+        FOR_EVERY_PIXEL(b1, {
+            dest.Set(x, y, static_cast<int>(b1.Get<int>(x, y) - b2.Get<int>(x, y)));
+        }) break;
+    }
+}
+
 Bitmap CopyCast32Simple(const Bitmap& b) {
     size_t h = b.Height();
     size_t w = b.Width();
@@ -297,6 +323,7 @@ Bitmap CopyCast16Simple(const Bitmap& b) {
 }
 
 void FillWithZeros(Bitmap& b) {
+    PERF_SCOPE("FillWithZeros", b.Height() * b.Width())
     std::memset(b.Data(), 0, b.Width()*b.Height()*b.BytesPerPixel());
 }
 
@@ -307,11 +334,11 @@ void ShiftSimple(Bitmap& b, int offset) {
     })
 }
 
-void SubDiv2Simple(Bitmap& b1, const Bitmap& b2) {
+void SubDiv2Simple(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
     FOR_EVERY_PIXEL(b1, {
         uint16_t value1 = b1.Get<uint16_t>(x, y) >> 1;
         uint16_t value2 = b2.Get<uint16_t>(x, y) >> 1;
-        b1.Set(x, y, static_cast<int16_t>(value1 - value2));
+        dest.Set(x, y, static_cast<int16_t>(value1 - value2));
     })
 }
 
@@ -320,7 +347,7 @@ void SubDiv2Simple(Bitmap& b1, const Bitmap& b2) {
 // SIMD implementations:
 #if defined(SIMD)
 
-void SubWithSIMD(Bitmap& b1, const Bitmap& b2) {
+void SubWithSIMD(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
     constexpr size_t SIMD_SIZE_BITS = 128;
     size_t h = b1.Height();
     size_t w = b1.Width();
@@ -328,25 +355,27 @@ void SubWithSIMD(Bitmap& b1, const Bitmap& b2) {
         case sizeof(int16_t): {
             constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int16_t);
             SIMD_OPERATION(
-                    auto b1_data = reinterpret_cast<int16_t *>(b1.Data());
-                    auto b2_data = reinterpret_cast<const int16_t *>(b2.Data());       ,
+                    auto b1_data = reinterpret_cast<const int16_t *>(b1.Data());
+                    auto b2_data = reinterpret_cast<const int16_t *>(b2.Data());
+                    auto dest_data = reinterpret_cast<int16_t *>(dest.Data());       ,
                     __m128i row1 = _mm_loadu_si128((__m128i *) (&b1_data[row_pos + y]));
                     __m128i row2 = _mm_loadu_si128((__m128i *) (&b2_data[row_pos + y]));
                     __m128i sub = _mm_sub_epi16(row1, row2);
-                    _mm_storeu_si128((__m128i *) (&b1_data[row_pos + y]), sub);        ,
-                    b1_data[row_pos + y] -= b2_data[row_pos + y];
+                    _mm_storeu_si128((__m128i *) (&dest_data[row_pos + y]), sub);        ,
+                    dest_data[row_pos + y] = b1_data[row_pos + y] - b2_data[row_pos + y];
             ) break;
         }
         case sizeof(int): {
             constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int);
             SIMD_OPERATION(
-                    auto b1_data = reinterpret_cast<int *>(b1.Data());
-                    auto b2_data = reinterpret_cast<const int *>(b2.Data());           ,
+                    auto b1_data = reinterpret_cast<const int *>(b1.Data());
+                    auto b2_data = reinterpret_cast<const int *>(b2.Data());
+                    auto dest_data = reinterpret_cast<int *>(dest.Data());           ,
                     __m128i row1 = _mm_loadu_si128((__m128i *) (&b1_data[row_pos + y]));
                     __m128i row2 = _mm_loadu_si128((__m128i *) (&b2_data[row_pos + y]));
                     __m128i sub = _mm_sub_epi32(row1, row2);
-                    _mm_storeu_si128((__m128i *) (&b1_data[row_pos + y]), sub);        ,
-                    b1_data[row_pos + y] -= b2_data[row_pos + y];
+                    _mm_storeu_si128((__m128i *) (&dest_data[row_pos + y]), sub);        ,
+                    dest_data[row_pos + y] = b1_data[row_pos + y] - b2_data[row_pos + y];
             ) break;
         }
     }
@@ -402,7 +431,7 @@ void SubShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy)
                     __m128i sub = _mm_sub_epi16(row1, row2);
                     _mm_storeu_si128((__m128i *) (&b1_data[row1_pos + y]), sub);
             ,
-                    b1_data[row1_pos + y] += b2_data[row2_pos + y + dy];
+                    b1_data[row1_pos + y] -= b2_data[row2_pos + y + dy];
             ) break;
         }
         case sizeof(int): {
@@ -416,7 +445,7 @@ void SubShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy)
                     __m128i sub = _mm_sub_epi32(row1, row2);
                     _mm_storeu_si128((__m128i *) (&b1_data[row1_pos + y]), sub);
             ,
-                    b1_data[row1_pos + y] += b2_data[row2_pos + y + dy];
+                    b1_data[row1_pos + y] -= b2_data[row2_pos + y + dy];
             )
         } break;
     }
@@ -458,6 +487,42 @@ Bitmap CopyCast32WithSIMD(const Bitmap& b) {
 }
 
 void AbsWithSIMD(Bitmap& b) {
+    constexpr size_t SIMD_SIZE_BITS = 128;
+    size_t h = b.Height();
+    size_t w = b.Width();
+    switch(b.BytesPerPixel()) {
+        case sizeof(int16_t): {
+            constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int16_t);
+            SIMD_OPERATION(
+                    auto data = reinterpret_cast<int16_t *>(b.Data());
+                    ,
+                    __m128i row = _mm_loadu_si128((__m128i *) (&data[row_pos + y]));
+                    __m128i abs = _mm_abs_epi16(row);
+                    _mm_storeu_si128((__m128i *) (&data[row_pos + y]), abs);
+                    ,
+                    if (data[row_pos + y] < 0) {
+                        data[row_pos + y] = -data[row_pos + y];
+                    }
+            )
+        } break;
+        case sizeof(int): {
+            constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int);
+            SIMD_OPERATION(
+                    auto data = reinterpret_cast<int *>(b.Data());
+                    ,
+                    __m128i row = _mm_loadu_si128((__m128i *) (&data[row_pos + y]));
+                    __m128i abs = _mm_abs_epi32(row);
+                    _mm_storeu_si128((__m128i *) (&data[row_pos + y]), abs);
+                    ,
+                    if (data[row_pos + y] < 0) {
+                        data[row_pos + y] = -data[row_pos + y];
+                    }
+            )
+        } break;
+    }
+}
+
+void Div2WithSIMD(Bitmap& b) {
     constexpr size_t SIMD_SIZE_BITS = 128;
     constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int16_t);
     size_t h = b.Height();
@@ -465,14 +530,35 @@ void AbsWithSIMD(Bitmap& b) {
     SIMD_OPERATION(
             auto data = reinterpret_cast<int16_t *>(b.Data());
             ,
+            // Division rounds toward zero: negative values are increased by 1 before the shift
             __m128i row = _mm_loadu_si128((__m128i *) (&data[row_pos + y]));
-            __m128i abs = _mm_abs_epi16(row);
-            _mm_storeu_si128((__m128i *) (&data[row_pos + y]), abs);
+            __m128i sign = _mm_srli_epi16(row, 15);
+            __m128i half = _mm_srai_epi16(_mm_add_epi16(row, sign), 1);
+            _mm_storeu_si128((__m128i *) (&data[row_pos + y]), half);
             ,
-            if (data[row_pos + y] < 0) {
-                data[row_pos + y] = -data[row_pos + y];
-            }
+            data[row_pos + y] = static_cast<int16_t>(data[row_pos + y] / 2);
+    )
+}
+
+Bitmap CopyCast16WithSIMD(const Bitmap& b) {
+    constexpr size_t SIMD_SIZE_BITS = 128;
+    constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(int);
+    size_t h = b.Height();
+    size_t w = b.Width();
+    Bitmap cp(h, w, sizeof(uint16_t));
+    SIMD_OPERATION(
+            auto b_data = reinterpret_cast<const int *>(b.Data());
+            auto cp_data = reinterpret_cast<uint16_t *>(cp.Data());
+            ,
+            // Unsigned saturation of the pack is the clamp to [0, UINT16_MAX]
+            __m128i row = _mm_loadu_si128((__m128i *) (&b_data[row_pos + y]));
+            __m128i packed = _mm_packus_epi32(row, row);
+            _mm_storel_epi64((__m128i *) (&cp_data[row_pos + y]), packed);
+            ,
+            int v = std::min(std::max(b_data[row_pos + y], 0), UINT16_MAX);
+            cp_data[row_pos + y] = static_cast<uint16_t>(v);
     )
+    return cp;
 }
 
 void ShiftWithSIMD(Bitmap& b, int offset) {
@@ -481,7 +567,7 @@ void ShiftWithSIMD(Bitmap& b, int offset) {
     size_t h = b.Height();
     size_t w = b.Width();
     SIMD_OPERATION(
-            auto data = reinterpret_cast<int16_t *>(b.Data());
+            auto data = reinterpret_cast<uint16_t *>(b.Data());
     ,
             __m128i row = _mm_loadu_si128((__m128i *) (&data[row_pos + y]));
             __m128i abs = _mm_srli_epi16(row, offset);
@@ -491,25 +577,26 @@ void ShiftWithSIMD(Bitmap& b, int offset) {
     )
 }
 
-void SubDiv2WithSIMD(Bitmap& b1, const Bitmap& b2) {
+void SubDiv2WithSIMD(const Bitmap& b1, const Bitmap& b2, Bitmap& dest) {
     constexpr size_t SIMD_SIZE_BITS = 128;
     size_t h = b1.Height();
     size_t w = b1.Width();
 
     constexpr size_t SIMD_SIZE_ITEMS = (SIMD_SIZE_BITS >> 3) / sizeof(uint16_t);
     SIMD_OPERATION(
-            auto b1_data = reinterpret_cast<uint16_t *>(b1.Data());
+            auto b1_data = reinterpret_cast<const uint16_t *>(b1.Data());
             auto b2_data = reinterpret_cast<const uint16_t *>(b2.Data());
+            auto dest_data = reinterpret_cast<uint16_t *>(dest.Data());
             ,
             __m128i row1 = _mm_loadu_si128((__m128i *) (&b1_data[row_pos + y]));
             __m128i row2 = _mm_loadu_si128((__m128i *) (&b2_data[row_pos + y]));
             __m128i row1_2 = _mm_srli_epi16(row1, 1);
             __m128i row2_2 = _mm_srli_epi16(row2, 1);
             __m128i sub_2 = _mm_sub_epi16(row1_2, row2_2);
-            _mm_storeu_si128((__m128i *) (&b1_data[row_pos + y]), sub_2);
+            _mm_storeu_si128((__m128i *) (&dest_data[row_pos + y]), sub_2);
             ,
-            b1_data[row_pos + y] -= b2_data[row_pos + y];
-            b1_data[row_pos + y] >>= 1;
+            // the same as the vector part: halve first, then subtract
+            dest_data[row_pos + y] = (b1_data[row_pos + y] >> 1) - (b2_data[row_pos + y] >> 1);
     )
 }
 
@@ -13,12 +13,18 @@ void AddShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy);
 // or b1[i,j] doesn't change if b2[i+dx,j+dy] is out of bounds
 // BE CAREFUL: signed
 // BE CAREFUL: b1 size must be equal to b2 size
+// BE CAREFUL: b2 may be b1 itself only if dx >= 0 and dy >= 0
 void SubShifted(Bitmap& b1, const Bitmap& b2, int dx, int dy);
 
 // Operation b1 := b1 - b2, where b1[i,j] -= b2[i,j]
 // BE CAREFUL: b1 size must be equal to b2 size
 void Sub(Bitmap& b1, const Bitmap& b2);
 
+// Operation dest := b1 - b2, where dest[i,j] = b1[i,j] - b2[i,j]
+// dest may be b1 itself
+// BE CAREFUL: b1, b2 and dest sizes must be equal
+void Sub(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+
 // Operation b1 := b1 + b2, where b1[i,j] += b2[i,j]
 // BE CAREFUL: b1 size must be equal to b2 size
 void Add(Bitmap& b1, const Bitmap& b2);
@@ -34,6 +40,12 @@ void Div2(Bitmap& b);
 // BE CAREFUL: b1 size must be equal to b2 size
 void SubDiv2(Bitmap& b1, const Bitmap& b2);
 
+// Operation dest := (b1 - b2) / 2; signed
+// where dest[i,j] = (b1[i,j] - b2[i,j]) / 2
+// dest may be b1 itself
+// BE CAREFUL: b1, b2 and dest sizes must be equal
+void SubDiv2(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+
 // Operation b := |b|
 void Abs(Bitmap& b);
 
@@ -46,4 +58,29 @@ Bitmap CopyCast32(const Bitmap& b);
 Bitmap CopyCast16(const Bitmap& b);
 
 // Fills bitmap b with zeros
-void FillWithZeros(Bitmap& b);
\ No newline at end of file
+void FillWithZeros(Bitmap& b);
+
+// Operation variants (only headers).
+// Operations above choose one of them by define SIMD.
+// All variants of an operation must give the same result (see check/differential.hpp)
+void AddShiftedSimple(Bitmap& b1, const Bitmap& b2, int dx, int dy);
+void SubShiftedSimple(Bitmap& b1, const Bitmap& b2, int dx, int dy);
+void SubSimple(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+void AbsSimple(Bitmap& b);
+void Div2Simple(Bitmap& b);
+void ShiftSimple(Bitmap& b, int offset);
+void SubDiv2Simple(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+Bitmap CopyCast32Simple(const Bitmap& b);
+Bitmap CopyCast16Simple(const Bitmap& b);
+
+#if defined(SIMD)
+void AddShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy);
+void SubShiftedWithSIMD(Bitmap& b1, const Bitmap& b2, int dx, int dy);
+void SubWithSIMD(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+void AbsWithSIMD(Bitmap& b);
+void Div2WithSIMD(Bitmap& b);
+void ShiftWithSIMD(Bitmap& b, int offset);
+void SubDiv2WithSIMD(const Bitmap& b1, const Bitmap& b2, Bitmap& dest);
+Bitmap CopyCast32WithSIMD(const Bitmap& b);
+Bitmap CopyCast16WithSIMD(const Bitmap& b);
+#endif
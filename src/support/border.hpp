@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include "bitmap.hpp"
+
+// Border handling.
+//
+// Loops are split into the interior, where every neighbour is inside
+// the image and is read without bounds checks, and the border.
+//
+// Directional filters extend the image by mirroring (reflect-101:
+// ..., p2, p1 | p0, p1, p2, ...), which keeps the parity of the Bayer
+// pattern, so the border pixels are filtered like the interior ones.
+// With define EXACT_BORDERS (see /CMakeLists.txt) they renormalise the weights
+// of the taps inside the image instead, as the original implementation does.
+//
+// Neighbours of the red/blue interpolation and refining out of the image
+// are zero in both modes (chrominance and high-pass are zero-padded).
+namespace border {
+
+    // Index of i (may be out of [0, n)) in the image mirrored by reflect-101
+    inline size_t Mirror(ptrdiff_t i, size_t n) {
+        if (n == 1) {
+            return 0;
+        }
+        auto period = static_cast<ptrdiff_t>(2 * (n - 1));
+        i %= period;
+        if (i < 0) {
+            i += period;
+        }
+        return static_cast<size_t>(i < static_cast<ptrdiff_t>(n) ? i : period - i);
+    }
+
+    // Splits [begin, end) of a line of n pixels into the parts whose neighbours
+    // up to 'halo' pixels away are inside the line or not, and calls
+    // part(part_begin, part_end, inside) for every non-empty part in order
+    template <typename Part>
+    inline void Split(size_t begin, size_t end, size_t n, size_t halo, Part part) {
+        size_t low = std::min(std::max(begin, halo), end);
+        size_t high = std::max(std::min(end, n > halo ? n - halo : 0), low);
+        if (begin < low) {
+            part(begin, low, false);
+        }
+        if (low < high) {
+            part(low, high, true);
+        }
+        if (high < end) {
+            part(high, end, false);
+        }
+    }
+
+    // Reads pixel (x, y) without bounds checks if kInside,
+    // otherwise zero when it is out of bounds (Bitmap::GetSafe)
+    template <bool kInside, typename T>
+    inline T Get(const Bitmap& b, size_t x, size_t y) {
+        if constexpr (kInside) {
+            return b.Get<T>(x, y);
+        }
+        else {
+            return b.GetSafe<T>(x, y);
+        }
+    }
+
+    // Calls row<inside>(x, y_begin, y_end) for the parts of row x, where
+    // 'inside' means all pixels up to 1 pixel away are inside the h x w image
+    template <typename Row>
+    inline void ForEachRowPart(size_t x, size_t y_begin, size_t y_end, size_t h, size_t w, Row row) {
+        bool inside_row = x >= 1 && x + 1 < h;
+        Split(y_begin, y_end, w, 1, [&](size_t begin, size_t end, bool inside) {
+            if (inside_row && inside) {
+                row(std::true_type{}, begin, end);
+            }
+            else {
+                row(std::false_type{}, begin, end);
+            }
+        });
+    }
+} // namespace border
@@ -0,0 +1,186 @@
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include "perf.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf {
+
+    constexpr const char* kCounterNames[kCounters] = {
+        "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"
+    };
+
+#if defined(__linux__)
+    struct EventType {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr EventType kEvents[kCounters] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                             | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                             | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    // Counters of one thread and the threads started by it
+    class ThreadCounters {
+    public:
+        ThreadCounters() {
+            for (size_t i = 0; i < kCounters; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = kEvents[i].type;
+                attr.config = kEvents[i].config;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.inherit = 1;
+                // Counters may be multiplexed: scale them by the time they were running
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                // this thread, any CPU
+                fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            }
+        }
+
+        ~ThreadCounters() {
+            for (int fd : fds_) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+
+        void Read(Values& values, std::array<bool, kCounters>& valid) const {
+            for (size_t i = 0; i < kCounters; ++i) {
+                uint64_t data[3]; // value, time enabled, time running
+                valid[i] = fds_[i] >= 0 && read(fds_[i], data, sizeof(data)) == sizeof(data);
+                if (!valid[i]) {
+                    values[i] = 0;
+                    continue;
+                }
+                values[i] = data[2] != 0 && data[2] < data[1]
+                        ? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2])
+                        : data[0];
+            }
+        }
+
+    private:
+        std::array<int, kCounters> fds_;
+    };
+
+    void Read(Values& values, std::array<bool, kCounters>& valid) {
+        // Opened at the first use in a thread, closed at its exit
+        thread_local ThreadCounters counters;
+        counters.Read(values, valid);
+    }
+#else
+    void Read(Values& values, std::array<bool, kCounters>& valid) {
+        values.fill(0);
+        valid.fill(false);
+    }
+#endif
+
+    bool Available() {
+        Values values;
+        std::array<bool, kCounters> valid;
+        Read(values, valid);
+        for (bool v : valid) {
+            if (v) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Accumulation:
+
+    struct Totals {
+        size_t calls{0};
+        size_t pixels{0};
+        Values values{};
+        std::array<bool, kCounters> valid{};
+    };
+
+    static std::mutex totals_mutex;
+
+    // Ordered by the name to print the report in a stable order
+    static std::map<std::string, Totals>& AllTotals() {
+        static std::map<std::string, Totals> totals;
+        return totals;
+    }
+
+    Scope::Scope(const char* name, size_t pixels) : name_{name}, pixels_{pixels} {
+        Read(begin_, valid_);
+    }
+
+    Scope::~Scope() {
+        Values end;
+        std::array<bool, kCounters> valid;
+        Read(end, valid);
+
+        std::lock_guard lock(totals_mutex);
+        auto& totals = AllTotals()[name_];
+        totals.calls += 1;
+        totals.pixels += pixels_;
+        for (size_t i = 0; i < kCounters; ++i) {
+            if (valid_[i] && valid[i] && end[i] >= begin_[i]) {
+                totals.values[i] += end[i] - begin_[i];
+                totals.valid[i] = true;
+            }
+        }
+    }
+
+    void Report(std::ostream& out) {
+        std::lock_guard lock(totals_mutex);
+        if (!Available()) {
+            out << "Hardware counters are not available (no PMU, perf_event_paranoid or seccomp)\n";
+        }
+        out << "Counters per megapixel:\n";
+        out << std::left << std::setw(24) << "scope" << std::right << std::setw(8) << "calls";
+        for (const char* name : kCounterNames) {
+            out << std::setw(16) << name;
+        }
+        out << std::setw(8) << "IPC" << '\n';
+
+        for (const auto& [name, totals] : AllTotals()) {
+            double megapixels = static_cast<double>(totals.pixels) / 1e6;
+            out << std::left << std::setw(24) << name << std::right << std::setw(8) << totals.calls;
+            for (size_t i = 0; i < kCounters; ++i) {
+                if (totals.valid[i] && megapixels > 0) {
+                    out << std::setw(16) << std::fixed << std::setprecision(0)
+                        << static_cast<double>(totals.values[i]) / megapixels;
+                }
+                else {
+                    out << std::setw(16) << "n/a";
+                }
+            }
+            if (totals.valid[CYCLES] && totals.valid[INSTRUCTIONS] && totals.values[CYCLES] != 0) {
+                out << std::setw(8) << std::fixed << std::setprecision(2)
+                    << static_cast<double>(totals.values[INSTRUCTIONS]) / totals.values[CYCLES];
+            }
+            else {
+                out << std::setw(8) << "n/a";
+            }
+            out << '\n';
+        }
+        out << std::defaultfloat;
+    }
+
+    void Reset() {
+        std::lock_guard lock(totals_mutex);
+        AllTotals().clear();
+    }
+} // namespace perf
@@ -0,0 +1,66 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Hardware performance counters of the pipeline stages and arithmetic kernels
+// (Linux perf_event_open). Enabled by define PERF_COUNTERS (see /CMakeLists.txt),
+// otherwise PERF_SCOPE does nothing.
+//
+// Counters are opened per thread and inherited by the threads it starts, so a scope
+// counts the work of all threads started inside it.
+// The wavefront (pipeline/wavefront.cpp) counts every band of a stage in the thread
+// running it, the stages get the same names as in the stage by stage pipeline;
+// "Stage wavefront" is the whole wavefront with the waiting of its threads.
+// Counters that cannot be opened (no PMU in a VM, perf_event_paranoid, seccomp
+// in a container) are reported as n/a; the processing is not affected.
+namespace perf {
+
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,
+        BRANCH_MISSES,
+        kCounters
+    };
+
+    using Values = std::array<uint64_t, kCounters>;
+
+    // Counters of the calling thread since the first call in it
+    // valid[i] is false if counter i is not available
+    void Read(Values& values, std::array<bool, kCounters>& valid);
+
+    // True if at least one counter can be read
+    bool Available();
+
+    // Adds the counters between construction and destruction to 'name'
+    // 'name' must be a string literal
+    class Scope {
+    public:
+        Scope(const char* name, size_t pixels);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* name_;
+        size_t pixels_;
+        Values begin_{};
+        std::array<bool, kCounters> valid_{};
+    };
+
+    // Prints counters per megapixel of every scope name
+    void Report(std::ostream& out);
+
+    // Forgets the accumulated counters
+    void Reset();
+} // namespace perf
+
+#if defined(PERF_COUNTERS)
+#define PERF_SCOPE(name, pixels) perf::Scope perf_scope{name, pixels};
+#else
+#define PERF_SCOPE(name, pixels)
+#endif
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "preprocess.hpp"
+#include "scheduler.hpp"
+#include "perf.hpp"
+
+#if defined(SIMD)
+#include <immintrin.h>
+#endif
+
+namespace pre {
+
+    // Rows corrected as one task of Correct
+    constexpr size_t kBandRows = 32;
+
+    Correction Correction::ForColors(const std::array<uint16_t, 3>& black_rgb,
+                                     const std::array<float, 3>& gain_rgb, uint16_t white) {
+        // Colors of the phases of RGGB: R G / G B
+        constexpr size_t kRGGB[4] = {0, 1, 1, 2};
+#if defined(RGGB)
+        constexpr size_t kNative = 0;
+#else
+        // GRBG is RGGB mirrored left to right
+        constexpr size_t kNative = 1;
+#endif
+        Correction correction;
+        for (size_t phase = 0; phase < 4; ++phase) {
+            size_t color = kRGGB[phase ^ kNative];
+            correction.black[phase] = black_rgb[color];
+            correction.gain[phase] = gain_rgb[color];
+        }
+        correction.white = white;
+        return correction;
+    }
+
+    bool Correction::IsIdentity() const {
+        for (size_t phase = 0; phase < 4; ++phase) {
+            if (black[phase] != 0 || gain[phase] != 1) {
+                return false;
+            }
+        }
+        return white == 65535;
+    }
+
+    // Multiplier of (in - black) of the phase
+    static float Factor(const Correction& correction, size_t phase) {
+        if (correction.white <= correction.black[phase] || !(correction.gain[phase] > 0)) {
+            throw std::invalid_argument("Gains must be positive and the white level above the black one");
+        }
+        float factor = correction.gain[phase] * 65535.0f
+                       / static_cast<float>(correction.white - correction.black[phase]);
+        // 65535 * factor must stay in int of _mm_cvtps_epi32
+        if (factor > 32767.0f) {
+            throw std::invalid_argument("Gain of the phase is too large");
+        }
+        return factor;
+    }
+
+    template <typename T>
+    static void CorrectRowsOf(const Bitmap& src, Bitmap& dest, const Correction& correction,
+                              size_t x_begin, size_t x_end) {
+        size_t w = src.Width();
+        // 8-bit samples are the high byte
+        constexpr int kShift = sizeof(T) == sizeof(uint8_t) ? 8 : 0;
+        float factors[4];
+        for (size_t phase = 0; phase < 4; ++phase) {
+            factors[phase] = Factor(correction, phase);
+        }
+
+        for (size_t x = x_begin; x < x_end; ++x) {
+            auto s = reinterpret_cast<const T*>(src.Data()) + x * w;
+            auto d = reinterpret_cast<uint16_t*>(dest.Data()) + x * w;
+            size_t row_phase = (x & 1) * 2;
+            const float f[2] = {factors[row_phase], factors[row_phase + 1]};
+            const int b[2] = {correction.black[row_phase], correction.black[row_phase + 1]};
+
+            // Both rounding to the nearest even, so the SIMD result is the same
+            auto correct = [&](size_t y) {
+                int value = std::max((static_cast<int>(s[y]) << kShift) - b[y & 1], 0);
+                float scaled = std::nearbyint(static_cast<float>(value) * f[y & 1]);
+                d[y] = static_cast<uint16_t>(std::min(scaled, 65535.0f));
+            };
+
+            size_t y = 0;
+#if defined(SIMD)
+            const __m128 factor = _mm_setr_ps(f[0], f[1], f[0], f[1]);
+            const __m128i black = _mm_setr_epi32(b[0], b[1], b[0], b[1]);
+            const __m128i zero = _mm_setzero_si128();
+            for (; y + 8 <= w; y += 8) {
+                __m128i in;
+                if constexpr (sizeof(T) == sizeof(uint8_t)) {
+                    in = _mm_slli_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + y))), 8);
+                }
+                else {
+                    in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + y));
+                }
+                __m128i lo = _mm_max_epi32(_mm_sub_epi32(_mm_unpacklo_epi16(in, zero), black), zero);
+                __m128i hi = _mm_max_epi32(_mm_sub_epi32(_mm_unpackhi_epi16(in, zero), black), zero);
+                lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+                hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+                // Saturates to 65535
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(d + y), _mm_packus_epi32(lo, hi));
+            }
+#endif
+            for (; y < w; ++y) {
+                correct(y);
+            }
+        }
+    }
+
+    void CorrectRows(const Bitmap& src, Bitmap& dest, const Correction& correction,
+                     size_t x_begin, size_t x_end) {
+        if (src.BytesPerPixel() == sizeof(uint8_t)) {
+            CorrectRowsOf<uint8_t>(src, dest, correction, x_begin, x_end);
+        }
+        else {
+            CorrectRowsOf<uint16_t>(src, dest, correction, x_begin, x_end);
+        }
+    }
+
+    void Correct(Bitmap& cfa, const Correction& correction, size_t threads, bool copy) {
+        PERF_SCOPE("Correct", cfa.Height() * cfa.Width())
+        for (size_t phase = 0; phase < 4; ++phase) {
+            // Throws before the processing
+            Factor(correction, phase);
+        }
+
+        size_t h = cfa.Height();
+        Bitmap result;
+        Bitmap* dest = &cfa;
+        if (copy || cfa.BytesPerPixel() != sizeof(uint16_t)) {
+            result = Bitmap(h, cfa.Width(), sizeof(uint16_t));
+            dest = &result;
+        }
+        size_t bands = (h + kBandRows - 1) / kBandRows;
+        sched::ParallelFor(bands, threads == 0 ? sched::DefaultThreads() : threads, [&](size_t band) {
+            size_t begin = band * kBandRows;
+            CorrectRows(cfa, *dest, correction, begin, std::min(begin + kBandRows, h));
+        });
+        if (dest == &result) {
+            cfa = std::move(result);
+        }
+    }
+} // namespace pre
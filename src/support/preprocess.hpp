@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include "bitmap.hpp"
+
+// Correction of the raw mosaic on load: black level, white balance and scaling.
+// It reads and writes every sample once. For 8-bit input it is the pass which
+// unpacks the samples to 16 bits. 16-bit input mapped without copying
+// (io/format/mapped.hpp) has no such pass: the correction copies the mosaic
+// out of the mapping, the one pass the zero-copy path saves otherwise. It is
+// not done in place, as every written page of a private mapping is copied
+// on write and stays resident next to the page cache of the file.
+//
+//      out = clamp((in - black) * gain * 65535 / (white - black), 0, 65535)
+//
+// Values are given per CFA phase (x & 1) * 2 + (y & 1), so both greens
+// may have their own black level.
+namespace pre {
+
+    struct Correction {
+        std::array<uint16_t, 4> black{0, 0, 0, 0};
+        std::array<float, 4> gain{1, 1, 1, 1};
+        // Level of the saturated sensor (in 16-bit units)
+        uint16_t white{65535};
+
+        // Per-color values placed on the phases of the native pattern (RGGB or GRBG)
+        static Correction ForColors(const std::array<uint16_t, 3>& black_rgb,
+                                    const std::array<float, 3>& gain_rgb, uint16_t white = 65535);
+
+        // No black level, unit gains and full range
+        bool IsIdentity() const;
+    };
+
+    // Writes corrected rows [x_begin, x_end) of 'src' to 'dest'
+    // src - Bitmap<uint8_t> (taken as value << 8) or Bitmap<uint16_t>
+    // dest - Bitmap<uint16_t> of the same size, may be 'src' itself
+    void CorrectRows(const Bitmap& src, Bitmap& dest, const Correction& correction,
+                     size_t x_begin, size_t x_end);
+
+    // 16-bit corrected mosaic in one pass by bands of rows in 'threads' threads
+    // (0 - sched::DefaultThreads()). A 16-bit 'cfa' is corrected in place unless
+    // 'copy' is set (mapped files), otherwise it is replaced
+    void Correct(Bitmap& cfa, const Correction& correction, size_t threads = 0, bool copy = false);
+} // namespace pre
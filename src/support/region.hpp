@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+
+// Rectangle of pixels [x_begin, x_end) x [y_begin, y_end)
+// x - row, y - column (as in Bitmap::Get)
+struct Region {
+    size_t x_begin{0}, x_end{0};
+    size_t y_begin{0}, y_end{0};
+
+    // Full rows [x_begin, x_end) of the image with width w
+    static Region Rows(size_t x_begin, size_t x_end, size_t w) {
+        return Region{x_begin, x_end, 0, w};
+    }
+
+    // Region extended by 'halo' pixels in every direction
+    // and clipped by the image h x w
+    Region Expanded(size_t halo, size_t h, size_t w) const {
+        return Region{
+            x_begin > halo ? x_begin - halo : 0, std::min(x_end + halo, h),
+            y_begin > halo ? y_begin - halo : 0, std::min(y_end + halo, w)
+        };
+    }
+
+    bool Empty() const {
+        return x_begin >= x_end || y_begin >= y_end;
+    }
+};
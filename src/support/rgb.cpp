@@ -1,23 +1,73 @@
 #pragma once
 #include "rgb.hpp"
 
+#if defined(SIMD)
+#include <immintrin.h>
+#endif
+
 namespace rgb {
+
+#if defined(SIMD)
+    namespace {
+        // Byte shuffles placing 8 pixels of R, G and B into 3 vectors of RGBRGB...:
+        // masks[vector][color] takes the words of the color for the vector
+        struct Interleave {
+            __m128i masks[3][3];
+
+            Interleave() {
+                for (int vector = 0; vector < 3; ++vector) {
+                    for (int color = 0; color < 3; ++color) {
+                        alignas(16) uint8_t bytes[16];
+                        for (int word = 0; word < 8; ++word) {
+                            int item = vector * 8 + word;
+                            bool taken = item % 3 == color;
+                            bytes[2 * word]     = taken ? static_cast<uint8_t>(2 * (item / 3))     : 0x80;
+                            bytes[2 * word + 1] = taken ? static_cast<uint8_t>(2 * (item / 3) + 1) : 0x80;
+                        }
+                        masks[vector][color] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+                    }
+                }
+            }
+        };
+    } // namespace
+#endif
+
     std::vector<uint16_t> PackRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B) {
+        std::vector<uint16_t> data(R.Height() * R.Width() * 3);
+        PackRGB(R, G, B, data.data());
+        return data;
+    }
+
+    void PackRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B, uint16_t* dest) {
         size_t h = R.Height();
         size_t w = R.Width();
-        size_t p = R.BytesPerPixel();
-        std::vector<uint16_t> data;
-        data.reserve(h * w * p);
 
         auto r = reinterpret_cast<const uint16_t*>(R.Data());
         auto g = reinterpret_cast<const uint16_t*>(G.Data());
         auto b = reinterpret_cast<const uint16_t*>(B.Data());
 
-        for (size_t i = 0; i < h * w; ++i) {
-            data.push_back(r[i]);
-            data.push_back(g[i]);
-            data.push_back(b[i]);
+        size_t i = 0;
+#if defined(SIMD)
+        static const Interleave kInterleave;
+        for (; i + 8 <= h * w; i += 8) {
+            __m128i colors[3] = {
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)),
+            };
+            for (int vector = 0; vector < 3; ++vector) {
+                const __m128i* masks = kInterleave.masks[vector];
+                __m128i packed = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(colors[0], masks[0]),
+                                                           _mm_shuffle_epi8(colors[1], masks[1])),
+                                              _mm_shuffle_epi8(colors[2], masks[2]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 3 * i + 8 * vector), packed);
+            }
+        }
+#endif
+        for (; i < h * w; ++i) {
+            dest[3 * i]     = r[i];
+            dest[3 * i + 1] = g[i];
+            dest[3 * i + 2] = b[i];
         }
-        return data;
     }
 } // namespace rgb
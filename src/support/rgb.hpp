@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "bitmap.hpp"
 
 namespace rgb {
@@ -10,4 +11,7 @@ namespace rgb {
     // Gathers all three layers into one image with structure RGBRGBRGB...
     // BE CAREFUL: All layers must have one size and bytes per pixel
     std::vector<uint16_t> PackRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B);
+
+    // The same writing to dest of 3 * height * width items
+    void PackRGB(const Bitmap& R, const Bitmap& G, const Bitmap& B, uint16_t* dest);
 } // namespace rgb
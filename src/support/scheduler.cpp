@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "scheduler.hpp"
+
+namespace sched {
+
+    Wavefront::Wavefront(size_t rows, size_t band_rows)
+        : rows_{rows},
+          band_rows_{std::max<size_t>(band_rows, 1)},
+          bands_{(rows + band_rows_ - 1) / band_rows_} {
+    }
+
+    size_t Wavefront::AddStage(RowKernel kernel) {
+        Stage stage;
+        stage.kernel = std::move(kernel);
+        stage.band_done.assign(bands_, 0);
+        stages_.push_back(std::move(stage));
+        return stages_.size() - 1;
+    }
+
+    void Wavefront::AddDependency(size_t stage, size_t upstream, size_t halo) {
+        stages_[stage].deps.push_back(Dependency{upstream, halo});
+    }
+
+    size_t Wavefront::BandEnd(size_t band) const {
+        return std::min((band + 1) * band_rows_, rows_);
+    }
+
+    bool Wavefront::IsReady(const Stage& stage) const {
+        if (stage.next_band >= bands_) {
+            return false;
+        }
+        size_t need = BandEnd(stage.next_band);
+        for (const auto& dep : stage.deps) {
+            if (stages_[dep.upstream].done_rows < std::min(need + dep.halo, rows_)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Wavefront::Work() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            // After a failure no band is released, the bands running are finished
+            if (error_) {
+                return;
+            }
+            // Prefer downstream stages: they free the rows of upstream ones
+            // while those are still in cache
+            Stage* ready = nullptr;
+            for (size_t s = stages_.size(); s-- > 0;) {
+                if (IsReady(stages_[s])) {
+                    ready = &stages_[s];
+                    break;
+                }
+            }
+            if (ready == nullptr) {
+                if (bands_left_ == 0) {
+                    return;
+                }
+                released_.wait(lock);
+                continue;
+            }
+
+            size_t band = ready->next_band++;
+            lock.unlock();
+            try {
+                ready->kernel(band * band_rows_, BandEnd(band));
+            }
+            catch (...) {
+                lock.lock();
+                // The first exception is rethrown by Run
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                released_.notify_all();
+                return;
+            }
+            lock.lock();
+
+            // Move the finished prefix of the stage
+            ready->band_done[band] = 1;
+            size_t first_undone = ready->done_rows / band_rows_;
+            while (first_undone < bands_ && ready->band_done[first_undone]) {
+                ++first_undone;
+            }
+            ready->done_rows = first_undone < bands_ ? first_undone * band_rows_ : rows_;
+            --bands_left_;
+            released_.notify_all();
+        }
+    }
+
+    void Wavefront::Run(size_t threads) {
+        bands_left_ = bands_ * stages_.size();
+        error_ = nullptr;
+        if (bands_left_ == 0) {
+            return;
+        }
+        threads = std::max<size_t>(threads, 1);
+
+        std::vector<std::thread> workers;
+        try {
+            for (size_t i = 1; i < threads; ++i) {
+                workers.emplace_back([this]() { Work(); });
+            }
+        }
+        catch (...) {
+            // No thread (system_error): the started workers stop and are joined below
+            std::lock_guard lock(mutex_);
+            error_ = std::current_exception();
+            released_.notify_all();
+        }
+        Work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    void ParallelFor(size_t count, size_t threads, const std::function<void(size_t)>& body) {
+        threads = std::min(std::max<size_t>(threads, 1), count);
+        std::atomic<size_t> next{0};
+        // The first exception is rethrown in the caller, other items are skipped
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto work = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    body(i);
+                }
+                catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    next = count;
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        try {
+            for (size_t i = 1; i < threads; ++i) {
+                workers.emplace_back(work);
+            }
+        }
+        catch (...) {
+            // No thread (system_error): the started workers stop and are joined below
+            std::lock_guard lock(error_mutex);
+            error = std::current_exception();
+            next = count;
+        }
+        work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t HardwareThreads() {
+        return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+    // 0 - not set
+    static std::atomic<size_t> default_threads{0};
+
+    size_t DefaultThreads() {
+#if defined(PARALLEL)
+        size_t threads = default_threads.load(std::memory_order_relaxed);
+        return threads != 0 ? threads : HardwareThreads();
+#else
+        return 1;
+#endif
+    }
+
+    void SetDefaultThreads(size_t threads) {
+        default_threads.store(threads, std::memory_order_relaxed);
+    }
+} // namespace sched
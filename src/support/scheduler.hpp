@@ -0,0 +1,82 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace sched {
+
+    // Computes rows [x_begin, x_end) of one pipeline stage
+    using RowKernel = std::function<void(size_t x_begin, size_t x_end)>;
+
+    // Dependency-driven row scheduler.
+    // Every stage is split into bands of 'band_rows' rows. A band is released
+    // as soon as the rows it reads are finished by all its upstream stages,
+    // so downstream stages start long before upstream stages are over.
+    //
+    // Bands of one stage are released in order, but may run concurrently
+    // BE CAREFUL: a kernel must not write rows outside of its band
+    class Wavefront {
+    public:
+        Wavefront(size_t rows, size_t band_rows);
+
+        // Adds a stage and returns its id
+        size_t AddStage(RowKernel kernel);
+
+        // Band [a, b) of 'stage' is released only when rows [0, b + halo)
+        // of 'upstream' are finished. 'upstream' must be added before 'stage'
+        void AddDependency(size_t stage, size_t upstream, size_t halo);
+
+        // Runs all stages using 'threads' threads (the caller is one of them)
+        // If a kernel throws or a thread cannot be started, no more bands are released,
+        // the bands running are finished and the first exception is rethrown
+        void Run(size_t threads);
+
+    private:
+        struct Dependency {
+            size_t upstream;
+            size_t halo;
+        };
+
+        struct Stage {
+            RowKernel kernel;
+            std::vector<Dependency> deps;
+            std::vector<char> band_done;
+            size_t next_band{0}; // first band not released yet
+            size_t done_rows{0}; // rows [0, done_rows) are finished
+        };
+
+        size_t BandEnd(size_t band) const;
+        bool IsReady(const Stage& stage) const;
+        void Work();
+
+        size_t rows_;
+        size_t band_rows_;
+        size_t bands_;
+        size_t bands_left_{0};
+        std::vector<Stage> stages_;
+        std::exception_ptr error_;
+
+        std::mutex mutex_;
+        std::condition_variable released_;
+    };
+
+    // Calls body(i) for every i in [0, count) using 'threads' threads
+    // (the caller is one of them). Items are taken one by one
+    // If body throws or a thread cannot be started, the rest items are skipped
+    // and the exception is rethrown
+    void ParallelFor(size_t count, size_t threads, const std::function<void(size_t)>& body);
+
+    // Number of threads to use for the whole-frame work
+    // All hardware threads unless changed by SetDefaultThreads
+    size_t DefaultThreads();
+
+    // Sets the result of DefaultThreads (0 - all hardware threads)
+    // BE CAREFUL: call it before the processing starts
+    void SetDefaultThreads(size_t threads);
+
+    // Number of hardware threads (at least 1)
+    size_t HardwareThreads();
+} // namespace sched
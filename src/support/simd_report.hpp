@@ -0,0 +1,18 @@
+#pragma once
+
+// Build-time report of the per-pixel operations without a vector path
+// (define SIMD_REPORT in /CMakeLists.txt). SCALAR_ONLY("name") placed next to
+// such an operation prints a compiler note, so the list stays in the code
+// and is printed by every build with the define.
+// Border parts of the vector operations are scalar by design and not listed:
+// an operation is listed until its interior gets a vector path.
+#define SIMD_REPORT_PRAGMA(text) _Pragma(#text)
+
+#if defined(SIMD_REPORT)
+#define SCALAR_ONLY(name) SIMD_REPORT_PRAGMA(message("Scalar only: " name))
+#if !defined(SIMD)
+#pragma message("SIMD is not defined: every operation is scalar")
+#endif
+#else
+#define SCALAR_ONLY(name)
+#endif
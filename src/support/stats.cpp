@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <stdexcept>
+#include "stats.hpp"
+#include "scheduler.hpp"
+#include "perf.hpp"
+#include "simd_report.hpp"
+
+namespace stats {
+
+    // Rows added as one task of AddLayer
+    constexpr size_t kBandRows = 32;
+
+    // Starts of 'count' equal parts of 'size' and the end
+    static std::vector<size_t> Split(size_t size, size_t count) {
+        std::vector<size_t> starts(count + 1);
+        for (size_t i = 0; i <= count; ++i) {
+            starts[i] = i * size / count;
+        }
+        return starts;
+    }
+
+    Accumulator::Accumulator(size_t h, size_t w, const Options& options)
+            : h_{h},
+              w_{w},
+              options_{options} {
+        if (options.histogram_bits == 0 || options.histogram_bits > 16
+            || options.zones_v == 0 || options.zones_h == 0) {
+            throw std::invalid_argument("Statistics need 1 to 16 histogram bits and at least one zone");
+        }
+        zone_rows_ = Split(h, options.zones_v);
+        zone_columns_ = Split(w, options.zones_h);
+    }
+
+    Accumulator::Partial* Accumulator::Acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            auto partial = std::make_unique<Partial>();
+            for (size_t c = 0; c < 3; ++c) {
+                partial->histogram[c].assign(4 * (size_t{1} << options_.histogram_bits), 0);
+                partial->zone_sums[c].assign(options_.zones_v * options_.zones_h, 0);
+            }
+            partials_.push_back(std::move(partial));
+            return partials_.back().get();
+        }
+        Partial* partial = free_.back();
+        free_.pop_back();
+        return partial;
+    }
+
+    void Accumulator::Release(Partial* partial) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(partial);
+    }
+
+    // Counts of the bins in 4 tables: increments of neighbouring samples falling
+    // into one bin do not wait for each other
+    SCALAR_ONLY("stats histogram")
+    static void CountBins(const uint16_t* row, size_t begin, size_t end, size_t shift, size_t bins, uint64_t* tables) {
+        size_t y = begin;
+        for (; y + 4 <= end; y += 4) {
+            ++tables[row[y] >> shift];
+            ++tables[bins + (row[y + 1] >> shift)];
+            ++tables[2 * bins + (row[y + 2] >> shift)];
+            ++tables[3 * bins + (row[y + 3] >> shift)];
+        }
+        for (; y < end; ++y) {
+            ++tables[row[y] >> shift];
+        }
+    }
+
+    void Accumulator::AddRows(Channel channel, const Bitmap& layer, size_t x_begin, size_t x_end) {
+        size_t bins = size_t{1} << options_.histogram_bits;
+        size_t shift = 16 - options_.histogram_bits;
+        uint16_t clip = options_.clip_level;
+        // The partial is the task's own until it is released
+        Partial* partial = Acquire();
+        uint64_t* tables = partial->histogram[channel].data();
+        uint64_t* sums = partial->zone_sums[channel].data();
+        uint64_t clipped = 0;
+
+        // Zone row of x_begin
+        size_t zone_v = std::upper_bound(zone_rows_.begin(), zone_rows_.end(), x_begin) - zone_rows_.begin() - 1;
+        for (size_t x = x_begin; x < x_end; ++x) {
+            while (x >= zone_rows_[zone_v + 1]) {
+                ++zone_v;
+            }
+            auto row = reinterpret_cast<const uint16_t*>(layer.Data()) + x * w_;
+            for (size_t zone_h = 0; zone_h < options_.zones_h; ++zone_h) {
+                // Sums and clipped samples are vectorized by the compiler
+                uint64_t sum = 0;
+                uint32_t clipped_row = 0;
+                for (size_t y = zone_columns_[zone_h]; y < zone_columns_[zone_h + 1]; ++y) {
+                    sum += row[y];
+                    clipped_row += row[y] >= clip;
+                }
+                sums[zone_v * options_.zones_h + zone_h] += sum;
+                clipped += clipped_row;
+            }
+            CountBins(row, 0, w_, shift, bins, tables);
+        }
+        partial->clipped[channel] += clipped;
+        Release(partial);
+    }
+
+    void Accumulator::AddLayer(Channel channel, const Bitmap& layer, size_t threads) {
+        PERF_SCOPE("Statistics", layer.Height() * layer.Width())
+        size_t bands = (h_ + kBandRows - 1) / kBandRows;
+        sched::ParallelFor(bands, threads, [&](size_t band) {
+            size_t begin = band * kBandRows;
+            AddRows(channel, layer, begin, std::min(begin + kBandRows, h_));
+        });
+    }
+
+    Stats Accumulator::Result() const {
+        Stats result;
+        result.options = options_;
+        size_t zones = options_.zones_v * options_.zones_h;
+        size_t bins = size_t{1} << options_.histogram_bits;
+        for (size_t c = 0; c < 3; ++c) {
+            result.histogram[c].assign(bins, 0);
+            std::vector<uint64_t> sums(zones, 0);
+            for (const auto& partial : partials_) {
+                const auto& tables = partial->histogram[c];
+                for (size_t i = 0; i < bins; ++i) {
+                    result.histogram[c][i] += tables[i] + tables[bins + i] + tables[2 * bins + i] + tables[3 * bins + i];
+                }
+                for (size_t i = 0; i < zones; ++i) {
+                    sums[i] += partial->zone_sums[c][i];
+                }
+                result.clipped[c] += partial->clipped[c];
+            }
+
+            uint64_t total = 0;
+            result.zone_mean[c].assign(zones, 0);
+            for (size_t zone_v = 0; zone_v < options_.zones_v; ++zone_v) {
+                for (size_t zone_h = 0; zone_h < options_.zones_h; ++zone_h) {
+                    size_t i = zone_v * options_.zones_h + zone_h;
+                    size_t pixels = (zone_rows_[zone_v + 1] - zone_rows_[zone_v])
+                                    * (zone_columns_[zone_h + 1] - zone_columns_[zone_h]);
+                    if (pixels != 0) {
+                        result.zone_mean[c][i] = static_cast<double>(sums[i]) / pixels;
+                    }
+                    total += sums[i];
+                }
+            }
+            if (h_ * w_ != 0) {
+                result.mean[c] = static_cast<double>(total) / (h_ * w_);
+            }
+        }
+        return result;
+    }
+
+    void WriteJSON(const Stats& stats, std::ostream& out) {
+        const char* names[3] = {"red", "green", "blue"};
+        out << "{\n";
+        out << "  \"histogram_bits\": " << stats.options.histogram_bits << ",\n";
+        out << "  \"zones\": [" << stats.options.zones_v << ", " << stats.options.zones_h << "],\n";
+        out << "  \"clip_level\": " << stats.options.clip_level << ",\n";
+        for (size_t c = 0; c < 3; ++c) {
+            out << "  \"" << names[c] << "\": {\n";
+            out << "    \"mean\": " << stats.mean[c] << ",\n";
+            out << "    \"clipped\": " << stats.clipped[c] << ",\n";
+            out << "    \"zone_mean\": [";
+            for (size_t i = 0; i < stats.zone_mean[c].size(); ++i) {
+                out << (i == 0 ? "" : ", ") << stats.zone_mean[c][i];
+            }
+            out << "],\n";
+            out << "    \"histogram\": [";
+            for (size_t i = 0; i < stats.histogram[c].size(); ++i) {
+                out << (i == 0 ? "" : ", ") << stats.histogram[c][i];
+            }
+            out << "]\n";
+            out << "  }" << (c < 2 ? "," : "") << '\n';
+        }
+        out << "}\n";
+    }
+} // namespace stats
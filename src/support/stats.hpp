@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "bitmap.hpp"
+
+// Statistics of the demosaiced frame for auto exposure and white balance:
+// per-channel histograms, means of a grid of zones and clipped samples.
+// The pipeline adds the rows of green after the posteriori decision and the rows
+// of red and blue after FillRBonRB, while they are still in cache, so no extra
+// pass over the image is needed. With REFINE they are the values before refining.
+//
+// Every concurrent task takes its own partial statistics, they are merged
+// only by Result().
+namespace stats {
+
+    enum Channel { RED, GREEN, BLUE };
+
+    struct Options {
+        // Histogram of 2^bits bins of the high bits of the samples
+        size_t histogram_bits{8};
+        // Grid of zones (rows x columns)
+        size_t zones_v{8}, zones_h{8};
+        // Samples >= clip level are clipped
+        uint16_t clip_level{65535};
+    };
+
+    struct Stats {
+        Options options;
+        std::array<std::vector<uint64_t>, 3> histogram;
+        // Mean of every zone, rows of zones one after another
+        // (0 for zones without pixels in small images)
+        std::array<std::vector<double>, 3> zone_mean;
+        std::array<uint64_t, 3> clipped{0, 0, 0};
+        std::array<double, 3> mean{0, 0, 0};
+    };
+
+    // Writes the statistics as a JSON object
+    void WriteJSON(const Stats& stats, std::ostream& out);
+
+    class Accumulator {
+    public:
+        // Statistics of an h x w frame
+        Accumulator(size_t h, size_t w, const Options& options = {});
+
+        // Adds rows [x_begin, x_end) of the channel, Bitmap<uint16_t>
+        // May be called concurrently for different rows
+        void AddRows(Channel channel, const Bitmap& layer, size_t x_begin, size_t x_end);
+
+        // Adds the whole layer by bands of rows in 'threads' threads
+        void AddLayer(Channel channel, const Bitmap& layer, size_t threads);
+
+        // Merges the partial statistics
+        // BE CAREFUL: call it when no rows are being added
+        Stats Result() const;
+
+    private:
+        // Counted into directly while a task holds it: no scratch tables per task
+        struct Partial {
+            // 4 tables of the bins one after another (see CountBins in stats.cpp)
+            std::array<std::vector<uint64_t>, 3> histogram;
+            std::array<std::vector<uint64_t>, 3> zone_sums;
+            std::array<uint64_t, 3> clipped{0, 0, 0};
+        };
+
+        Partial* Acquire();
+        void Release(Partial* partial);
+
+        size_t h_, w_;
+        Options options_;
+        // First row and column of every zone and the end
+        std::vector<size_t> zone_rows_, zone_columns_;
+
+        std::mutex mutex_;
+        // One partial per task running at once
+        std::vector<std::unique_ptr<Partial>> partials_;
+        std::vector<Partial*> free_;
+    };
+} // namespace stats
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Vector helpers of the operations on one CFA phase of a row.
+// Interpolation and refining change every second pixel of a row, so 4 target
+// pixels y, y + 2, y + 4, y + 6 are taken as the 32-bit lanes of a vector
+// from 8 consecutive values: the sums are exact in int and the clamp
+// to uint16_t is the unsigned saturation of the pack.
+//
+// The 16-bit buffers of REFINE16 take 8 target pixels as 16-bit lanes
+// from 16 consecutive values.
+//
+// Loads read 8 (16) values from the pointer, the last row of a bitmap has them
+// because of DATA_SAFE_OFFSET in bitmap.hpp.
+// BE CAREFUL: stores write only the target lanes, the other pixels of the row
+// may belong to another stage running concurrently (see pipeline/wavefront.hpp)
+#if defined(SIMD)
+#include <immintrin.h>
+
+namespace strided {
+
+    // Pixels of a row taken by one vector
+    constexpr size_t kStep = 8;
+    // Offset of the last target pixel of a vector
+    constexpr size_t kLast = 6;
+
+    // Values p[0], p[2], p[4], p[6] as int
+    inline __m128i LoadU16(const uint16_t* p) {
+        __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        return _mm_blend_epi16(row, _mm_setzero_si128(), 0xAA);
+    }
+
+    inline __m128i LoadI16(const int16_t* p) {
+        __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        // Sign extension of the low halves of the lanes
+        return _mm_srai_epi32(_mm_slli_epi32(row, 16), 16);
+    }
+
+    inline __m128i LoadI32(const int* p) {
+        __m128 low  = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        __m128 high = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4)));
+        return _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+
+    // mask < 0 ? negative : other, lane by lane
+    inline __m128i SelectNegative(__m128i mask, __m128i negative, __m128i other) {
+        return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(other), _mm_castsi128_ps(negative),
+                                              _mm_castsi128_ps(mask)));
+    }
+
+    // v / 3 rounded toward zero like int division: the high half of v * (2^32 + 2) / 3
+    // plus one for negative v
+    inline __m128i Div3(__m128i v) {
+        const __m128i magic = _mm_set1_epi32(0x55555556);
+        __m128i even = _mm_srli_epi64(_mm_mul_epi32(v, magic), 32);
+        __m128i odd  = _mm_mul_epi32(_mm_srli_epi64(v, 32), magic);
+        __m128i quotient = _mm_blend_epi16(even, odd, 0xCC);
+        return _mm_sub_epi32(quotient, _mm_srai_epi32(v, 31));
+    }
+
+    // Sets p[0], p[2], p[4], p[6] to the lanes clamped to [0, UINT16_MAX]
+    inline void StoreU16(uint16_t* p, __m128i v) {
+        __m128i packed = _mm_packus_epi32(v, v);
+        p[0] = static_cast<uint16_t>(_mm_extract_epi16(packed, 0));
+        p[2] = static_cast<uint16_t>(_mm_extract_epi16(packed, 1));
+        p[4] = static_cast<uint16_t>(_mm_extract_epi16(packed, 2));
+        p[6] = static_cast<uint16_t>(_mm_extract_epi16(packed, 3));
+    }
+
+    // 16-bit lanes: 8 target pixels y, y + 2, ..., y + 14 from 16 values
+    constexpr size_t kStep16 = 16;
+    constexpr size_t kLast16 = 14;
+
+    // Values p[0], p[2], ..., p[14] (uint16_t or int16_t) as 16-bit lanes
+    inline __m128i LoadEven16(const void* p) {
+        auto v = reinterpret_cast<const __m128i*>(p);
+        const __m128i low_halves = _mm_set1_epi32(0xFFFF);
+        return _mm_packus_epi32(_mm_and_si128(_mm_loadu_si128(v), low_halves),
+                                _mm_and_si128(_mm_loadu_si128(v + 1), low_halves));
+    }
+
+    // Signs of p[0], p[2], ..., p[14]: all bits set for negative values
+    inline __m128i NegativeEven16(const int* p) {
+        __m128i packed = _mm_packs_epi32(LoadI32(p), LoadI32(p + 8));
+        return _mm_cmplt_epi16(packed, _mm_setzero_si128());
+    }
+
+    // Sets p[0], p[2], ..., p[14] to the lanes
+    inline void StoreEven16(uint16_t* p, __m128i v) {
+        p[0]  = static_cast<uint16_t>(_mm_extract_epi16(v, 0));
+        p[2]  = static_cast<uint16_t>(_mm_extract_epi16(v, 1));
+        p[4]  = static_cast<uint16_t>(_mm_extract_epi16(v, 2));
+        p[6]  = static_cast<uint16_t>(_mm_extract_epi16(v, 3));
+        p[8]  = static_cast<uint16_t>(_mm_extract_epi16(v, 4));
+        p[10] = static_cast<uint16_t>(_mm_extract_epi16(v, 5));
+        p[12] = static_cast<uint16_t>(_mm_extract_epi16(v, 6));
+        p[14] = static_cast<uint16_t>(_mm_extract_epi16(v, 7));
+    }
+} // namespace strided
+#endif
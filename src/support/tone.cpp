@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "tone.hpp"
+#include "scheduler.hpp"
+#include "perf.hpp"
+
+#if defined(SIMD)
+#include <immintrin.h>
+#endif
+
+namespace tone {
+
+    // Rows converted as one task of Apply
+    constexpr size_t kBandRows = 32;
+
+    static uint8_t Round8(double value) {
+        return static_cast<uint8_t>(std::clamp(std::lround(value * 255.0), 0L, 255L));
+    }
+
+    ToneCurve ToneCurve::Linear() {
+        ToneCurve curve;
+        for (size_t i = 0; i < kEntries; ++i) {
+            curve.lut_[i] = static_cast<uint8_t>((i * 255 + 32767) / 65535);
+        }
+        return curve;
+    }
+
+    ToneCurve ToneCurve::Gamma(double gamma) {
+        if (!(gamma > 0)) {
+            throw std::invalid_argument("Gamma must be positive");
+        }
+        ToneCurve curve;
+        for (size_t i = 0; i < kEntries; ++i) {
+            curve.lut_[i] = Round8(std::pow(i / 65535.0, 1.0 / gamma));
+        }
+        return curve;
+    }
+
+    ToneCurve ToneCurve::SRGB() {
+        ToneCurve curve;
+        for (size_t i = 0; i < kEntries; ++i) {
+            double v = i / 65535.0;
+            curve.lut_[i] = Round8(v <= 0.0031308 ? 12.92 * v : 1.055 * std::pow(v, 1 / 2.4) - 0.055);
+        }
+        return curve;
+    }
+
+    ToneCurve ToneCurve::FromPoints(const std::vector<std::pair<uint32_t, uint32_t>>& points) {
+        if (points.empty()) {
+            throw std::invalid_argument("Tone curve has no points");
+        }
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (points[i].first >= kEntries || points[i].second > 255
+                || (i > 0 && points[i].first <= points[i - 1].first)) {
+                throw std::invalid_argument("Tone curve points must be sorted, input < 65536, output < 256");
+            }
+        }
+
+        ToneCurve curve;
+        size_t next = 0; // the first point with input > i
+        for (size_t i = 0; i < kEntries; ++i) {
+            while (next < points.size() && points[next].first <= i) {
+                ++next;
+            }
+            if (next == 0) {
+                curve.lut_[i] = static_cast<uint8_t>(points.front().second);
+            }
+            else if (next == points.size()) {
+                curve.lut_[i] = static_cast<uint8_t>(points.back().second);
+            }
+            else {
+                const auto& [x0, y0] = points[next - 1];
+                const auto& [x1, y1] = points[next];
+                double t = static_cast<double>(i - x0) / (x1 - x0);
+                curve.lut_[i] = static_cast<uint8_t>(std::lround(y0 + t * (static_cast<double>(y1) - y0)));
+            }
+        }
+        return curve;
+    }
+
+    ToneCurve ToneCurve::Load(const char* path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error(std::string("Cannot open tone curve ") + path);
+        }
+        std::vector<std::pair<uint32_t, uint32_t>> points;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream values(line);
+            uint32_t input, output;
+            if (!(values >> input >> output)) {
+                throw std::runtime_error(std::string("Broken tone curve line: ") + line);
+            }
+            points.emplace_back(input, output);
+        }
+        return FromPoints(points);
+    }
+
+    ToneCurve ToneCurve::Parse(const char* description) {
+        std::string text = description;
+        if (text == "linear") {
+            return Linear();
+        }
+        if (text == "srgb") {
+            return SRGB();
+        }
+        if (text.rfind("gamma:", 0) == 0) {
+            return Gamma(std::stod(text.substr(6)));
+        }
+        return Load(description);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Conversion:
+
+    void ApplyRows(const Bitmap& src, Bitmap& dest, const ToneCurve& curve, size_t x_begin, size_t x_end) {
+        size_t w = src.Width();
+        auto s = reinterpret_cast<const uint16_t*>(src.Data()) + x_begin * w;
+        auto d = dest.Data() + x_begin * w;
+        const uint8_t* lut = curve.Table();
+        size_t count = (x_end - x_begin) * w;
+
+        size_t i = 0;
+#if defined(SIMD)
+        // There is no gather of bytes: indices are loaded and results stored
+        // by 16, the lookups are independent loads the core issues in parallel
+        for (; i + 16 <= count; i += 16) {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8));
+            __m128i out = _mm_cvtsi32_si128(lut[_mm_extract_epi16(lo, 0)]);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 1)], 1);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 2)], 2);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 3)], 3);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 4)], 4);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 5)], 5);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 6)], 6);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(lo, 7)], 7);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 0)], 8);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 1)], 9);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 2)], 10);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 3)], 11);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 4)], 12);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 5)], 13);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 6)], 14);
+            out = _mm_insert_epi8(out, lut[_mm_extract_epi16(hi, 7)], 15);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), out);
+        }
+#endif
+        for (; i < count; ++i) {
+            d[i] = lut[s[i]];
+        }
+    }
+
+    rgb::BitmapRGB Create8Bit(size_t h, size_t w) {
+        return rgb::BitmapRGB{
+            Bitmap{h, w, sizeof(uint8_t)},
+            Bitmap{h, w, sizeof(uint8_t)},
+            Bitmap{h, w, sizeof(uint8_t)}
+        };
+    }
+
+    rgb::BitmapRGB Apply(const rgb::BitmapRGB& image, const ToneCurve& curve, size_t threads) {
+        PERF_SCOPE("Tone", image.G.Height() * image.G.Width())
+        size_t h = image.G.Height();
+        auto result = Create8Bit(h, image.G.Width());
+        size_t bands = (h + kBandRows - 1) / kBandRows;
+        // All layers of a band at once: its rows are read once from memory
+        sched::ParallelFor(bands, threads == 0 ? sched::DefaultThreads() : threads, [&](size_t band) {
+            size_t begin = band * kBandRows;
+            size_t end = std::min(begin + kBandRows, h);
+            ApplyRows(image.R, result.R, curve, begin, end);
+            ApplyRows(image.G, result.G, curve, begin, end);
+            ApplyRows(image.B, result.B, curve, begin, end);
+        });
+        return result;
+    }
+} // namespace tone
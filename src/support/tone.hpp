@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bitmap.hpp"
+#include "rgb.hpp"
+
+// 16 -> 8 bit output: every sample goes through a lookup table of the tone curve.
+// The table has an entry per 16-bit value (64 KB), so a lookup is one load
+// from L2 and any curve costs the same.
+namespace tone {
+
+    class ToneCurve {
+    public:
+        // Keeps the 8 high bits (rounded)
+        static ToneCurve Linear();
+        // out = in ^ (1 / gamma)
+        static ToneCurve Gamma(double gamma);
+        // sRGB transfer function (IEC 61966-2-1)
+        static ToneCurve SRGB();
+        // Linear interpolation between points {input 0..65535, output 0..255}
+        // sorted by input. Inputs out of the points take the nearest one
+        // Exception if the points are empty, unsorted or out of range
+        static ToneCurve FromPoints(const std::vector<std::pair<uint32_t, uint32_t>>& points);
+        // Points of FromPoints from a text file of "input output" lines,
+        // lines beginning with '#' are skipped
+        // Exception on failure
+        static ToneCurve Load(const char* path);
+        // "linear", "srgb", "gamma:<value>" or the path of a file for Load
+        // Exception on failure
+        static ToneCurve Parse(const char* description);
+
+        uint8_t operator ()(uint16_t value) const { return lut_[value]; }
+        const uint8_t* Table() const { return lut_.data(); }
+
+    private:
+        ToneCurve() : lut_(kEntries) {}
+
+        static constexpr size_t kEntries = 1 << 16;
+        std::vector<uint8_t> lut_;
+    };
+
+    // Writes curve(src) to the rows [x_begin, x_end) of dest
+    // src - Bitmap<uint16_t>, dest - Bitmap<uint8_t> of the same size
+    void ApplyRows(const Bitmap& src, Bitmap& dest, const ToneCurve& curve, size_t x_begin, size_t x_end);
+
+    // 8-bit layers of the image, converted in one pass by bands of rows
+    // in 'threads' threads (0 - sched::DefaultThreads())
+    rgb::BitmapRGB Apply(const rgb::BitmapRGB& image, const ToneCurve& curve, size_t threads = 0);
+
+    // Allocates 8-bit layers for an h x w image
+    rgb::BitmapRGB Create8Bit(size_t h, size_t w);
+} // namespace tone
@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include "yuv.hpp"
+#include "scheduler.hpp"
+#include "perf.hpp"
+
+#if defined(SIMD)
+#include <immintrin.h>
+#endif
+
+namespace yuv {
+
+    // Rows converted as one task of Convert, even for 4:2:0
+    constexpr size_t kBandRows = 32;
+    // Fixed point of the coefficients: the sums stay in int for 10 bits
+    // and the sums of 2x2 blocks
+    constexpr int kShift = 20;
+
+    // Sample = clamp((k[0] * R + k[1] * G + k[2] * B + bias) >> kShift, 0, max)
+    struct Coefficients {
+        int y[3];  // of the pixel
+        int cb[3]; // of the sums of a 2x2 block
+        int cr[3];
+        int y_bias;
+        int c_bias;
+        int max;
+    };
+
+    static bool Is420(Format format) {
+        return format != Format::I422;
+    }
+
+    static Coefficients MakeCoefficients(Matrix matrix, Format format) {
+        double kr = matrix == Matrix::BT601 ? 0.299 : 0.2126;
+        double kb = matrix == Matrix::BT601 ? 0.114 : 0.0722;
+        // Limited range: Y in [16, 235], Cb and Cr in [16, 240], 4 times more for 10 bits
+        int scale = format == Format::P010 ? 4 : 1;
+        double one = static_cast<double>(1 << kShift) / 65535;
+        double y_unit = 219.0 * scale * one;
+        double c_unit = 224.0 * scale * one / 4;
+
+        Coefficients c;
+        c.y[0] = static_cast<int>(std::lround(kr * y_unit));
+        c.y[2] = static_cast<int>(std::lround(kb * y_unit));
+        // Weights of white sum to the whole range, of grey chroma to zero
+        c.y[1] = static_cast<int>(std::lround(y_unit)) - c.y[0] - c.y[2];
+        c.cb[0] = static_cast<int>(std::lround(-kr / (2 * (1 - kb)) * c_unit));
+        c.cb[2] = static_cast<int>(std::lround(0.5 * c_unit));
+        c.cb[1] = -c.cb[0] - c.cb[2];
+        c.cr[0] = static_cast<int>(std::lround(0.5 * c_unit));
+        c.cr[2] = static_cast<int>(std::lround(-kb / (2 * (1 - kr)) * c_unit));
+        c.cr[1] = -c.cr[0] - c.cr[2];
+        c.y_bias = ((16 * scale) << kShift) + (1 << (kShift - 1));
+        c.c_bias = ((128 * scale) << kShift) + (1 << (kShift - 1));
+        c.max = 256 * scale - 1;
+        return c;
+    }
+
+    Format ParseFormat(const char* name) {
+        std::string text = name;
+        if (text == "nv12") {
+            return Format::NV12;
+        }
+        if (text == "i420") {
+            return Format::I420;
+        }
+        if (text == "i422") {
+            return Format::I422;
+        }
+        if (text == "p010") {
+            return Format::P010;
+        }
+        throw std::invalid_argument("Unknown YUV format " + text + ", expected nv12, i420, i422 or p010");
+    }
+
+    Image Create(Format format, size_t h, size_t w) {
+        size_t ch = Is420(format) ? (h + 1) / 2 : h;
+        size_t cw = (w + 1) / 2;
+        switch (format) {
+            case Format::NV12:
+                return Image{format, Bitmap{h, w, sizeof(uint8_t)}, Bitmap{ch, cw, 2 * sizeof(uint8_t)}, Bitmap{}};
+            case Format::P010:
+                return Image{format, Bitmap{h, w, sizeof(uint16_t)}, Bitmap{ch, cw, 2 * sizeof(uint16_t)}, Bitmap{}};
+            case Format::I420:
+            case Format::I422:
+                break;
+        }
+        return Image{format, Bitmap{h, w, sizeof(uint8_t)}, Bitmap{ch, cw, sizeof(uint8_t)},
+                     Bitmap{ch, cw, sizeof(uint8_t)}};
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////
+    // Conversion:
+
+    template <typename T>
+    static T* Row(Bitmap& b, size_t x) {
+        return reinterpret_cast<T*>(b.Data() + x * b.Width() * b.BytesPerPixel());
+    }
+
+    static const uint16_t* Row(const Bitmap& b, size_t x) {
+        return reinterpret_cast<const uint16_t*>(b.Data()) + x * b.Width();
+    }
+
+    static int Sample(const int (&k)[3], int bias, int max, int r, int g, int b) {
+        return std::clamp((k[0] * r + k[1] * g + k[2] * b + bias) >> kShift, 0, max);
+    }
+
+#if defined(SIMD)
+    static __m128i Sample(const int (&k)[3], int bias, int max, __m128i r, __m128i g, __m128i b) {
+        __m128i sum = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(k[0])),
+                                    _mm_mullo_epi32(g, _mm_set1_epi32(k[1])));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(b, _mm_set1_epi32(k[2])));
+        sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(bias)), kShift);
+        return _mm_min_epi32(_mm_max_epi32(sum, _mm_setzero_si128()), _mm_set1_epi32(max));
+    }
+
+    // Sums of the pixel pairs 2j, 2j + 1 of the 8 values at p as int
+    static __m128i PairSums(const uint16_t* p) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        return _mm_add_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFFFF)), _mm_srli_epi32(v, 16));
+    }
+#endif
+
+    // Rows of R, G, B
+    using Rows = std::array<const uint16_t*, 3>;
+
+    static Rows RowsOf(const Bitmap* const (&layers)[3], size_t x) {
+        return Rows{Row(*layers[0], x), Row(*layers[1], x), Row(*layers[2], x)};
+    }
+
+    // 10-bit samples of P010 are kept in the high bits
+    template <typename T>
+    constexpr int kStoreShift = sizeof(T) == sizeof(uint16_t) ? 6 : 0;
+
+    template <bool kVector, typename T>
+    static void LumaRow(const Rows& rgb, T* dest, const Coefficients& c, size_t w) {
+        size_t y = 0;
+#if defined(SIMD)
+        if constexpr (kVector) {
+            const __m128i zero = _mm_setzero_si128();
+            for (; y + 8 <= w; y += 8) {
+                __m128i v[3];
+                for (size_t i = 0; i < 3; ++i) {
+                    v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb[i] + y));
+                }
+                __m128i low = Sample(c.y, c.y_bias, c.max, _mm_cvtepu16_epi32(v[0]), _mm_cvtepu16_epi32(v[1]),
+                                     _mm_cvtepu16_epi32(v[2]));
+                __m128i high = Sample(c.y, c.y_bias, c.max, _mm_unpackhi_epi16(v[0], zero),
+                                      _mm_unpackhi_epi16(v[1], zero), _mm_unpackhi_epi16(v[2], zero));
+                __m128i packed = _mm_packus_epi32(low, high);
+                if constexpr (sizeof(T) == sizeof(uint8_t)) {
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + y), _mm_packus_epi16(packed, packed));
+                }
+                else {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + y), _mm_slli_epi16(packed, kStoreShift<T>));
+                }
+            }
+        }
+#endif
+        for (; y < w; ++y) {
+            dest[y] = static_cast<T>(Sample(c.y, c.y_bias, c.max, rgb[0][y], rgb[1][y], rgb[2][y]) << kStoreShift<T>);
+        }
+    }
+
+    // Chroma of the blocks of rows top and bottom (the same row at the last odd
+    // row and for 4:2:2), Cb to u[j * step] and Cr to v[j * step]
+    template <bool kVector, typename T, bool kInterleaved>
+    static void ChromaRow(const Rows& top, const Rows& bottom,
+                          T* u, T* v, const Coefficients& c, size_t w) {
+        constexpr size_t step = kInterleaved ? 2 : 1;
+        size_t cw = (w + 1) / 2;
+        size_t j = 0;
+#if defined(SIMD)
+        if constexpr (kVector) {
+            for (; 2 * j + 8 <= w; j += 4) {
+                __m128i sum[3];
+                for (size_t i = 0; i < 3; ++i) {
+                    sum[i] = _mm_add_epi32(PairSums(top[i] + 2 * j), PairSums(bottom[i] + 2 * j));
+                }
+                __m128i cb = Sample(c.cb, c.c_bias, c.max, sum[0], sum[1], sum[2]);
+                __m128i cr = Sample(c.cr, c.c_bias, c.max, sum[0], sum[1], sum[2]);
+                if constexpr (!kInterleaved) {
+                    __m128i packed = _mm_packus_epi32(cb, cr);
+                    packed = _mm_packus_epi16(packed, packed);
+                    int cb4 = _mm_cvtsi128_si32(packed);
+                    int cr4 = _mm_extract_epi32(packed, 1);
+                    std::memcpy(u + j, &cb4, sizeof(cb4));
+                    std::memcpy(v + j, &cr4, sizeof(cr4));
+                }
+                else if constexpr (sizeof(T) == sizeof(uint8_t)) {
+                    __m128i pairs = _mm_or_si128(cb, _mm_slli_epi32(cr, 16));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(u + 2 * j), _mm_packus_epi16(pairs, pairs));
+                }
+                else {
+                    __m128i pairs = _mm_or_si128(_mm_slli_epi32(cb, kStoreShift<T>),
+                                                 _mm_slli_epi32(cr, 16 + kStoreShift<T>));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(u + 2 * j), pairs);
+                }
+            }
+        }
+#endif
+        for (; j < cw; ++j) {
+            size_t left = 2 * j;
+            size_t right = std::min(left + 1, w - 1);
+            int sum[3];
+            for (size_t i = 0; i < 3; ++i) {
+                sum[i] = top[i][left] + top[i][right] + bottom[i][left] + bottom[i][right];
+            }
+            u[j * step] = static_cast<T>(Sample(c.cb, c.c_bias, c.max, sum[0], sum[1], sum[2]) << kStoreShift<T>);
+            v[j * step] = static_cast<T>(Sample(c.cr, c.c_bias, c.max, sum[0], sum[1], sum[2]) << kStoreShift<T>);
+        }
+    }
+
+    template <bool kVector, typename T, bool kInterleaved>
+    static void ConvertRowsAs(const Bitmap* const (&layers)[3], Image& image, const Coefficients& c,
+                              size_t x_begin, size_t x_end) {
+        size_t h = image.Y.Height();
+        size_t w = image.Y.Width();
+        for (size_t x = x_begin; x < x_end; ++x) {
+            LumaRow<kVector, T>(RowsOf(layers, x), Row<T>(image.Y, x), c, w);
+        }
+
+        bool subsampled = Is420(image.format);
+        for (size_t x = x_begin; x < x_end; x += subsampled ? 2 : 1) {
+            Rows top = RowsOf(layers, x);
+            Rows bottom = RowsOf(layers, subsampled ? std::min(x + 1, h - 1) : x);
+            size_t cx = subsampled ? x / 2 : x;
+            T* u = Row<T>(image.U, cx);
+            T* v = kInterleaved ? u + 1 : Row<T>(image.V, cx);
+            ChromaRow<kVector, T, kInterleaved>(top, bottom, u, v, c, w);
+        }
+    }
+
+    template <bool kVector>
+    static void ConvertRowsVariant(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                                   Image& image, Matrix matrix, size_t x_begin, size_t x_end) {
+        const Bitmap* const layers[3] = {&R, &G, &B};
+        auto c = MakeCoefficients(matrix, image.format);
+        switch (image.format) {
+            case Format::NV12:
+                ConvertRowsAs<kVector, uint8_t, true>(layers, image, c, x_begin, x_end);
+                break;
+            case Format::I420:
+            case Format::I422:
+                ConvertRowsAs<kVector, uint8_t, false>(layers, image, c, x_begin, x_end);
+                break;
+            case Format::P010:
+                ConvertRowsAs<kVector, uint16_t, true>(layers, image, c, x_begin, x_end);
+                break;
+        }
+    }
+
+    void ConvertRowsSimple(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                           Image& image, Matrix matrix, size_t x_begin, size_t x_end) {
+        ConvertRowsVariant<false>(R, G, B, image, matrix, x_begin, x_end);
+    }
+
+    void ConvertRowsWithSIMD(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                             Image& image, Matrix matrix, size_t x_begin, size_t x_end) {
+        ConvertRowsVariant<true>(R, G, B, image, matrix, x_begin, x_end);
+    }
+
+    void ConvertRows(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                     Image& image, Matrix matrix, size_t x_begin, size_t x_end) {
+#if defined(SIMD)
+        ConvertRowsWithSIMD(R, G, B, image, matrix, x_begin, x_end);
+#else
+        ConvertRowsSimple(R, G, B, image, matrix, x_begin, x_end);
+#endif
+    }
+
+    Image Convert(const rgb::BitmapRGB& rgb, Format format, Matrix matrix, size_t threads) {
+        PERF_SCOPE("YUV", rgb.G.Height() * rgb.G.Width())
+        size_t h = rgb.G.Height();
+        auto image = Create(format, h, rgb.G.Width());
+        size_t bands = (h + kBandRows - 1) / kBandRows;
+        sched::ParallelFor(bands, threads == 0 ? sched::DefaultThreads() : threads, [&](size_t band) {
+            size_t begin = band * kBandRows;
+            ConvertRows(rgb.R, rgb.G, rgb.B, image, matrix, begin, std::min(begin + kBandRows, h));
+        });
+        return image;
+    }
+
+    void Write(const Image& image, std::ostream& out) {
+        for (const Bitmap* plane : {&image.Y, &image.U, &image.V}) {
+            out.write(reinterpret_cast<const char*>(plane->Data()),
+                      static_cast<std::streamsize>(plane->Height() * plane->Width() * plane->BytesPerPixel()));
+        }
+    }
+
+    void Save(const Image& image, const char* path) {
+        std::ofstream file(path, std::ios::binary);
+        Write(image, file);
+        if (!file) {
+            throw std::runtime_error(std::string("Cannot write ") + path);
+        }
+    }
+} // namespace yuv
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include "bitmap.hpp"
+#include "rgb.hpp"
+
+// YCbCr output for video encoders: luma of every pixel and chroma of 2x2
+// (4:2:0) or 2x1 (4:2:2) blocks computed from the final R, G, B rows,
+// limited range. With WAVEFRONT the rows are converted inside the pipeline
+// (menon::DemosaicingYUV), so the RGB image is never read again.
+//
+// Chroma of a block is the one of its mean R, G, B. Blocks at the odd last
+// row or column repeat it.
+namespace yuv {
+
+    enum class Format {
+        NV12, // 8-bit Y plane and one plane of interleaved Cb, Cr, 4:2:0
+        I420, // 8-bit Y, Cb and Cr planes, 4:2:0
+        I422, // 8-bit Y, Cb and Cr planes, 4:2:2
+        P010, // 10-bit samples in the high bits of 16, Y and interleaved CbCr, 4:2:0
+    };
+
+    enum class Matrix {
+        BT601,
+        BT709,
+    };
+
+    // "nv12", "i420", "i422" or "p010"
+    // Exception if the name is unknown
+    Format ParseFormat(const char* name);
+
+    // Planes of one frame. The interleaved CbCr plane of NV12 and P010 is U
+    // with a pixel per Cb, Cr pair, V is empty then
+    struct Image {
+        Format format;
+        Bitmap Y, U, V;
+    };
+
+    Image Create(Format format, size_t h, size_t w);
+
+    // Writes the rows [x_begin, x_end) of the image from the 16-bit layers R, G, B
+    // and the chroma of the blocks starting in them
+    // BE CAREFUL: for 4:2:0 x_begin must be even, x_end even or the height
+    void ConvertRowsSimple(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                           Image& image, Matrix matrix, size_t x_begin, size_t x_end);
+    void ConvertRowsWithSIMD(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                             Image& image, Matrix matrix, size_t x_begin, size_t x_end);
+    void ConvertRows(const Bitmap& R, const Bitmap& G, const Bitmap& B,
+                     Image& image, Matrix matrix, size_t x_begin, size_t x_end);
+
+    // The image converted in one pass by bands of rows
+    // in 'threads' threads (0 - sched::DefaultThreads())
+    Image Convert(const rgb::BitmapRGB& rgb, Format format, Matrix matrix = Matrix::BT709, size_t threads = 0);
+
+    // Writes the planes one after another (raw .yuv of ffmpeg and encoders),
+    // frames of a video follow each other
+    void Write(const Image& image, std::ostream& out);
+
+    // Exception on failure
+    void Save(const Image& image, const char* path);
+} // namespace yuv